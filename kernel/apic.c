@@ -0,0 +1,193 @@
+/* apic.c - Local APIC setup, timer and inter-processor interrupts
+ * vim:ts=4
+ */
+
+#include "apic.h"
+#include "i8259.h"
+#include "idt.h"
+#include "ioapic.h"
+#include "lib.h"
+#include "schedule.h"
+#include "smp.h"
+#include "tsc.h"
+
+/* Delays from the Intel MultiProcessor Specification (B.4) */
+#define INIT_DELAY_US 10000
+#define SIPI_DELAY_US 200
+
+/* How long the timer is counted against the TSC */
+#define TIMER_CALIBRATE_MS 10
+
+volatile uint32_t *lapic = NULL;
+
+// Initial count of the timer for one tick. Every processor shares the bus
+// clock, so the boot processor's calibration is used by all of them.
+static uint32_t lapic_timer_count;
+
+irq_stat_t lapic_timer_stats[MAX_CPUS];
+
+/* Busy waits until the last IPI has been accepted */
+static void lapic_wait_icr(void)
+{
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_SEND_PENDING) {
+        /* wait */
+    }
+}
+
+/*
+ * lapic_init
+ *   DESCRIPTION: Software enables the local APIC of the calling processor and
+ *                lets it accept interrupts of every priority. LINT0/LINT1 are
+ *                left as the BIOS set them, so the 8259 keeps reaching the
+ *                boot processor through virtual wire mode.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Writes the SVR, TPR and ESR of this processor's APIC.
+ */
+void lapic_init(void)
+{
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+
+    /* The ESR must be written before it is read */
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    lapic_eoi();
+}
+
+/* Counts down the timer from its maximum for TIMER_CALIBRATE_MS and derives
+ * the initial count of one tick. */
+static void lapic_timer_calibrate(void)
+{
+    uint32_t elapsed;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    udelay(TIMER_CALIBRATE_MS * 1000);
+    elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_timer_count = elapsed / TIMER_CALIBRATE_MS * (1000 / TICK_HZ);
+}
+
+void lapic_timer_start(void)
+{
+    if (lapic_timer_count == 0) {
+        return;
+    }
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LOCAL_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+/* Returns the TSC cycles since the timer of the calling processor fired */
+static uint32_t lapic_timer_age(void)
+{
+    uint32_t elapsed = lapic_timer_count - lapic_read(LAPIC_TIMER_CURRENT);
+
+    return div64_32((uint64_t)elapsed * tsc_khz * (1000 / TICK_HZ), lapic_timer_count);
+}
+
+void local_timer_interrupt(void)
+{
+    irq_stat_t *stat = &lapic_timer_stats[this_cpu()->id];
+    uint64_t start = rdtsc();
+
+    hist_add(&stat->latency, lapic_timer_age());
+    sched_tick();
+    hist_add(&stat->duration, rdtsc() - start);
+}
+
+/*
+ * apic_init
+ *   DESCRIPTION: Enables the local APIC of the boot processor, hands the
+ *                device interrupts to the IO APIC and replaces the PIT with
+ *                the local APIC timer as the scheduler tick. Without an IO
+ *                APIC the 8259 keeps delivering device interrupts through
+ *                virtual wire mode; without a local APIC nothing changes.
+ *   INPUTS: none
+ *   OUTPUTS: Prints which interrupt controller is in use.
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Masks IRQ 0 at the 8259 once the local timer runs. Needs
+ *                 paging (for the APIC registers) and tsc_init().
+ */
+void apic_init(void)
+{
+    if (lapic == NULL) {
+        printf("APIC: none, using the 8259\n");
+        return;
+    }
+    lapic_init();
+
+    if (ioapic_init() == 0) {
+        printf("APIC: device interrupts routed through the IO APIC\n");
+    } else {
+        printf("APIC: no IO APIC, using the 8259 for device interrupts\n");
+    }
+
+    lapic_timer_calibrate();
+    if (lapic_timer_count == 0) {
+        printf("APIC: timer did not count, keeping the PIT\n");
+        return;
+    }
+    disable_irq(0);
+    lapic_timer_start();
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic_read(LAPIC_ID) >> ICR_DEST_SHIFT;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector)
+{
+    lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+    lapic_write(LAPIC_ICR_LOW, ICR_FIXED | ICR_ASSERT | vector);
+    lapic_wait_icr();
+}
+
+void lapic_send_ipi_all_but_self(uint32_t vector)
+{
+    lapic_write(LAPIC_ICR_LOW, ICR_ALL_BUT_SELF | ICR_FIXED | ICR_ASSERT | vector);
+    lapic_wait_icr();
+}
+
+/*
+ * lapic_start_ap
+ *   DESCRIPTION: Wakes up an application processor with INIT followed by two
+ *                STARTUP IPIs, as in the MP specification.
+ *   INPUTS: apic_id -- APIC ID of the processor to start
+ *           start_addr -- physical address of its real mode entry point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Busy waits about 10.4 ms. Needs tsc_init() to have run.
+ */
+void lapic_start_ap(uint32_t apic_id, uint32_t start_addr)
+{
+    int i;
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+    lapic_write(LAPIC_ICR_LOW, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    lapic_wait_icr();
+    udelay(SIPI_DELAY_US);
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+    lapic_write(LAPIC_ICR_LOW, ICR_INIT | ICR_LEVEL);
+    lapic_wait_icr();
+    udelay(INIT_DELAY_US);
+
+    for (i = 0; i < 2; i++) {
+        lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+        lapic_write(LAPIC_ICR_LOW, ICR_STARTUP | (start_addr >> 12));
+        udelay(SIPI_DELAY_US);
+        lapic_wait_icr();
+    }
+}
@@ -0,0 +1,112 @@
+/* apic.h - Local APIC used for the scheduler tick and to start and interrupt
+ * the other processors
+ * vim:ts=4
+ */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+/* Where the local APIC registers are unless the MP table says otherwise */
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+/* 4 MB region holding the IO APIC and local APIC registers. Mapped
+ * uncached in every page directory. */
+#define APIC_MMIO_BASE 0xFEC00000
+
+/* Local APIC register offsets (in bytes) */
+#define LAPIC_ID 0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+/* Spurious vector register: software enable bit */
+#define LAPIC_SVR_ENABLE 0x100
+
+/* Local vector table entry bits */
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+
+/* Timer divide configuration: bus clock / 16 */
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+/* Scheduler ticks per second of the local APIC timer */
+#define TICK_HZ 100
+
+/* Interrupt command register fields */
+#define ICR_FIXED 0x00000
+#define ICR_INIT 0x00500
+#define ICR_STARTUP 0x00600
+#define ICR_SEND_PENDING 0x01000
+#define ICR_ASSERT 0x04000
+#define ICR_LEVEL 0x08000
+#define ICR_ALL_BUT_SELF 0xC0000
+#define ICR_DEST_SHIFT 24
+
+/* Vectors used by the local APIC. Above the PIC and syscall vectors. The
+ * timer is in a lower priority class than the IPIs. */
+#define LOCAL_TIMER_VECTOR 0xEF
+#define RESCHEDULE_VECTOR 0xF0
+#define TLB_FLUSH_VECTOR 0xF1
+#define SPURIOUS_VECTOR 0xFF
+
+#ifndef ASM
+
+// Virtual (= physical) address of this processor's local APIC registers.
+// NULL if the machine has no MP table, in which case only one processor runs.
+extern volatile uint32_t *lapic;
+
+/* Reads a local APIC register */
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / sizeof(uint32_t)];
+}
+
+/* Writes a local APIC register */
+static inline void lapic_write(uint32_t reg, uint32_t val)
+{
+    lapic[reg / sizeof(uint32_t)] = val;
+}
+
+// Enables the local APIC of the calling processor.
+void lapic_init(void);
+
+// Sets up the local APIC and IO APIC of the boot processor and starts its
+// timer. Falls back to the 8259 and the PIT if either is missing.
+void apic_init(void);
+
+// Starts the periodic scheduler tick of the calling processor. Does nothing
+// unless apic_init() calibrated the timer.
+void lapic_timer_start(void);
+
+// Handler of LOCAL_TIMER_VECTOR, called from idt.c.
+void local_timer_interrupt(void);
+
+// Returns the APIC ID of the calling processor.
+uint32_t lapic_id(void);
+
+// Signals the end of the interrupt currently being serviced.
+void lapic_eoi(void);
+
+// Sends interrupt |vector| to the processor with APIC ID |apic_id|.
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+
+// Sends interrupt |vector| to every processor except the caller.
+void lapic_send_ipi_all_but_self(uint32_t vector);
+
+// Runs the INIT-SIPI-SIPI sequence that starts processor |apic_id| in real
+// mode at physical address |start_addr| (must be 4 KB aligned and below 1 MB).
+void lapic_start_ap(uint32_t apic_id, uint32_t start_addr);
+
+#endif /* ASM */
+#endif /* _APIC_H */
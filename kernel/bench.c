@@ -0,0 +1,703 @@
+/* bench.c - In-kernel microbenchmarks
+ * vim:ts=4
+ */
+
+#include "bench.h"
+
+#ifdef BENCHMARK
+
+#include "lib.h"
+#include "pt.h"
+#include "switch.h"
+#include "tsc.h"
+#include "x86_desc.h"
+#include "smp.h"
+#include "apic.h"
+#include "i8259.h"
+#include "kthread.h"
+#include "rtc.h"
+#include "schedule.h"
+#include "syscall.h"
+#include "idt.h"
+#include "pcb.h"
+#include "sys_execute.h"
+#include "sys_waitpid.h"
+#include "frame.h"
+#include "keyboard.h"
+#include "terminal.h"
+#include "wait.h"
+#include "stats.h"
+
+/* Number of times each of the two yielding threads (or contexts) switches to
+ * the other */
+#define BENCH_SWITCH_ROUNDS 100000
+/* Size of the private stacks of the benchmark contexts */
+#define BENCH_STACK_SIZE 4096
+/* Timer IRQs (the PIT runs at 18.2 Hz) and keyboard IRQs each way of
+ * acknowledging 8259 IRQs is timed over */
+#define BENCH_IRQ_TICKS 16
+#define BENCH_IRQ_KEYS 64
+/* Keyboard controller status port, its input buffer full bit, and the
+ * command that hands the next byte written to the data port back as if the
+ * keyboard sent it, raising IRQ 1 */
+#define BENCH_KBC_STATUS 0x64
+#define BENCH_KBC_INPUT_FULL 0x02
+#define BENCH_KBC_WRITE_KBD 0xD2
+/* Scancode the keyboard IRQs deliver: the space bar released, which the
+ * keyboard driver ignores */
+#define BENCH_KEY_SCANCODE 0xB9
+/* Longest wait for one keyboard IRQ, in milliseconds */
+#define BENCH_KEY_TIMEOUT_MS 10
+/* RTC rate and number of periods the jitter benchmark waits for */
+#define BENCH_RTC_FREQ 128
+#define BENCH_JITTER_PERIODS 256
+/* Most CPU hog threads started as background load */
+#define BENCH_MAX_HOGS 2
+/* Programs run per exec benchmark run, and the command: cat prints one line
+ * for a file that isn't there and halts */
+#define BENCH_EXEC_ROUNDS 1000
+#define BENCH_EXEC_COMMAND "cat nosuchfile"
+/* Terminal the programs run on: the last one, which nobody looks at before
+ * its shell is opened */
+#define BENCH_TERMINAL (MAX_TERMINAL - 1)
+/* Children the spawn and waitpid self-test has running at once */
+#define BENCH_SPAWN_CHILDREN 8
+/* Rounds of the TLB benchmark, and the user pages its loop touches in each */
+#define BENCH_TLB_ROUNDS 10000
+#define BENCH_TLB_PAGES 64
+/* Page global enable bit of CR4 */
+#define CR4_PGE 0x00000080
+/* Null syscalls timed per entry path */
+#define BENCH_SYSCALL_ROUNDS 10000
+/* Where the syscall benchmark's user code runs, and the vector it leaves
+ * user mode through when done */
+#define BENCH_USER_ADDR 0x08000000
+#define BENCH_EXIT_VECTOR 0x81
+/* Offsets in the user page of the two results the user code stores */
+#define BENCH_RESULT_INT80 0x800
+#define BENCH_RESULT_SYSENTER 0x804
+
+// Context of run_benchmarks() and of the two yielding "processes".
+static context_t bench_main_context;
+static context_t bench_contexts[2];
+static uint8_t bench_stacks[2][BENCH_STACK_SIZE] __attribute__((aligned(16)));
+// Second address space, a copy of the kernel's, so the switch reloads CR3.
+static page_directory_t bench_pd __attribute__((aligned(sizeof(page_directory_t))));
+
+// First yielding context. Bounces to the second one for every round and
+// returns to the benchmark when done.
+static void bench_ping(void)
+{
+    int i;
+    for (i = 0; i < BENCH_SWITCH_ROUNDS; i++) {
+        switch_to(&bench_contexts[0], &bench_contexts[1]);
+    }
+    switch_to(&bench_contexts[0], &bench_main_context);
+}
+
+// Second yielding context. Only ever switches back to the first one.
+static void bench_pong(void)
+{
+    while (1) {
+        switch_to(&bench_contexts[1], &bench_contexts[0]);
+    }
+}
+
+// Points |context| at a fresh stack that "returns" into |func|.
+static void bench_init_context(context_t *context, uint8_t *stack, void (*func)(void), uint32_t cr3)
+{
+    uint32_t *esp = (uint32_t *)(stack + BENCH_STACK_SIZE);
+
+    memset(context, 0x00, sizeof(context_t));
+    *--esp = (uint32_t)func;
+    context->esp = (uint32_t)esp;
+    context->esp0 = this_cpu()->tss.esp0;
+    context->cr3 = cr3;
+}
+
+// Runs one ping-pong and prints the per switch cost.
+static void bench_switch_run(const int8_t *name, uint32_t pong_cr3)
+{
+    unsigned long flags;
+    uint32_t cr3;
+    uint64_t start, end;
+    uint32_t cycles;
+
+    // The calling thread must not be switched away from while its context
+    // is parked in bench_main_context.
+    cli_and_save(flags);
+    GET_CR3(cr3);
+    bench_init_context(&bench_contexts[0], bench_stacks[0], bench_ping, cr3);
+    bench_init_context(&bench_contexts[1], bench_stacks[1], bench_pong, pong_cr3);
+    bench_main_context.cr3 = cr3;
+    bench_main_context.esp0 = this_cpu()->tss.esp0;
+
+    start = rdtsc();
+    switch_to(&bench_main_context, &bench_contexts[0]);
+    end = rdtsc();
+    restore_flags(flags);
+
+    // Every round is two switches, plus entering and leaving ping.
+    cycles = div64_32(end - start, 2 * BENCH_SWITCH_ROUNDS + 2);
+    printf("  raw switch_to(), %s: %u cycles/switch, %u switches/s\n", name, cycles,
+           cycles ? div64_32((uint64_t)tsc_khz * 1000, cycles) : 0);
+}
+
+// The two threads yielding to each other through schedule(): how many got
+// going and how many are done, protected by the lock of |bench_yield_wq|,
+// and when the second got going and the last one finished.
+static wait_queue_t bench_yield_wq = WAIT_QUEUE_INIT;
+static int32_t bench_yield_ready;
+static int32_t bench_yield_done;
+static uint64_t bench_yield_start;
+static uint64_t bench_yield_end;
+
+// One of the yielding threads. Both are pinned to the same processor, so
+// every schedule() requeues this one and picks the other one, with all the
+// accounting of a real switch.
+static void bench_yield_thread(void *arg)
+{
+    unsigned long flags;
+    int32_t ready;
+    int i;
+
+    // Wait for the other one, or the first rounds would switch to nothing.
+    spin_lock_irqsave(&bench_yield_wq.lock, flags);
+    ready = ++bench_yield_ready;
+    if (ready == 2) {
+        bench_yield_start = rdtsc();
+    }
+    spin_unlock_irqrestore(&bench_yield_wq.lock, flags);
+    while (bench_yield_ready < 2) {
+        schedule();
+    }
+
+    for (i = 0; i < BENCH_SWITCH_ROUNDS; i++) {
+        schedule();
+    }
+
+    spin_lock_irqsave(&bench_yield_wq.lock, flags);
+    bench_yield_end = rdtsc();
+    bench_yield_done++;
+    spin_unlock_irqrestore(&bench_yield_wq.lock, flags);
+    wake_up(&bench_yield_wq);
+}
+
+// Runs the two yielding threads on another processor than the caller, if
+// there is one, and prints the per switch cost.
+static void bench_yield_run(void)
+{
+    int32_t cpu = (this_cpu()->id + 1) % num_cpus;
+    int32_t started = 0;
+    uint32_t cycles;
+
+    bench_yield_ready = 0;
+    bench_yield_done = 0;
+    while (started < 2 && kthread_create_on(bench_yield_thread, NULL, cpu) != -1) {
+        started++;
+    }
+    if (started < 2) {
+        // Let a lone thread go; with nobody to switch to it finishes quickly.
+        printf("  schedule(): no free PCB\n");
+        bench_yield_ready = 2;
+        wait_event(&bench_yield_wq, bench_yield_done == started);
+        return;
+    }
+    wait_event(&bench_yield_wq, bench_yield_done == 2);
+
+    cycles = div64_32(bench_yield_end - bench_yield_start, 2 * BENCH_SWITCH_ROUNDS);
+    printf("  schedule(), two kernel threads on CPU %d: %u cycles/switch, %u switches/s\n",
+           cpu, cycles, cycles ? div64_32((uint64_t)tsc_khz * 1000, cycles) : 0);
+}
+
+void bench_context_switch(void)
+{
+    uint32_t cr3;
+
+    GET_CR3(cr3);
+    memcpy(&bench_pd, (void *)cr3, sizeof(page_directory_t));
+
+    printf("context switch (%u rounds):\n", BENCH_SWITCH_ROUNDS);
+    bench_yield_run();
+    bench_switch_run("same address space", cr3);
+    bench_switch_run("different address space", (uint32_t)&bench_pd);
+}
+
+// Prints the IRQ duration histogram |h| in cycles, with the count of each
+// log2 bucket as bucket:count.
+static void bench_hist_print(const int8_t *name, const hist_t *h)
+{
+    int i;
+
+    printf("    %s: n %u avg %u max %u cycles |", name, h->count,
+           h->count ? div64_32(h->sum, h->count) : 0, h->max);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i]) {
+            printf(" %d:%u", i, h->buckets[i]);
+        }
+    }
+    printf("\n");
+}
+
+// Has the keyboard controller raise IRQ 1 with BENCH_KEY_SCANCODE and waits
+// until do_irq() counted it. Returns false if it didn't come.
+static bool bench_key_irq(void)
+{
+    uint32_t count = irq_stats[1].duration.count;
+    uint64_t timeout = rdtsc() + (uint64_t)BENCH_KEY_TIMEOUT_MS * tsc_khz;
+
+    while (inb(BENCH_KBC_STATUS) & BENCH_KBC_INPUT_FULL) {
+        cpu_relax();
+    }
+    outb(BENCH_KBC_WRITE_KBD, BENCH_KBC_STATUS);
+    while (inb(BENCH_KBC_STATUS) & BENCH_KBC_INPUT_FULL) {
+        cpu_relax();
+    }
+    outb(BENCH_KEY_SCANCODE, KEYBOARD_IN);
+
+    while (irq_stats[1].duration.count == count) {
+        if (rdtsc() > timeout) {
+            return false;
+        }
+        cpu_relax();
+    }
+    return true;
+}
+
+// Takes BENCH_IRQ_KEYS keyboard IRQs and BENCH_IRQ_TICKS timer IRQs with
+// interrupts enabled, and prints their duration histograms from irq_stats[].
+// The samples stay in irq_stats[] afterwards.
+static void bench_irq_run(const int8_t *name)
+{
+    hist_t saved[2];
+    hist_t taken;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        saved[i] = irq_stats[i].duration;
+        memset(&irq_stats[i].duration, 0, sizeof(hist_t));
+    }
+
+    sti();
+    for (i = 0; i < BENCH_IRQ_KEYS && bench_key_irq(); i++) {
+    }
+    while (irq_stats[0].duration.count < BENCH_IRQ_TICKS) {
+        cpu_relax();
+    }
+    cli();
+
+    printf("  %s:\n", name);
+    bench_hist_print("timer", &irq_stats[0].duration);
+    bench_hist_print("keyboard", &irq_stats[1].duration);
+
+    for (i = 0; i < 2; i++) {
+        taken = irq_stats[i].duration;
+        irq_stats[i].duration = saved[i];
+        hist_merge(&irq_stats[i].duration, &taken);
+    }
+}
+
+void bench_irq_ack(void)
+{
+    int32_t aeoi = i8259_aeoi;
+
+    printf("8259 IRQ duration, entry to acknowledge (%u timer, %u keyboard IRQs):\n",
+           BENCH_IRQ_TICKS, BENCH_IRQ_KEYS);
+
+    // What irq_handler_wrapper used to do around every handler.
+    i8259_set_aeoi(0);
+    irq_old_ack = 1;
+    bench_irq_run("EOI + mask/unmask");
+    irq_old_ack = 0;
+
+    // What do_irq() does now, with and without automatic EOI.
+    bench_irq_run("cached masks, EOI");
+    i8259_set_aeoi(1);
+    bench_irq_run("cached masks, AEOI");
+
+    i8259_set_aeoi(aeoi);
+}
+
+// User page of the syscall benchmark: its code at the start, the results in
+// the middle and its stack at the end.
+static uint8_t bench_user_page[1 << NUM_4KB_OFFSET_BITS] __attribute__((aligned(1 << NUM_4KB_OFFSET_BITS)));
+static pte_t bench_user_pt[NUM_PTE_ENTRIES] __attribute__((aligned(sizeof(page_table_t))));
+
+// User mode part of the syscall benchmark, copied to BENCH_USER_ADDR. Times
+// %esi getpid calls through int 0x80 and then through the vsyscall page and
+// stores the TSC cycles both took.
+void bench_user_code();
+extern uint8_t bench_user_code_end[];
+asm("bench_user_code:"
+    "      movl    $" STRINGIFY2(VSYSCALL_ADDR) ", %ebx;"
+    "      rdtsc;"
+    "      movl    %eax, %ebp;"
+    "      movl    %esi, %edi;"
+    "1:    movl    $" STRINGIFY2(SYS_GETPID) ", %eax;"
+    "      int     $0x80;"
+    "      decl    %edi;"
+    "      jnz     1b;"
+    "      rdtsc;"
+    "      subl    %ebp, %eax;"
+    "      movl    %eax, " STRINGIFY2(BENCH_USER_ADDR + BENCH_RESULT_INT80) ";"
+    "      rdtsc;"
+    "      movl    %eax, %ebp;"
+    "      movl    %esi, %edi;"
+    "2:    movl    $" STRINGIFY2(SYS_GETPID) ", %eax;"
+    "      call    *%ebx;"
+    "      decl    %edi;"
+    "      jnz     2b;"
+    "      rdtsc;"
+    "      subl    %ebp, %eax;"
+    "      movl    %eax, " STRINGIFY2(BENCH_USER_ADDR + BENCH_RESULT_SYSENTER) ";"
+    "      int     $" STRINGIFY2(BENCH_EXIT_VECTOR) ";"
+    "bench_user_code_end:");
+
+// Reached through BENCH_EXIT_VECTOR once the user code is done. Goes back to
+// bench_syscall() and is never resumed.
+void bench_user_exit();
+asm("bench_user_exit:"
+    "      cli;"
+    "      movl    $" STRINGIFY2(KERNEL_DS) ", %eax;"
+    "      movl    %eax, %ds;"
+    "      pushl   $bench_main_context;"
+    "      pushl   $bench_contexts;"
+    "      call    switch_to;");
+
+void bench_syscall(void)
+{
+    idt_desc_t saved_gate = idt[BENCH_EXIT_VECTOR];
+    idt_desc_t gate = idt[0x80];
+    uint32_t *esp;
+    uint32_t cr3;
+
+    printf("null syscall, getpid (%u rounds):\n", BENCH_SYSCALL_ROUNDS);
+
+    // A user page for the code and its stack, in a copy of the kernel's
+    // address space (which has the vsyscall page already).
+    GET_CR3(cr3);
+    memcpy(&bench_pd, (void *)cr3, sizeof(page_directory_t));
+    memcpy(bench_user_page, bench_user_code, bench_user_code_end - (uint8_t *)bench_user_code);
+    map_page_table_entry((page_table_t *)bench_user_pt, BENCH_USER_ADDR, (uint32_t)bench_user_page, P | RW | US);
+    map_page_directory_entry(&bench_pd, BENCH_USER_ADDR, (uint32_t)bench_user_pt, P | RW | US);
+
+    // Same kind of gate as int 0x80, so user mode may raise it.
+    gate.offset_15_00 = (uint32_t)bench_user_exit & 0xFFFF;
+    gate.offset_31_16 = (uint32_t)bench_user_exit >> 16;
+    idt[BENCH_EXIT_VECTOR] = gate;
+
+    // Enter user mode the way a new process does, with the round count in
+    // %esi.
+    esp = (uint32_t *)(bench_stacks[0] + BENCH_STACK_SIZE);
+    *--esp = USER_DS;
+    *--esp = BENCH_USER_ADDR + sizeof(bench_user_page);
+    *--esp = EFLAGS_IF;
+    *--esp = USER_CS;
+    *--esp = BENCH_USER_ADDR;
+    *--esp = (uint32_t)ret_to_user;
+    memset(&bench_contexts[0], 0x00, sizeof(context_t));
+    bench_contexts[0].esi = BENCH_SYSCALL_ROUNDS;
+    bench_contexts[0].esp = (uint32_t)esp;
+    bench_contexts[0].esp0 = (uint32_t)(bench_stacks[0] + BENCH_STACK_SIZE);
+    bench_contexts[0].cr3 = (uint32_t)&bench_pd;
+    bench_main_context.cr3 = cr3;
+    bench_main_context.esp0 = this_cpu()->tss.esp0;
+
+    switch_to(&bench_main_context, &bench_contexts[0]);
+    idt[BENCH_EXIT_VECTOR] = saved_gate;
+
+    printf("  int 0x80: %u cycles\n",
+           *(uint32_t *)(bench_user_page + BENCH_RESULT_INT80) / BENCH_SYSCALL_ROUNDS);
+    if (cpuid_features() & CPUID_FEATURE_SEP) {
+        printf("  SYSENTER: %u cycles\n",
+               *(uint32_t *)(bench_user_page + BENCH_RESULT_SYSENTER) / BENCH_SYSCALL_ROUNDS);
+    } else {
+        printf("  SYSENTER: not supported, the stub uses int 0x80\n");
+    }
+}
+
+// Tells the CPU hogs of the jitter benchmark to finish.
+static volatile int32_t bench_hogs_stop;
+
+// Background load for the jitter benchmark: spins until told to stop.
+static void bench_hog_thread(void *arg)
+{
+    while (!bench_hogs_stop) {
+        cpu_relax();
+    }
+}
+
+// Waits for BENCH_JITTER_PERIODS RTC interrupts and prints how far the gaps
+// between wakeups stray from the RTC period.
+static void bench_jitter_run(const int8_t *name)
+{
+    uint64_t period = div64_32((uint64_t)tsc_khz * 1000, BENCH_RTC_FREQ);
+    uint64_t total = 0;
+    uint64_t prev, now, gap, dev;
+    uint64_t worst = 0;
+    int i;
+
+    // Line up with an interrupt first.
+    rtc_read(0, NULL, 0);
+    prev = rdtsc();
+    for (i = 0; i < BENCH_JITTER_PERIODS; i++) {
+        rtc_read(0, NULL, 0);
+        now = rdtsc();
+        gap = now - prev;
+        dev = (gap > period) ? gap - period : period - gap;
+        total += dev;
+        if (dev > worst) {
+            worst = dev;
+        }
+        prev = now;
+    }
+    printf("  %s: avg %u us, max %u us\n", name,
+           tsc_to_us(div64_32(total, BENCH_JITTER_PERIODS)), tsc_to_us(worst));
+}
+
+// Runs as a kernel thread once the scheduler is up, since it needs the RTC
+// interrupt and other threads to compete with.
+static void bench_jitter_thread(void *arg)
+{
+    int32_t hogs = 0;
+
+    while (hogs < num_cpus && hogs < BENCH_MAX_HOGS &&
+           kthread_create(bench_hog_thread, NULL) != -1) {
+        hogs++;
+    }
+    rtc_set_freq(BENCH_RTC_FREQ);
+
+    printf("RTC wakeup jitter (%u Hz, %d CPU hogs):\n", BENCH_RTC_FREQ, hogs);
+    bench_jitter_run("SCHED_NORMAL");
+    sched_setscheduler(-1, SCHED_FIFO, RT_PRIO_MAX);
+    bench_jitter_run("SCHED_FIFO");
+
+    bench_hogs_stop = 1;
+    rtc_set_freq(DEFAULT_FREQ);
+}
+
+void bench_rt_jitter(void)
+{
+    bench_hogs_stop = 0;
+    if (kthread_create(bench_jitter_thread, NULL) == -1) {
+        printf("RTC wakeup jitter: no free PCB\n");
+    }
+}
+
+// Wipes what the programs printed on BENCH_TERMINAL, unless somebody opened
+// a shell there meanwhile.
+static void bench_clear_terminal(void)
+{
+    if (!terminal_started_shell[BENCH_TERMINAL]) {
+        terminal_clear_internal(BENCH_TERMINAL);
+    }
+}
+
+// Runs BENCH_EXEC_ROUNDS programs one after the other through execute_on(),
+// each until it halts. Returns the cycles one took, -1 if one didn't start.
+static int32_t bench_exec_run(void)
+{
+    uint64_t start, end;
+    int i;
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_EXEC_ROUNDS; i++) {
+        if (execute_on((uint8_t *)BENCH_EXEC_COMMAND, BENCH_TERMINAL) == -1) {
+            break;
+        }
+    }
+    end = rdtsc();
+    bench_clear_terminal();
+
+    return (i == BENCH_EXEC_ROUNDS) ? (int32_t)div64_32(end - start, BENCH_EXEC_ROUNDS) : -1;
+}
+
+void bench_exec(void)
+{
+    static const int8_t *names[2] = {"no pool", "pool"};
+    int32_t cycles[2];
+    int i;
+
+    pcb_pool_set_limit(0);
+    cycles[0] = bench_exec_run();
+    pcb_pool_set_limit(PCB_POOL_MAX);
+    cycles[1] = bench_exec_run();
+
+    printf("execute + halt of " BENCH_EXEC_COMMAND " (%u rounds):\n", BENCH_EXEC_ROUNDS);
+    for (i = 0; i < 2; i++) {
+        if (cycles[i] == -1) {
+            printf("  %s: could not start " BENCH_EXEC_COMMAND "\n", names[i]);
+        } else {
+            printf("  %s: %u cycles/process, %u processes/s\n", names[i], cycles[i],
+                   cycles[i] ? div64_32((uint64_t)tsc_khz * 1000, cycles[i]) : 0);
+        }
+    }
+}
+
+// Crosses |pid| off the |count| children in |pids|. Returns false if it
+// isn't one of them, or was collected already.
+static bool bench_spawn_collect(int32_t *pids, int32_t count, int32_t pid)
+{
+    int32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (pids[i] == pid) {
+            pids[i] = -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void bench_spawn_wait(void)
+{
+    int32_t pids[BENCH_SPAWN_CHILDREN];
+    int32_t started, collected = 0, polled;
+    uint64_t start, end;
+    bool ok = true;
+    int32_t pid;
+    int32_t i;
+
+    start = rdtsc();
+    for (started = 0; started < BENCH_SPAWN_CHILDREN; started++) {
+        pids[started] = spawn_on((uint8_t *)BENCH_EXEC_COMMAND, BENCH_TERMINAL);
+        if (pids[started] == -1) {
+            break;
+        }
+    }
+
+    // The children run on whatever processors are free. Take the ones that
+    // halted already without waiting...
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        ok = ok && bench_spawn_collect(pids, started, pid);
+        collected++;
+    }
+    if (pid == -1 && collected < started) {
+        ok = false;
+    }
+    polled = collected;
+    // ...then wait for each of the others by pid, while the rest halt and
+    // wake the wait queue too.
+    for (i = 0; i < started && ok; i++) {
+        if (pids[i] == -1) {
+            continue;
+        }
+        pid = waitpid(pids[i], NULL, 0);
+        ok = (pid > 0) && bench_spawn_collect(pids, started, pid);
+        collected++;
+    }
+    end = rdtsc();
+
+    // Nothing is left to collect, with or without waiting.
+    if (waitpid(-1, NULL, WNOHANG) != -1 || waitpid(-1, NULL, 0) != -1) {
+        ok = false;
+    }
+    bench_clear_terminal();
+
+    printf("spawn + waitpid of %d children: %s, %d collected without waiting, %u cycles\n",
+           started, (ok && started == BENCH_SPAWN_CHILDREN) ? "ok" : "FAILED", polled,
+           (uint32_t)(end - start));
+}
+
+// Runs the benchmarks that need the scheduler, once it is up.
+static void bench_sched_thread(void *arg)
+{
+    bench_context_switch();
+    bench_spawn_wait();
+    bench_exec();
+    bench_rt_jitter();
+}
+
+// Runs the echo and page loop rounds in the loaded address space, whose user
+// memory holds the pages. With |old_kernel| set, turns global pages off and
+// echoes over the kernel page directory, as the keyboard handler used to.
+static void bench_tlb_run(const int8_t *name, bool old_kernel)
+{
+    volatile uint32_t *pages = (volatile uint32_t *)USER_MEMORY;
+    uint64_t start, end;
+    uint32_t cycles;
+    uint32_t cr3, cr4;
+    int i, j;
+
+    GET_CR3(cr3);
+    asm volatile("movl %%cr4, %0"
+                 : "=r"(cr4));
+    if (old_kernel) {
+        asm volatile("movl %0, %%cr4"
+                     :
+                     : "r"(cr4 & ~CR4_PGE)
+                     : "memory");
+    }
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_TLB_ROUNDS; i++) {
+        if (old_kernel) {
+            SET_CR3(pd_kernel);
+        }
+        echo('x');
+        if (old_kernel) {
+            SET_CR3(cr3);
+        }
+        // Take the key back the way a backspace does, so the screen stays.
+        terminal_back_space_helper_internal(visible_terminal);
+        terminal_back_space_internal(visible_terminal);
+
+        for (j = 0; j < BENCH_TLB_PAGES; j++) {
+            pages[j * (FRAME_SIZE / sizeof(uint32_t))]++;
+        }
+    }
+    end = rdtsc();
+
+    // Turning PGE back on flushes the TLB, global entries too.
+    asm volatile("movl %0, %%cr4"
+                 :
+                 : "r"(cr4)
+                 : "memory");
+    terminal_cursor(get_cursor_row_index(visible_terminal), get_cursor_col_index(visible_terminal));
+
+    cycles = div64_32(end - start, BENCH_TLB_ROUNDS);
+    printf("  %s: %u cycles/round\n", name, cycles);
+}
+
+void bench_tlb(void)
+{
+    page_directory_t *page_directory = pd_alloc();
+    uint32_t cr3;
+    int i;
+
+    printf("keyboard echo + %u page loop (%u rounds):\n", BENCH_TLB_PAGES, BENCH_TLB_ROUNDS);
+    if (page_directory == NULL) {
+        printf("  out of memory\n");
+        return;
+    }
+    // A process-like address space with the pages in its user memory.
+    for (i = 0; i < BENCH_TLB_PAGES; i++) {
+        if (user_page_alloc(page_directory, USER_MEMORY + i * FRAME_SIZE, RW) == 0) {
+            printf("  out of memory\n");
+            user_space_free(page_directory);
+            frame_free((uint32_t)page_directory, 0);
+            return;
+        }
+    }
+
+    GET_CR3(cr3);
+    SET_CR3(page_directory);
+    bench_tlb_run("CR3 switch, no global pages", true);
+    bench_tlb_run("global pages", false);
+    SET_CR3(cr3);
+
+    user_space_free(page_directory);
+    frame_free((uint32_t)page_directory, 0);
+}
+
+void run_benchmarks(void)
+{
+    printf("Running benchmarks\n");
+    bench_syscall();
+    bench_tlb();
+    if (kthread_create(bench_sched_thread, NULL) == -1) {
+        printf("context switch, exec and RTC wakeup jitter: no free PCB\n");
+    }
+}
+
+#endif /* BENCHMARK */
@@ -0,0 +1,66 @@
+/* bench.h - In-kernel microbenchmarks, run at boot when built with
+ * `make BENCH=1`
+ * vim:ts=4
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "types.h"
+
+#ifdef BENCHMARK
+
+// Runs every benchmark but bench_irq_ack() and prints the results. Called
+// from entry() with interrupts disabled, before the first shell starts.
+void run_benchmarks(void);
+
+// Two kernel threads pinned to one processor yielding to each other through
+// schedule(), so every switch goes through the run queue, the accounting
+// and switch_to_process(). Then, as a lower bound, two bare contexts
+// bouncing through switch_to() alone, once sharing the address space and
+// once in different ones. Prints cycles per switch and switches per second.
+// Must run in a kernel thread, which waits for the two threads.
+void bench_context_switch(void);
+
+// Duration histograms (from irq_stats[]) of real timer and keyboard IRQs
+// through the 8259, acknowledged the old way (EOI plus an uncached mask and
+// unmask of the line) and the current one (cached masks and one EOI, or
+// nothing in AEOI mode). The keyboard IRQs come from the keyboard controller
+// echoing a key release. Called from entry() with interrupts disabled, after
+// tsc_init() and before apic_init() hands the IRQs to the IO APIC. Enables
+// interrupts for a few seconds.
+void bench_irq_ack(void);
+
+// Null syscall (getpid) latency from user mode, through int 0x80 and through
+// the SYSENTER stub in the vsyscall page.
+void bench_syscall(void);
+
+// Process creation throughput: runs a short program through execute() until
+// it halts, over and over, once allocating everything and once reusing
+// exited processes from the PCB pool. Prints cycles per process and
+// processes per second. Must run in a kernel thread, which waits for every
+// program in execute_on(). The programs print on the last terminal, which is
+// cleared again afterwards.
+void bench_exec(void);
+
+// Self-test of spawn() and waitpid(): starts BENCH_SPAWN_CHILDREN short
+// programs at once, collects the ones that halted with WNOHANG and waits for
+// the others by pid. Prints whether every child was collected exactly once,
+// and the cycles it all took. Must run in a kernel thread, which is the
+// parent of the programs.
+void bench_spawn_wait(void);
+
+// Cost of the keyboard echo to a process that keeps its working set in the
+// TLB: echoes a key (and erases it again) between passes of a loop over
+// BENCH_TLB_PAGES user pages, once the old way, switching to the kernel page
+// directory around the echo without global pages, and once as it is now.
+// Prints cycles per round.
+void bench_tlb(void);
+
+// Measures how late a task woken by every RTC interrupt runs, as a normal
+// and as a SCHED_FIFO process, while CPU hogs compete with it. Runs from a
+// kernel thread, so the results are printed once the scheduler starts.
+void bench_rt_jitter(void);
+
+#endif /* BENCHMARK */
+#endif /* _BENCH_H */
@@ -0,0 +1,135 @@
+/* elf.c - Loader of ELF32 executables
+ * vim:ts=4
+ *
+ * Only the program headers matter. Every PT_LOAD segment is mapped page by
+ * page at its p_vaddr, with p_filesz bytes from p_offset in the file and
+ * zeros up to p_memsz. Pages that hold file data are filled in right away.
+ * The zeros of a writable segment, its bss, come from the page fault
+ * handler, which maps a zeroed writable page on first touch, so a big bss
+ * costs nothing until it is used. A read-only segment is mapped in full,
+ * since those pages would come out writable.
+ */
+
+#include "elf.h"
+#include "fs.h"
+#include "lib.h"
+#include "pt.h"
+#include "frame.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/* Returns 1 if |ehdr| is the header of an i386 executable */
+static int32_t elf_header_ok(const elf32_ehdr_t *ehdr)
+{
+    return *(uint32_t *)ehdr->e_ident == ELF_MAGIC &&
+           ehdr->e_ident[ELF_IDENT_CLASS] == ELF_CLASS_32 &&
+           ehdr->e_type == ELF_TYPE_EXEC &&
+           ehdr->e_machine == ELF_MACHINE_386 &&
+           ehdr->e_phentsize >= sizeof(elf32_phdr_t);
+}
+
+/* Returns 1 if the segment |phdr| lies in the user memory and its file part
+ * in the |length| bytes of the file */
+static int32_t segment_ok(const elf32_phdr_t *phdr, uint32_t length)
+{
+    return phdr->p_filesz <= phdr->p_memsz &&
+           in_user_memory(phdr->p_vaddr) &&
+           phdr->p_memsz <= USER_MEMORY + USER_MEMORY_SIZE - phdr->p_vaddr &&
+           phdr->p_offset <= length &&
+           phdr->p_filesz <= length - phdr->p_offset;
+}
+
+/* Maps the pages of the segment |phdr| of the file in |inode| that are
+ * filled in up front and reads in its file part. Returns the pages that were
+ * not mapped before, or -1 if memory ran out or the file is short. */
+static int32_t load_segment(uint32_t inode, page_directory_t *page_directory, const elf32_phdr_t *phdr)
+{
+    uint32_t flags = (phdr->p_flags & PF_W) ? RW : 0;
+    uint32_t file_end = phdr->p_vaddr + phdr->p_filesz;
+    uint32_t end = flags ? file_end : phdr->p_vaddr + phdr->p_memsz;
+    uint32_t page, frame, from, to;
+    int32_t pages = 0;
+
+    for (page = phdr->p_vaddr & ~(FRAME_SIZE - 1); page < end; page += FRAME_SIZE) {
+        // Segments that are not page aligned may share a page.
+        if (user_page_lookup(page_directory, page) == 0) {
+            pages++;
+        }
+        frame = user_page_alloc(page_directory, page, flags);
+        if (frame == 0) {
+            return -1;
+        }
+
+        // The part of the page backed by the file.
+        from = MAX(page, phdr->p_vaddr);
+        to = MIN(page + FRAME_SIZE, file_end);
+        if (from < to &&
+            read_data(inode, phdr->p_offset + (from - phdr->p_vaddr), (uint8_t *)frame + (from - page), to - from) != to - from) {
+            return -1;
+        }
+    }
+    return pages;
+}
+
+/* Reads program header |i| of the file in |inode| with header |ehdr| into
+ * |phdr|. Returns 0, or -1 if the file is short. */
+static int32_t read_phdr(uint32_t inode, const elf32_ehdr_t *ehdr, int32_t i, elf32_phdr_t *phdr)
+{
+    if (read_data(inode, ehdr->e_phoff + i * ehdr->e_phentsize, (uint8_t *)phdr, sizeof(*phdr)) != sizeof(*phdr)) {
+        return -1;
+    }
+    return 0;
+}
+
+int32_t elf_check(uint32_t inode)
+{
+    uint32_t length = inodes[inode].length;
+    elf32_ehdr_t ehdr;
+    elf32_phdr_t phdr;
+    int i;
+
+    if (read_data(inode, 0, (uint8_t *)&ehdr, sizeof(ehdr)) != sizeof(ehdr) || !elf_header_ok(&ehdr) ||
+        !in_user_memory(ehdr.e_entry)) {
+        return -1;
+    }
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        if (read_phdr(inode, &ehdr, i, &phdr) == -1) {
+            return -1;
+        }
+        if (phdr.p_type == PT_LOAD && phdr.p_memsz != 0 && !segment_ok(&phdr, length)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int32_t elf_load(uint32_t inode, page_directory_t *page_directory, uint32_t *entry)
+{
+    elf32_ehdr_t ehdr;
+    elf32_phdr_t phdr;
+    int32_t pages = 0;
+    int32_t mapped;
+    int i;
+
+    // Nothing is mapped for a file that is no good.
+    if (elf_check(inode) == -1) {
+        return -1;
+    }
+    read_data(inode, 0, (uint8_t *)&ehdr, sizeof(ehdr));
+
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        read_phdr(inode, &ehdr, i, &phdr);
+        if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0) {
+            continue;
+        }
+        mapped = load_segment(inode, page_directory, &phdr);
+        if (mapped == -1) {
+            return -1;
+        }
+        pages += mapped;
+    }
+
+    *entry = ehdr.e_entry;
+    return pages;
+}
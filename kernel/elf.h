@@ -0,0 +1,77 @@
+/* elf.h - Loader of ELF32 executables
+ * vim:ts=4
+ */
+
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "types.h"
+
+// First 4 bytes of an ELF file, 0x7f 'E' 'L' 'F'. Reversed for little endian.
+#define ELF_MAGIC 0x464c457f
+
+// Index and value in e_ident of the class of 32 bit files.
+#define ELF_IDENT_CLASS 4
+#define ELF_CLASS_32 1
+
+// e_type of an executable and e_machine of the i386.
+#define ELF_TYPE_EXEC 2
+#define ELF_MACHINE_386 3
+
+// p_type of a segment to be loaded into memory.
+#define PT_LOAD 1
+
+// Bits in p_flags. x86 pages without PAE can't keep readable pages from
+// being executed, so only PF_W makes a difference.
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+#ifndef ASM
+
+struct page_directory;
+
+/* ELF file header */
+typedef struct elf32_ehdr {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} elf32_ehdr_t;
+
+/* Program header, one per segment */
+typedef struct elf32_phdr {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} elf32_phdr_t;
+
+// Returns 0 if the file in |inode| is an i386 executable whose PT_LOAD
+// segments all lie in the user memory, -1 if not.
+int32_t elf_check(uint32_t inode);
+
+// Maps the PT_LOAD segments of the executable in |inode| into the empty user
+// memory of |page_directory| at their p_vaddr, writable only if they have
+// PF_W, and reads in their file parts. The rest of a writable segment is left
+// to the page fault handler. Sets |*entry| to the entry point.
+// Return: the pages mapped, -1 if elf_check() fails, in which case nothing is
+//         mapped, or memory ran out. The caller frees what was mapped.
+int32_t elf_load(uint32_t inode, struct page_directory *page_directory, uint32_t *entry);
+
+#endif /* ASM */
+#endif /* _ELF_H */
@@ -0,0 +1,344 @@
+/* frame.c - Buddy allocator of physical page frames
+ * vim:ts=4
+ *
+ * Free blocks of 2^order frames sit on one list per order, linked through
+ * their first bytes, which the kernel can reach since all managed memory is
+ * mapped at its physical address. A block's buddy is the block of the same
+ * size it was split from, found by flipping bit |order| of the frame number,
+ * and the two are merged again as soon as both are free.
+ */
+
+#include "frame.h"
+#include "lib.h"
+#include "spinlock.h"
+#include "stats.h"
+
+/* Frames below LOWMEM_LIMIT, the most that can be managed */
+#define LOWMEM_FRAMES (LOWMEM_LIMIT >> FRAME_SHIFT)
+
+/* Most RAM regions and boot modules remembered from the multiboot info */
+#define MAX_RAM_REGIONS 16
+
+/* frame_state[] of the first frame of a free block is FRAME_FREE | order, of
+ * an allocated block its order. Every other frame is 0. */
+#define FRAME_FREE 0x80
+
+/* Multiboot memory map type of usable RAM */
+#define MMAP_TYPE_RAM 1
+
+/* Flag bits in multiboot_info_t.flags */
+#define MBI_FLAG_MEM 0
+#define MBI_FLAG_MODS 3
+#define MBI_FLAG_MMAP 6
+
+typedef struct mem_region {
+    uint32_t start;
+    uint32_t end;
+} mem_region_t;
+
+/* A free block, written at its own address */
+typedef struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+uint32_t lowmem_end = FRAME_BASE;
+
+static mem_region_t ram_regions[MAX_RAM_REGIONS];
+static int32_t num_ram_regions;
+static mem_region_t module_regions[MAX_RAM_REGIONS];
+static int32_t num_module_regions;
+
+static uint8_t frame_state[LOWMEM_FRAMES];
+/* References to each allocated single frame. Set to 1 by frame_alloc(); more
+ * are taken by address spaces sharing the frame copy-on-write. */
+static uint16_t frame_refs[LOWMEM_FRAMES];
+static free_block_t *free_lists[FRAME_MAX_ORDER + 1];
+
+/* Free blocks and how often each order was allocated, freed and not
+ * available */
+static uint32_t free_blocks[FRAME_MAX_ORDER + 1];
+static uint32_t alloc_count[FRAME_MAX_ORDER + 1];
+static uint32_t free_count[FRAME_MAX_ORDER + 1];
+static uint32_t fail_count[FRAME_MAX_ORDER + 1];
+
+/* Frames managed and frames free */
+static uint32_t total_frames;
+static uint32_t nr_free;
+
+static spinlock_t frame_lock = SPINLOCK_INIT;
+
+/* Adds [start, end) to |regions| */
+static void add_region(mem_region_t *regions, int32_t *num, uint32_t start, uint32_t end)
+{
+    if (start >= end || *num == MAX_RAM_REGIONS) {
+        return;
+    }
+    regions[*num].start = start;
+    regions[*num].end = end;
+    (*num)++;
+}
+
+void frame_scan_mmap(multiboot_info_t *mbi)
+{
+    int32_t i;
+
+    if (mbi->flags & (1 << MBI_FLAG_MMAP)) {
+        memory_map_t *mmap;
+
+        for (mmap = (memory_map_t *)mbi->mmap_addr;
+             (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+             mmap = (memory_map_t *)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+            uint64_t start = ((uint64_t)mmap->base_addr_high << 32) | mmap->base_addr_low;
+            uint64_t end = start + (((uint64_t)mmap->length_high << 32) | mmap->length_low);
+
+            if (mmap->type != MMAP_TYPE_RAM || start >= LOWMEM_LIMIT) {
+                continue;
+            }
+            if (end > LOWMEM_LIMIT) {
+                end = LOWMEM_LIMIT;
+            }
+            if (start < FRAME_BASE) {
+                start = FRAME_BASE;
+            }
+            // Whole frames only.
+            start = (start + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+            end &= ~(FRAME_SIZE - 1);
+            add_region(ram_regions, &num_ram_regions, start, end);
+        }
+    } else if (mbi->flags & (1 << MBI_FLAG_MEM)) {
+        // mem_upper is the RAM from 1 MB up, in KB.
+        uint32_t end = 1 * 1024 * 1024 + mbi->mem_upper * 1024;
+
+        if (end > LOWMEM_LIMIT) {
+            end = LOWMEM_LIMIT;
+        }
+        add_region(ram_regions, &num_ram_regions, FRAME_BASE, end & ~(FRAME_SIZE - 1));
+    }
+
+    // The file system image stays where the boot loader put it.
+    if (mbi->flags & (1 << MBI_FLAG_MODS)) {
+        module_t *mod = (module_t *)mbi->mods_addr;
+
+        for (i = 0; i < mbi->mods_count; i++, mod++) {
+            add_region(module_regions, &num_module_regions, mod->mod_start & ~(FRAME_SIZE - 1), mod->mod_end);
+        }
+    }
+
+    for (i = 0; i < num_ram_regions; i++) {
+        // Round up to a whole large page, which is how it is mapped.
+        uint32_t end = (ram_regions[i].end + (4 << 20) - 1) & ~((4 << 20) - 1);
+
+        if (end > lowmem_end) {
+            lowmem_end = end;
+        }
+    }
+}
+
+/* Puts the free block at frame |pfn| on the list of |order| */
+static void free_list_add(uint32_t pfn, int32_t order)
+{
+    free_block_t *block = (free_block_t *)(pfn << FRAME_SHIFT);
+
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    free_lists[order] = block;
+    frame_state[pfn] = FRAME_FREE | order;
+    free_blocks[order]++;
+}
+
+/* Takes the free block at frame |pfn| off the list of |order| */
+static void free_list_del(uint32_t pfn, int32_t order)
+{
+    free_block_t *block = (free_block_t *)(pfn << FRAME_SHIFT);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    frame_state[pfn] = 0;
+    free_blocks[order]--;
+}
+
+/* Frees the block of 2^order frames at |pfn|, merging it with its buddy for
+ * as long as that is free too. Called with frame_lock held. */
+static void __frame_free(uint32_t pfn, int32_t order)
+{
+    nr_free += 1 << order;
+    frame_state[pfn] = 0;
+
+    while (order < FRAME_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1 << order);
+
+        if (buddy >= LOWMEM_FRAMES || frame_state[buddy] != (FRAME_FREE | order)) {
+            break;
+        }
+        free_list_del(buddy, order);
+        pfn &= ~(1 << order);
+        order++;
+    }
+    free_list_add(pfn, order);
+}
+
+/* Returns 1 if the frame at |addr| holds part of a boot module */
+static int32_t in_module(uint32_t addr)
+{
+    int32_t i;
+
+    for (i = 0; i < num_module_regions; i++) {
+        if (addr + FRAME_SIZE > module_regions[i].start && addr < module_regions[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void frame_init(void)
+{
+    int32_t i;
+    uint32_t addr;
+
+    for (i = 0; i < num_ram_regions; i++) {
+        for (addr = ram_regions[i].start; addr < ram_regions[i].end; addr += FRAME_SIZE) {
+            if (!in_module(addr)) {
+                __frame_free(addr >> FRAME_SHIFT, 0);
+                total_frames++;
+            }
+        }
+    }
+
+    printf("Memory: %u KB managed, %u large pages\n", total_frames * (FRAME_SIZE / 1024),
+           free_blocks[FRAME_ORDER_4MB]);
+}
+
+uint32_t frame_alloc(int32_t order)
+{
+    unsigned long flags;
+    uint32_t pfn;
+    int32_t o;
+
+    if (order < 0 || order > FRAME_MAX_ORDER) {
+        return 0;
+    }
+
+    spin_lock_irqsave(&frame_lock, flags);
+    for (o = order; o <= FRAME_MAX_ORDER && !free_lists[o]; o++) {
+        /* find the smallest block that is big enough */
+    }
+    if (o > FRAME_MAX_ORDER) {
+        fail_count[order]++;
+        spin_unlock_irqrestore(&frame_lock, flags);
+        return 0;
+    }
+
+    pfn = (uint32_t)free_lists[o] >> FRAME_SHIFT;
+    free_list_del(pfn, o);
+    // Give back the upper halves until the block is the right size.
+    while (o > order) {
+        o--;
+        free_list_add(pfn + (1 << o), o);
+    }
+    frame_state[pfn] = order;
+    frame_refs[pfn] = 1;
+    nr_free -= 1 << order;
+    alloc_count[order]++;
+    spin_unlock_irqrestore(&frame_lock, flags);
+
+    return pfn << FRAME_SHIFT;
+}
+
+void frame_free(uint32_t addr, int32_t order)
+{
+    unsigned long flags;
+
+    if (addr == 0) {
+        return;
+    }
+
+    spin_lock_irqsave(&frame_lock, flags);
+    __frame_free(addr >> FRAME_SHIFT, order);
+    free_count[order]++;
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+void frame_get(uint32_t addr)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&frame_lock, flags);
+    frame_refs[addr >> FRAME_SHIFT]++;
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+void frame_put(uint32_t addr)
+{
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    unsigned long flags;
+
+    if (addr == 0) {
+        return;
+    }
+
+    spin_lock_irqsave(&frame_lock, flags);
+    if (--frame_refs[pfn] == 0) {
+        __frame_free(pfn, 0);
+        free_count[0]++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+uint32_t frame_refcount(uint32_t addr)
+{
+    return frame_refs[addr >> FRAME_SHIFT];
+}
+
+int32_t frame_block_order(uint32_t addr)
+{
+    return frame_state[addr >> FRAME_SHIFT] & ~FRAME_FREE;
+}
+
+uint32_t frame_free_count(void)
+{
+    return nr_free;
+}
+
+/* Builds the text of the meminfo device */
+static void meminfo_fill(textbuf_t *tb)
+{
+    int32_t order;
+
+    tb_puts(tb, "frames: total ");
+    tb_putn(tb, total_frames, 10, 0);
+    tb_puts(tb, " free ");
+    tb_putn(tb, nr_free, 10, 0);
+    tb_puts(tb, "\norder KB free-blocks allocs frees failed\n");
+    for (order = 0; order <= FRAME_MAX_ORDER; order++) {
+        tb_putn(tb, order, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, (FRAME_SIZE / 1024) << order, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, free_blocks[order], 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, alloc_count[order], 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, free_count[order], 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, fail_count[order], 10, 0);
+        tb_puts(tb, "\n");
+    }
+}
+
+static stats_file_t meminfo_file = {SPINLOCK_INIT, meminfo_fill};
+
+int32_t meminfo_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    (void)id;
+    return stats_file_read(&meminfo_file, offset, buf, nbytes);
+}
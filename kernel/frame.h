@@ -0,0 +1,76 @@
+/* frame.h - Buddy allocator of physical page frames
+ * vim:ts=4
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "types.h"
+#include "multiboot.h"
+
+// Size of the smallest frame.
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+
+// Blocks of 2^order frames are handed out, from 4 KB (order 0) up to 4 MB
+// (FRAME_ORDER_4MB), the size of a large page.
+#define FRAME_ORDER_4MB 10
+#define FRAME_MAX_ORDER FRAME_ORDER_4MB
+
+// Physical memory below this is mapped at the same virtual address in every
+// address space (see map_kernel_pages()), so the kernel can use any frame
+// directly. User programs start at 128 MB, which limits it.
+#define LOWMEM_LIMIT 0x08000000
+
+// Frames from here up are managed. Below is the low memory and the kernel,
+// with the boot and idle stacks. Process kernel stacks come from the frame
+// allocator, so current_pid() can tell them apart.
+#define FRAME_BASE 0x00800000
+
+// Name of the device file the allocator statistics are read from.
+#define MEMINFO_DEVICE_NAME "meminfo"
+
+#ifndef ASM
+
+// End of the usable RAM that is mapped and managed, a multiple of 4 MB. Set
+// by frame_scan_mmap().
+extern uint32_t lowmem_end;
+
+// Remembers the usable RAM in the multiboot memory map of |mbi|, less the
+// boot modules. Must run before paging is on, which hides the map.
+void frame_scan_mmap(multiboot_info_t *mbi);
+
+// Puts the remembered RAM on the free lists. Needs the memory mapped by
+// page_table_init().
+void frame_init(void);
+
+// Returns the physical (and kernel virtual) address of a free block of
+// 2^order frames, aligned to its size, or 0 if there is none.
+uint32_t frame_alloc(int32_t order);
+
+// Returns the block at |addr| that frame_alloc(|order|) handed out.
+void frame_free(uint32_t addr, int32_t order);
+
+// Takes another reference to the single frame at |addr|, which frame_alloc(0)
+// handed out with one.
+void frame_get(uint32_t addr);
+
+// Drops a reference to the single frame at |addr| and frees it with the last
+// one. Does nothing for 0.
+void frame_put(uint32_t addr);
+
+// Number of references to the single frame at |addr|.
+uint32_t frame_refcount(uint32_t addr);
+
+// Returns the order of the allocated block starting at |addr|.
+int32_t frame_block_order(uint32_t addr);
+
+// Number of free 4 KB frames.
+uint32_t frame_free_count(void);
+
+// Read operation of the meminfo device. Returns the allocator statistics as
+// text.
+int32_t meminfo_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+#endif /* ASM */
+#endif /* _FRAME_H */
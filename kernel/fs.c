@@ -1,8 +1,13 @@
 #include "fs.h"
+#include "frame.h"
+#include "idt.h"
+#include "slab.h"
+#include "irqsoff.h"
 #include "keyboard.h"
 #include "pcb.h"
 #include "rtc.h"
 #include "terminal.h"
+#include "trace.h"
 #include "pt.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -70,6 +75,62 @@ file_operator_table_t file_operator_tables[NUM_FILE_TYPES] = {
                 write_fail,
                 close_success}};
 
+/*
+ * Device files, which are opened by name like the files in the file system
+ * image but have no inode.
+ */
+file_operator_table_t trace_file_operator_table = {
+        open_success,
+        trace_read,
+        write_fail,
+        close_success};
+
+file_operator_table_t syscall_stats_file_operator_table = {
+        open_success,
+        syscall_stats_read,
+        write_fail,
+        close_success};
+
+file_operator_table_t irq_stats_file_operator_table = {
+        open_success,
+        irq_stats_read,
+        write_fail,
+        close_success};
+
+file_operator_table_t meminfo_file_operator_table = {
+        open_success,
+        meminfo_read,
+        write_fail,
+        close_success};
+
+file_operator_table_t slabinfo_file_operator_table = {
+        open_success,
+        slabinfo_read,
+        write_fail,
+        close_success};
+
+#ifdef IRQSOFF_TRACE
+file_operator_table_t irqsoff_file_operator_table = {
+        open_success,
+        irqsoff_read,
+        write_fail,
+        close_success};
+#endif
+
+static const struct {
+    const char *name;
+    file_operator_table_t *ops;
+} device_files[] = {
+        {TRACE_DEVICE_NAME, &trace_file_operator_table},
+        {SYSCALL_STATS_DEVICE_NAME, &syscall_stats_file_operator_table},
+        {IRQ_STATS_DEVICE_NAME, &irq_stats_file_operator_table},
+        {MEMINFO_DEVICE_NAME, &meminfo_file_operator_table},
+        {SLABINFO_DEVICE_NAME, &slabinfo_file_operator_table},
+#ifdef IRQSOFF_TRACE
+        {IRQSOFF_DEVICE_NAME, &irqsoff_file_operator_table},
+#endif
+};
+
 /* wrappers for keyboard operations */
 int32_t keyboard_open_wrapper(const uint8_t *filename)
 {
@@ -150,13 +211,10 @@ file_operator_table_t stdout_file_operator_table = {
  */
 
 /*
- * Opens stdin at STDIN_FILENO in current process (as determined by curr_pid).
+ * Opens stdin at STDIN_FILENO in the file array |files| of a process.
  */
-void open_stdin()
+void open_stdin(file_t *files)
 {
-    pcb_entry_t *pcb_entry = GET_PCB_ENTRY(curr_pid);
-    file_t *files = pcb_entry->files;
-
     files[STDIN_FILENO] = (file_t){
             &stdin_file_operator_table,
             NULL,
@@ -167,13 +225,10 @@ void open_stdin()
 }
 
 /*
- * Opens stdout at STDOUT_FILENO in current process (as determined by curr_pid).
+ * Opens stdout at STDOUT_FILENO in the file array |files| of a process.
  */
-void open_stdout()
+void open_stdout(file_t *files)
 {
-    pcb_entry_t *pcb_entry = GET_PCB_ENTRY(curr_pid);
-    file_t *files = pcb_entry->files;
-
     files[STDOUT_FILENO] = (file_t){
             &stdout_file_operator_table,
             NULL,
@@ -220,7 +275,7 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry)
 int32_t read_data(uint32_t inode_number, uint32_t offset, uint8_t *buf, uint32_t length)
 {
     inode_t *inode = inodes + inode_number;
-    uint32_t bytes_remaining = MIN(length, inode->length);
+    uint32_t bytes_remaining;
     uint32_t *data_blocks_numbers = inode->data_blocks;
     int i;
     int start_block_index;
@@ -233,6 +288,9 @@ int32_t read_data(uint32_t inode_number, uint32_t offset, uint8_t *buf, uint32_t
     if (offset >= inode->length) {
         return 0;
     }
+    // Only what is left of the file past |offset|.
+    length = MIN(length, inode->length - offset);
+    bytes_remaining = length;
 
     start_block_index = offset / BLOCK_SIZE;
     end_block_index = MIN(offset + length, inode->length) / sizeof(block_t);
@@ -253,7 +311,7 @@ int32_t read_data(uint32_t inode_number, uint32_t offset, uint8_t *buf, uint32_t
     // Copy over the end block
     memcpy(buf, (char *)(data_blocks + data_blocks_numbers[end_block_index]), bytes_remaining);
 
-    return MIN(length, inode->length);
+    return length;
 }
 
 int32_t read_directory(uint32_t inode_number, uint32_t offset, uint8_t *buf, uint32_t length)
@@ -309,15 +367,27 @@ int32_t sys_open(const uint8_t *filename)
         return -1;
     }
 
-    if (read_dentry_by_name(filename, &dir_entry) == -1) {
-        return -1;
+    for (i = 0; i < sizeof(device_files) / sizeof(device_files[0]); i++) {
+        if (strncmp((const int8_t *)filename, (const int8_t *)device_files[i].name, FILE_NAME_LENGTH) == 0) {
+            break;
+        }
     }
 
-    files[fd] = (file_t){
-            file_operator_tables + dir_entry.file_type,
-            inodes + dir_entry.inode_number,
-            0,
-            IN_USE};
+    if (i < sizeof(device_files) / sizeof(device_files[0])) {
+        files[fd] = (file_t){
+                device_files[i].ops,
+                NULL,
+                0,
+                IN_USE};
+    } else if (read_dentry_by_name(filename, &dir_entry) == -1) {
+        return -1;
+    } else {
+        files[fd] = (file_t){
+                file_operator_tables + dir_entry.file_type,
+                inodes + dir_entry.inode_number,
+                0,
+                IN_USE};
+    }
 
     if ((retval = (&files[fd])->file_operations_table_pointer->open(filename))) {
         return retval;
@@ -136,11 +136,11 @@ typedef enum whence {
     NUM_WHENCE_TYPES
 } whence_enum;
 
-/* Opens stdin for the current process*/
-void open_stdin();
+/* Opens stdin in the file array of a process */
+void open_stdin(file_t *files);
 
-/* Opens stdout for the current process*/
-void open_stdout();
+/* Opens stdout in the file array of a process */
+void open_stdout(file_t *files);
 
 /* initializes the filesystem with the start address in memory */
 void init_fs(char *fs_addr);
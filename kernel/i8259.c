@@ -42,6 +42,12 @@
 uint8_t master_mask = 0xFF; /* IRQs 0-7 */
 uint8_t slave_mask = 0xFF;  /* IRQs 8-15 */
 
+#ifdef I8259_AEOI
+int32_t i8259_aeoi = 1;
+#else
+int32_t i8259_aeoi = 0;
+#endif
+
 /* Initialize the 8259 PIC */
 void i8259_init(void)
 {
@@ -58,13 +64,13 @@ void i8259_init(void)
     outb(ICW1, MASTER_8259_PORT);        /* ICW1: select Master init */
     outb(ICW2_MASTER, MASTER_8259_DATA); /* ICW2: Master IR0-7 mapped to 0x20-0x27 */
     outb(ICW3_MASTER, MASTER_8259_DATA); /* Master has a slave on IR2 */
-    outb(ICW4, MASTER_8259_DATA);        /* Master expected normal EOI */
+    outb(ICW4 | (i8259_aeoi ? ICW4_AEOI : 0), MASTER_8259_DATA); /* Master normal or automatic EOI */
 
     /* Init the Slave */
     outb(ICW1, SLAVE_8259_PORT);       /* ICW1: select slave init */
     outb(ICW2_SLAVE, SLAVE_8259_DATA); /* ICW2: Slave IR0-7 mapped to 0x28-0x2f */
     outb(ICW3_SLAVE, SLAVE_8259_DATA); /* Slave is a slave on master's IR2 */
-    outb(ICW4, SLAVE_8259_DATA);       /* (slave's support for AEOI in flat mode is to be investigated) */
+    outb(ICW4 | (i8259_aeoi ? ICW4_AEOI : 0), SLAVE_8259_DATA); /* Slave the same as the master */
 
     outb(master_mask, MASTER_8259_DATA); /* restore master irq mask */
     outb(slave_mask, SLAVE_8259_DATA);   /* restore slave irq mask */
@@ -72,7 +78,8 @@ void i8259_init(void)
     restore_flags(flags);
 }
 
-/* Enable (unmask) the specified IRQ */
+/* Enable (unmask) the specified IRQ. The masks are cached, so the IMR is only
+ * written when the bit actually changes. */
 void enable_irq(uint32_t irq_num)
 {
     unsigned long flags;
@@ -80,38 +87,65 @@ void enable_irq(uint32_t irq_num)
     cli_and_save(flags);
 
     if (irq_num < 8) {
-        master_mask &= ~(1 << irq_num);
-        outb(master_mask, MASTER_8259_DATA);
+        if (master_mask & (1 << irq_num)) {
+            master_mask &= ~(1 << irq_num);
+            outb(master_mask, MASTER_8259_DATA);
+        }
     } else {
         irq_num -= 8;
-        slave_mask &= ~(1 << irq_num);
-        outb(slave_mask, SLAVE_8259_DATA);
+        if (slave_mask & (1 << irq_num)) {
+            slave_mask &= ~(1 << irq_num);
+            outb(slave_mask, SLAVE_8259_DATA);
+        }
     }
 
     restore_flags(flags);
 }
 
-/* Disable (mask) the specified IRQ */
+/* Disable (mask) the specified IRQ. Only writes the IMR on a change. */
 void disable_irq(uint32_t irq_num)
 {
-    unsigned int mask;
     unsigned long flags;
 
-    mask = 1 << irq_num;
     cli_and_save(flags);
 
     if (irq_num < 8) {
-        master_mask |= (1 << irq_num);
-        outb(master_mask, MASTER_8259_DATA);
+        if (!(master_mask & (1 << irq_num))) {
+            master_mask |= (1 << irq_num);
+            outb(master_mask, MASTER_8259_DATA);
+        }
     } else {
         irq_num -= 8;
-        slave_mask |= (1 << irq_num);
-        outb(slave_mask, SLAVE_8259_DATA);
+        if (!(slave_mask & (1 << irq_num))) {
+            slave_mask |= (1 << irq_num);
+            outb(slave_mask, SLAVE_8259_DATA);
+        }
     }
 
     restore_flags(flags);
 }
 
+#ifdef BENCHMARK
+/* Mask (|masked| set) or unmask the specified IRQ the way disable_irq() and
+ * enable_irq() did before the masks were cached: always writes the IMR */
+void i8259_write_mask(uint32_t irq_num, int32_t masked)
+{
+    unsigned long flags;
+    uint8_t *mask = (irq_num < 8) ? &master_mask : &slave_mask;
+
+    cli_and_save(flags);
+
+    if (masked) {
+        *mask |= (1 << (irq_num % 8));
+    } else {
+        *mask &= ~(1 << (irq_num % 8));
+    }
+    outb(*mask, (irq_num < 8) ? MASTER_8259_DATA : SLAVE_8259_DATA);
+
+    restore_flags(flags);
+}
+#endif
+
 /* Send end-of-interrupt signal for the specified IRQ */
 void send_eoi(uint32_t irq_num)
 {
@@ -131,3 +165,65 @@ void send_eoi(uint32_t irq_num)
 
     restore_flags(flags);
 }
+
+/* Returns 1 if the specified IRQ is unmasked */
+int32_t i8259_irq_enabled(uint32_t irq_num)
+{
+    if (irq_num < 8) {
+        return !(master_mask & (1 << irq_num));
+    }
+    return !(slave_mask & (1 << (irq_num - 8)));
+}
+
+/* Mask every IRQ on both PICs */
+void i8259_mask_all(void)
+{
+    unsigned long flags;
+    cli_and_save(flags);
+
+    master_mask = 0xFF;
+    slave_mask = 0xFF;
+    outb(master_mask, MASTER_8259_DATA);
+    outb(slave_mask, SLAVE_8259_DATA);
+
+    restore_flags(flags);
+}
+
+/* Switch to or from automatic EOI. The init sequence restores the masks. */
+void i8259_set_aeoi(int32_t on)
+{
+    i8259_aeoi = on;
+    i8259_init();
+}
+
+/*
+ * The PIC raises IRQ7 (IRQ15 on the slave) when a request goes away before the
+ * CPU acknowledges it. Such an IRQ has no in-service bit. A masked line can
+ * only come in this way, which needs no port access to check. In AEOI mode
+ * the in-service bit is already clear, so only the mask tells.
+ */
+int32_t i8259_spurious(uint32_t irq_num)
+{
+    uint32_t port;
+
+    if (irq_num != 7 && irq_num != 15) {
+        return 0;
+    }
+    port = (irq_num == 7) ? MASTER_8259_PORT : SLAVE_8259_PORT;
+
+    if (i8259_irq_enabled(irq_num)) {
+        if (i8259_aeoi) {
+            return 0;
+        }
+        outb(OCW3_READ_ISR, port);
+        if (inb(port) & (1 << 7)) {
+            return 0;
+        }
+    }
+
+    // The master did see a real request on its cascade input.
+    if (irq_num == 15 && !i8259_aeoi) {
+        outb(EOI | ICW3_SLAVE, MASTER_8259_PORT);
+    }
+    return 1;
+}
@@ -28,12 +28,23 @@
 #define ICW3_SLAVE      0x02
 // Using 8086 system.
 #define ICW4            0x01
+// Or'd into ICW4 for automatic EOI: the PIC clears the in-service bit as soon
+// as the CPU takes the interrupt.
+#define ICW4_AEOI       0x02
+
+/* OCW3 that makes the next read of the command port return the in-service
+ * register */
+#define OCW3_READ_ISR   0x0B
 
 /* Specific end-of-interrupt byte. This gets OR'd with
  * the interrupt number and sent out to the PIC
  * to declare the interrupt finished */
 #define EOI             0x60
 
+/* 1 if the PICs run in automatic EOI mode, so send_eoi() is not needed.
+ * Defaults to 0 unless built with -DI8259_AEOI. */
+extern int32_t i8259_aeoi;
+
 /* Externally-visible functions */
 
 /* Initialize both PICs */
@@ -44,5 +55,18 @@ void enable_irq(uint32_t irq_num);
 void disable_irq(uint32_t irq_num);
 /* Send end-of-interrupt signal for the specified IRQ */
 void send_eoi(uint32_t irq_num);
+#ifdef BENCHMARK
+/* Mask or unmask the specified IRQ, writing the IMR even if it doesn't change */
+void i8259_write_mask(uint32_t irq_num, int32_t masked);
+#endif
+/* Returns 1 if the specified IRQ is unmasked */
+int32_t i8259_irq_enabled(uint32_t irq_num);
+/* Mask every IRQ on both PICs, e.g. once the IO APIC takes over */
+void i8259_mask_all(void);
+/* Reprograms both PICs with or without automatic EOI */
+void i8259_set_aeoi(int32_t on);
+/* Returns 1 if IRQ |irq_num| is a spurious IRQ7 or IRQ15, which must not be
+ * handled or acknowledged (the master still gets its EOI for IRQ15) */
+int32_t i8259_spurious(uint32_t irq_num);
 
 #endif /* _I8259_H */
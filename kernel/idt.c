@@ -5,6 +5,10 @@
 #include "rtc.h"
 #include "syscall.h"
 #include "schedule.h"
+#include "smp.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "tsc.h"
 
 /* The IDT itself */
 idt_desc_t idt[NUM_VEC] __attribute__((aligned (16)));
@@ -141,37 +145,179 @@ x86_desc_t idt_desc = {
 irq_handler_func irq_handler_table[NUM_IRQ_HANDLER];
 
 
+// Per-IRQ histograms of the TSC cycles spent from entry to acknowledge,
+// including the handler and any IRQs nested in it, and of the latency of IRQ
+// 0. Only the boot processor takes IRQs, and an IRQ does not nest in itself,
+// so each entry has one writer at a time.
+irq_stat_t irq_stats[NUM_IRQ_HANDLER];
+
+#ifdef BENCHMARK
+// Set by the IRQ benchmark to acknowledge 8259 IRQs the way
+// irq_handler_wrapper did before do_irq(): EOI first, then the line masked
+// around the handler, writing the IMR both times.
+int32_t irq_old_ack = 0;
+#endif
+
+/*
+ * do_irq
+ *   DESCRIPTION: Runs the handler of |irq| and acknowledges it. Through the IO
+ *                APIC the local APIC keeps the vector in service until the
+ *                single EOI write after the handler, which holds off the same
+ *                and lower priority IRQs. The 8259 does the same with its
+ *                in-service bit, so the line needs no masking either and the
+ *                EOI is the only port write. In AEOI mode the PIC has already
+ *                forgotten the IRQ, so the handler runs with interrupts
+ *                disabled instead and nothing is written at all.
+ *   INPUTS: irq -- IRQ number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Updates irq_stats[irq]. Spurious 8259 IRQs are only counted.
+ *                 For IRQ 0 also records how long ago the PIT raised it.
+ */
+void do_irq(uint32_t irq)
+{
+    uint64_t start = rdtsc();
+
+    // The PIT is the only device that tells when it raised its IRQ.
+    if (irq == 0) {
+        hist_add(&irq_stats[irq].latency, pit_irq_age());
+    }
+
+    if (ioapic_enabled) {
+        sti();
+        irq_handler_table[irq]();
+        cli();
+        lapic_eoi();
+    } else if (i8259_spurious(irq)) {
+        irq_stats[irq].spurious++;
+        return;
+    } else if (i8259_aeoi) {
+        irq_handler_table[irq]();
+#ifdef BENCHMARK
+    } else if (irq_old_ack) {
+        send_eoi(irq);
+        i8259_write_mask(irq, 1);
+        sti();
+        irq_handler_table[irq]();
+        cli();
+        i8259_write_mask(irq, 0);
+#endif
+    } else {
+        sti();
+        irq_handler_table[irq]();
+        cli();
+        send_eoi(irq);
+    }
+
+    hist_add(&irq_stats[irq].duration, rdtsc() - start);
+}
+
+void irq_print_stats(void)
+{
+    int32_t i;
+
+    printf("irq count avg(cycles) spurious\n");
+    for (i = 0; i < NUM_IRQ_HANDLER; i++) {
+        hist_t *duration = &irq_stats[i].duration;
+
+        if (duration->count == 0 && irq_stats[i].spurious == 0) {
+            continue;
+        }
+        printf("%d   %u %u %u\n", i, duration->count,
+               duration->count ? div64_32(duration->sum, duration->count) : 0,
+               irq_stats[i].spurious);
+    }
+}
+
+/* Prints the histograms of |stat| labelled with |name| and |num| */
+static void irq_stat_print(textbuf_t *tb, const char *name, int32_t num, const irq_stat_t *stat)
+{
+    if (stat->duration.count == 0 && stat->spurious == 0) {
+        return;
+    }
+    tb_puts(tb, name);
+    tb_putn(tb, num, 10, 0);
+    tb_puts(tb, " spurious ");
+    tb_putn(tb, stat->spurious, 10, 0);
+    tb_puts(tb, "\n  duration:");
+    hist_print(tb, &stat->duration);
+    if (stat->latency.count) {
+        tb_puts(tb, "  latency:");
+        hist_print(tb, &stat->latency);
+    }
+}
+
+/* Builds the text of the irqstat device */
+static void irq_stats_fill(textbuf_t *tb)
+{
+    int32_t i;
+
+    tb_puts(tb, "IRQ cycles, buckets are log2 cycles as bucket:count\n");
+    for (i = 0; i < NUM_IRQ_HANDLER; i++) {
+        irq_stat_print(tb, "irq ", i, &irq_stats[i]);
+    }
+    for (i = 0; i < num_cpus; i++) {
+        irq_stat_print(tb, "local timer cpu ", i, &lapic_timer_stats[i]);
+    }
+}
+
+static stats_file_t irq_stats_file = {SPINLOCK_INIT, irq_stats_fill};
+
+int32_t irq_stats_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    (void)id;
+    return stats_file_read(&irq_stats_file, offset, buf, nbytes);
+}
+
 // All IRQ interrupts first call this wrapper which will call the appropriate C
-// function IRQ handler. This way the C function does not need to use iret or
-// save all registers.
+// function IRQ handler through do_irq(). This way the C function does not need
+// to use iret or save all registers. If the handler asked for a reschedule,
+// schedule() is called by irq_exit() once the outermost handler is done and
+// its IRQ is acknowledged, so no IRQ stays in service while another process
+// runs.
 // Input: IRQ number should be on top of stack.
 // Output: Runs C function handler corresponding to IRQ num.
 asm("irq_handler_wrapper:"
            SAVE_REG_X86
     "      movl  $" STRINGIFY2(KERNEL_DS) ", %eax;"
     "      movl  %eax, %ds;"
-
-    "      pushl   " SAVE_REG_SIZE_STR "(%esp);" // Need to pass IRQ num to send_eoi().
-    "      call    send_eoi;"
-    "      addl    $4, %esp;" // Pop send_eoi() argument off.
-
-    "      pushl   " SAVE_REG_SIZE_STR "(%esp);"
-    "      call    disable_irq;"
-    "      addl    $4, %esp;"
-
-    "      sti;"
-    "      movl    " SAVE_REG_SIZE_STR "(%esp), %eax;"
-    "      call    *irq_handler_table(, %eax, 4);"
-    "      cli;"
-
-    "      pushl   " SAVE_REG_SIZE_STR "(%esp);"
-    "      call    enable_irq;"
+    "      call    irq_enter;"
+    "      pushl   " SAVE_REG_SIZE_STR "(%esp);" // Pass the IRQ num to do_irq().
+    "      call    do_irq;"
     "      addl    $4, %esp;"
-
+    "      call    irq_exit;"
            RESTORE_REG_X86
     "      addl    $4, %esp;" // Need to restore stack. IRQ num is on stack.
     "      iret;");
 
+// Defines the entry point |handler_name|_wrapper of an interrupt raised by the
+// local APIC itself (IPIs and its timer) whose C function is |handler_name|.
+// They are acknowledged at the local APIC and not at the 8259. The handlers
+// are short and run with interrupts disabled.
+#define DEFINE_LAPIC_HANDLER_WRAPPER(handler_name)            \
+    void handler_name##_wrapper();                            \
+    asm(#handler_name                                         \
+        "_wrapper:"                                           \
+               SAVE_REG_X86                                   \
+        "      movl  $" STRINGIFY2(KERNEL_DS) ", %eax;"       \
+        "      movl  %eax, %ds;"                              \
+        "      call    irq_enter;"                            \
+        "      call    " #handler_name ";"                    \
+        "      call    lapic_eoi;"                            \
+        "      call    irq_exit;"                             \
+               RESTORE_REG_X86                                \
+        "      iret;")
+
+DEFINE_LAPIC_HANDLER_WRAPPER(smp_reschedule_interrupt);
+DEFINE_LAPIC_HANDLER_WRAPPER(smp_tlb_flush_interrupt);
+DEFINE_LAPIC_HANDLER_WRAPPER(local_timer_interrupt);
+
+// The local APIC raises its spurious vector when an interrupt goes away
+// before it is delivered. It must not be acknowledged.
+void spurious_interrupt_wrapper();
+asm("spurious_interrupt_wrapper:"
+    "      iret;");
+
 /*
 Processor Exceptions
 
@@ -408,7 +554,10 @@ void idt_set_exceptions(void)
 // handle a system timer interrupt.
 void system_timer_handler(void)
 {
-    schedule();
+    sched_tick();
+    // Only used when the local APIC timer is not. Only this processor gets
+    // the PIT, so pass the tick on.
+    smp_send_reschedule_all();
 }
 
 // IRQ 1
@@ -521,6 +670,14 @@ void primary_ata_channel_handler(void)
     EXCEPTION(" Primary ATA Channel ");
 }
 
+// IRQ 15
+// C function interrupt handler of type irq_handler_func that will be called to
+// handle the secondary ATA channel interrupts.
+void secondary_ata_channel_handler(void)
+{
+    EXCEPTION(" Secondary ATA Channel ");
+}
+
 // Whenever setup IRQ handler in idt_set_hardware_interrupts(), need to also
 // define the wrapper here. Needs to be out here because C doesn't support
 // nested function declaration.
@@ -538,6 +695,7 @@ DEFINE_IRQ_HANDLER_WRAPPER(11, peripherals_2_handler);
 DEFINE_IRQ_HANDLER_WRAPPER(12, mouse_ps2_handler);
 DEFINE_IRQ_HANDLER_WRAPPER(13, processor_handler);
 DEFINE_IRQ_HANDLER_WRAPPER(14, primary_ata_channel_handler);
+DEFINE_IRQ_HANDLER_WRAPPER(15, secondary_ata_channel_handler);
 
 // Sets up handlers for all possible hardware interrupts in the IDT. Note that
 // although it isn't necessary to set them all up, it makes debugging easier if
@@ -559,6 +717,7 @@ void idt_set_hardware_interrupts(void)
     SET_IRQ_HANDLER(12, mouse_ps2_handler);
     SET_IRQ_HANDLER(13, processor_handler);
     SET_IRQ_HANDLER(14, primary_ata_channel_handler);
+    SET_IRQ_HANDLER(15, secondary_ata_channel_handler);
 }
 
 // Sets up all interrupts/exceptions in IDT table.
@@ -569,6 +728,12 @@ void idt_set_interrupts(void)
 
     // Support system call through INT 0x80.
     SET_SYSTEM_GATE(idt[0x80], system_call_handler);
+
+    // Local APIC timer and inter-processor interrupts.
+    SET_INTERRUPT_GATE(idt[LOCAL_TIMER_VECTOR], local_timer_interrupt_wrapper);
+    SET_INTERRUPT_GATE(idt[RESCHEDULE_VECTOR], smp_reschedule_interrupt_wrapper);
+    SET_INTERRUPT_GATE(idt[TLB_FLUSH_VECTOR], smp_tlb_flush_interrupt_wrapper);
+    SET_INTERRUPT_GATE(idt[SPURIOUS_VECTOR], spurious_interrupt_wrapper);
 }
 
 void idt_init(void)
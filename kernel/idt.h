@@ -3,11 +3,13 @@
 
 #include "types.h"
 #include "x86_desc.h"
+#include "smp.h"
+#include "stats.h"
 
 /* Number of vectors in the interrupt descriptor table (IDT) */
 #define NUM_VEC 256
 // Number of IRQ handlers supported.
-#define NUM_IRQ_HANDLER 15
+#define NUM_IRQ_HANDLER 16
 
 /* Sets all the processor exceptions in the IDT */
 // void idt_set_exceptions(void);
@@ -41,6 +43,37 @@ extern x86_desc_t idt_desc __attribute__((aligned (4)));
 // The function pointer type of IRQ handlers.
 typedef void (*irq_handler_func)();
 
+// Name of the device file the IRQ histograms are read from.
+#define IRQ_STATS_DEVICE_NAME "irqstat"
+
+// How long an IRQ took to handle, how long it waited from being raised to
+// its handler starting (only known for timer IRQs) and how often it was
+// spurious, in TSC cycles.
+typedef struct irq_stat {
+    uint32_t spurious;
+    hist_t duration;
+    hist_t latency;
+} irq_stat_t;
+
+extern irq_stat_t irq_stats[NUM_IRQ_HANDLER];
+
+#ifdef BENCHMARK
+// Non-zero makes do_irq() acknowledge 8259 IRQs the old way, with an EOI and
+// an uncached mask and unmask of the line. Only for the IRQ benchmark.
+extern int32_t irq_old_ack;
+#endif
+
+// Latency and duration of the local APIC timer interrupt of every processor.
+// Kept by apic.c.
+extern irq_stat_t lapic_timer_stats[MAX_CPUS];
+
+// Prints irq_stats[] for the IRQs that came in.
+void irq_print_stats(void);
+
+// Read operation of the irqstat device. Returns the histograms of
+// irq_stats[] and lapic_timer_stats[] as text.
+int32_t irq_stats_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
 /* Load the interrupt descriptor table (IDT).  This macro takes a 32-bit
  * address which points to a 6-byte structure.  The 6-byte structure
  * (defined as "struct x86_desc" above) contains a 2-byte size field
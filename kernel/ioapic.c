@@ -0,0 +1,109 @@
+/* ioapic.c - IO APIC routing of the ISA interrupts
+ * vim:ts=4
+ */
+
+#include "ioapic.h"
+#include "apic.h"
+#include "i8259.h"
+#include "lib.h"
+#include "mp.h"
+#include "smp.h"
+
+/* Interrupt mode configuration register. Selecting it and writing 1 moves the
+ * 8259 output from the processor to the APICs. */
+#define IMCR_SELECT_PORT 0x22
+#define IMCR_DATA_PORT 0x23
+#define IMCR_SELECT 0x70
+#define IMCR_APIC_MODE 0x01
+
+/* Size of the region mapped by map_kernel_pages() at APIC_MMIO_BASE */
+#define APIC_MMIO_SIZE 0x400000
+
+int32_t ioapic_enabled = 0;
+
+static volatile uint32_t *ioapic;
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    return ioapic[IOAPIC_WINDOW / sizeof(uint32_t)];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val)
+{
+    ioapic[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    ioapic[IOAPIC_WINDOW / sizeof(uint32_t)] = val;
+}
+
+/* Points |pin| at |vector| on the processor with APIC ID |apic_id|, using the
+ * polarity and trigger mode the MP table gave for ISA IRQ |irq| */
+static void ioapic_route(uint32_t pin, uint32_t irq, uint32_t vector, uint32_t apic_id)
+{
+    uint32_t low = vector;
+
+    if ((mp_isa_irq_flags[irq] & MP_IRQ_POLARITY_MASK) == MP_IRQ_ACTIVE_LOW) {
+        low |= IOAPIC_ACTIVE_LOW;
+    }
+    if ((mp_isa_irq_flags[irq] & MP_IRQ_TRIGGER_MASK) == MP_IRQ_LEVEL) {
+        low |= IOAPIC_LEVEL;
+    }
+
+    // Write the destination first so the entry is never live half written.
+    ioapic_write(IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+    ioapic_write(IOAPIC_REDTBL(pin) + 1, apic_id << IOAPIC_DEST_SHIFT);
+    ioapic_write(IOAPIC_REDTBL(pin), low);
+}
+
+/*
+ * ioapic_init
+ *   DESCRIPTION: Masks every IO APIC pin, then routes the IRQs the drivers
+ *                have enabled at the 8259 to the boot processor and masks the
+ *                8259. The vectors stay ICW2_MASTER + irq, so the IDT entries
+ *                and irq_handler_table do not change. The PIT (IRQ 0) is left
+ *                off since the local APIC timer takes over the tick.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no IO APIC to use
+ *   SIDE EFFECTS: Switches the IMCR, masks LINT0 of this processor and sets
+ *                 ioapic_enabled. Must run on the boot processor with
+ *                 interrupts disabled, after lapic_init().
+ */
+int32_t ioapic_init(void)
+{
+    uint32_t pins;
+    uint32_t irq, pin;
+
+    if (lapic == NULL || mp_ioapic_addr < APIC_MMIO_BASE ||
+        mp_ioapic_addr >= APIC_MMIO_BASE + APIC_MMIO_SIZE) {
+        return -1;
+    }
+    ioapic = (volatile uint32_t *)mp_ioapic_addr;
+
+    pins = ((ioapic_read(IOAPIC_VER) >> IOAPIC_MAX_REDIR_SHIFT) & 0xFF) + 1;
+    for (pin = 0; pin < pins; pin++) {
+        ioapic_write(IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+    }
+
+    if (mp_imcr_present) {
+        outb(IMCR_SELECT, IMCR_SELECT_PORT);
+        outb(IMCR_APIC_MODE, IMCR_DATA_PORT);
+    }
+
+    for (irq = 0; irq < NUM_ISA_IRQS; irq++) {
+        // IRQ 2 is only the cascade from the slave 8259.
+        if (irq == 0 || irq == 2 || !i8259_irq_enabled(irq)) {
+            continue;
+        }
+        pin = mp_isa_irq_pin[irq];
+        if (pin < pins) {
+            ioapic_route(pin, irq, ICW2_MASTER + irq, cpus[0].apic_id);
+        }
+    }
+
+    // In virtual wire mode the 8259 reaches the processor through LINT0.
+    i8259_mask_all();
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+
+    ioapic_enabled = 1;
+    return 0;
+}
@@ -0,0 +1,41 @@
+/* ioapic.h - IO APIC routing of the ISA interrupts
+ * vim:ts=4
+ */
+
+#ifndef _IOAPIC_H
+#define _IOAPIC_H
+
+#include "types.h"
+
+/* Offsets of the index and data registers from the IO APIC base */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+/* Indirect registers */
+#define IOAPIC_VER 0x01
+#define IOAPIC_REDTBL(pin) (0x10 + 2 * (pin))
+
+/* Bits 16-23 of the version register: number of pins minus one */
+#define IOAPIC_MAX_REDIR_SHIFT 16
+
+/* Low word of a redirection entry. Delivery mode fixed, physical destination. */
+#define IOAPIC_MASKED 0x10000
+#define IOAPIC_LEVEL 0x08000
+#define IOAPIC_ACTIVE_LOW 0x02000
+/* High word of a redirection entry: destination APIC ID */
+#define IOAPIC_DEST_SHIFT 24
+
+#ifndef ASM
+
+// 1 once the IO APIC delivers the device interrupts and the 8259 is masked.
+// Read by the IRQ wrapper in idt.c to pick how to acknowledge an IRQ.
+extern int32_t ioapic_enabled;
+
+// Moves every IRQ that is unmasked at the 8259 (except the PIT) over to the
+// IO APIC, delivered to the boot processor on the same vector as before.
+// Return: 0 on success, -1 if the machine has no usable IO APIC, in which
+// case the 8259 stays in charge.
+int32_t ioapic_init(void);
+
+#endif /* ASM */
+#endif /* _IOAPIC_H */
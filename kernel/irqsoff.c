@@ -0,0 +1,204 @@
+/* irqsoff.c - Tracer of the longest sections run with interrupts disabled
+ * vim:ts=4
+ *
+ * Built with IRQSOFF_TRACE (make IRQSOFF=1). The cli(), cli_and_save(),
+ * sti() and restore_flags() macros in lib.h then call in here, and every
+ * section from disabling interrupts to enabling them again is timed and
+ * charged to the pair of addresses that did it. Sections that start when the
+ * processor takes an IRQ are charged to irq_enter(). Interrupts are disabled
+ * whenever this code runs, so each processor keeps its own table without a
+ * lock, and nothing here may use the traced macros.
+ */
+
+#ifdef IRQSOFF_TRACE
+
+#include "irqsoff.h"
+#include "lib.h"
+#include "smp.h"
+#include "stats.h"
+#include "tsc.h"
+
+/* One pair of disabling and enabling addresses */
+typedef struct irqsoff_site {
+    uint32_t start_site;
+    uint32_t end_site;
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+} irqsoff_site_t;
+
+typedef struct irqsoff_cpu {
+    // When and where interrupts were disabled, 0 while they aren't.
+    uint64_t start;
+    uint32_t start_site;
+    irqsoff_site_t sites[IRQSOFF_SITES];
+} irqsoff_cpu_t;
+
+static irqsoff_cpu_t irqsoff_cpus[MAX_CPUS];
+
+// Every processor's sites, gathered when the device is read. Only used with
+// the lock of irqsoff_file held.
+static irqsoff_site_t irqsoff_all[MAX_CPUS * IRQSOFF_SITES];
+
+/* Returns the state of the calling processor, NULL before it has its own
+ * GDT (this_cpu() does not point into cpus[] until then). */
+static irqsoff_cpu_t *irqsoff_this_cpu(void)
+{
+    cpu_t *cpu = this_cpu();
+
+    if (cpu < cpus || cpu >= cpus + MAX_CPUS) {
+        return NULL;
+    }
+    return &irqsoff_cpus[cpu - cpus];
+}
+
+/* Starts a section at |site| */
+static void irqsoff_start(uint32_t site)
+{
+    irqsoff_cpu_t *c = irqsoff_this_cpu();
+
+    if (c) {
+        c->start = rdtsc();
+        c->start_site = site;
+    }
+}
+
+/* Charges a section of |cycles| from |start_site| to |end_site|. If every
+ * slot is taken, the one with the shortest longest section gives way. */
+static void irqsoff_record(irqsoff_cpu_t *c, uint32_t start_site, uint32_t end_site, uint32_t cycles)
+{
+    irqsoff_site_t *site = NULL;
+    int32_t i;
+
+    for (i = 0; i < IRQSOFF_SITES; i++) {
+        irqsoff_site_t *s = &c->sites[i];
+
+        if (s->count && s->start_site == start_site && s->end_site == end_site) {
+            site = s;
+            break;
+        }
+        if (!site || s->max < site->max) {
+            site = s;
+        }
+    }
+
+    if (site->start_site != start_site || site->end_site != end_site || !site->count) {
+        if (site->count && site->max >= cycles) {
+            return;
+        }
+        site->start_site = start_site;
+        site->end_site = end_site;
+        site->count = 0;
+        site->max = 0;
+        site->total = 0;
+    }
+    site->count++;
+    site->total += cycles;
+    if (cycles > site->max) {
+        site->max = cycles;
+    }
+}
+
+void trace_irqs_off(uint32_t flags)
+{
+    // Only the outermost disable starts a section.
+    if (flags & EFLAGS_IF) {
+        irqsoff_start((uint32_t)__builtin_return_address(0));
+    }
+}
+
+void trace_irqs_on(void)
+{
+    irqsoff_cpu_t *c = irqsoff_this_cpu();
+    uint64_t now = rdtsc();
+    uint32_t flags;
+
+    if (!c || !c->start) {
+        return;
+    }
+
+    // If interrupts are on already, the section was ended by code that isn't
+    // traced (e.g. the IRET from an IRQ handler) and its length is unknown.
+    asm volatile("pushfl; popl %0"
+                 : "=r"(flags));
+    if (!(flags & EFLAGS_IF)) {
+        uint64_t cycles = now - c->start;
+
+        irqsoff_record(c, c->start_site, (uint32_t)__builtin_return_address(0),
+                       (cycles >> 32) ? 0xFFFFFFFF : (uint32_t)cycles);
+    }
+    c->start = 0;
+}
+
+void trace_hardirq_enter(void)
+{
+    irqsoff_start((uint32_t)__builtin_return_address(0));
+}
+
+/* Builds the text of the irqsoff device */
+static void irqsoff_fill(textbuf_t *tb)
+{
+    int32_t n = 0;
+    int32_t cpu, i, j;
+
+    // Gather the sites of every processor, merging equal ones.
+    for (cpu = 0; cpu < num_cpus; cpu++) {
+        for (i = 0; i < IRQSOFF_SITES; i++) {
+            irqsoff_site_t *s = &irqsoff_cpus[cpu].sites[i];
+
+            if (!s->count) {
+                continue;
+            }
+            for (j = 0; j < n; j++) {
+                if (irqsoff_all[j].start_site == s->start_site && irqsoff_all[j].end_site == s->end_site) {
+                    break;
+                }
+            }
+            if (j == n) {
+                irqsoff_all[n++] = *s;
+                continue;
+            }
+            irqsoff_all[j].count += s->count;
+            irqsoff_all[j].total += s->total;
+            if (s->max > irqsoff_all[j].max) {
+                irqsoff_all[j].max = s->max;
+            }
+        }
+    }
+
+    tb_puts(tb, "longest interrupts-off sections: max us, max cycles, count, avg cycles, disabled at, enabled at\n");
+    // Move the longest left one at a time.
+    for (i = 0; i < n && i < IRQSOFF_TOP; i++) {
+        irqsoff_site_t tmp;
+
+        for (j = i + 1; j < n; j++) {
+            if (irqsoff_all[j].max > irqsoff_all[i].max) {
+                tmp = irqsoff_all[i];
+                irqsoff_all[i] = irqsoff_all[j];
+                irqsoff_all[j] = tmp;
+            }
+        }
+        tb_putn(tb, tsc_to_us(irqsoff_all[i].max), 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, irqsoff_all[i].max, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, irqsoff_all[i].count, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, div64_32(irqsoff_all[i].total, irqsoff_all[i].count), 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, irqsoff_all[i].start_site, 16, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, irqsoff_all[i].end_site, 16, 0);
+        tb_puts(tb, "\n");
+    }
+}
+
+static stats_file_t irqsoff_file = {SPINLOCK_INIT, irqsoff_fill};
+
+int32_t irqsoff_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    (void)id;
+    return stats_file_read(&irqsoff_file, offset, buf, nbytes);
+}
+
+#endif /* IRQSOFF_TRACE */
@@ -0,0 +1,30 @@
+/* irqsoff.h - Tracer of the longest sections run with interrupts disabled
+ * vim:ts=4
+ */
+
+#ifndef _IRQSOFF_H
+#define _IRQSOFF_H
+
+#include "types.h"
+
+// Name of the device file the longest sections are read from.
+#define IRQSOFF_DEVICE_NAME "irqsoff"
+
+// Distinct sections remembered per processor, and how many of the longest
+// the device returns.
+#define IRQSOFF_SITES 32
+#define IRQSOFF_TOP 10
+
+#ifdef IRQSOFF_TRACE
+
+// Called by irq_enter(). The processor disabled interrupts when it took the
+// IRQ, so a section starts here.
+void trace_hardirq_enter(void);
+
+// Read operation of the irqsoff device. Returns, as text, the IRQSOFF_TOP
+// longest sections seen on any processor with the addresses interrupts were
+// disabled and enabled at.
+int32_t irqsoff_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+#endif /* IRQSOFF_TRACE */
+#endif /* _IRQSOFF_H */
@@ -15,6 +15,14 @@
 #include "syscall.h"
 #include "sys_execute.h"
 #include "schedule.h"
+#include "tsc.h"
+#include "bench.h"
+#include "mp.h"
+#include "smp.h"
+#include "apic.h"
+#include "workqueue.h"
+#include "frame.h"
+#include "slab.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -106,23 +114,14 @@ static int check_magic_and_mbi(unsigned long magic, multiboot_info_t *mbi)
 
 // Entrypoint to kernel. Checks if MAGIC is valid and print the Multiboot
 // information structure pointed by ADDR. Also sets up devices, IRQ interrupts,
-// exception handlers, GDT, LDT, page tables. Then infinite loops at end.
+// exception handlers, GDT, LDT, page tables and the other processors. Then
+// runs the idle loop of the boot processor.
 // Input: Magic bytes and pointer (|addr|) to multiboot info struct.
 // Return: No value, but will return if something goes wrong.
 void entry(unsigned long magic, unsigned long addr)
 {
     multiboot_info_t *mbi;
-
-    /* Clear the screen. */
-    clear();
-
-    /* Set MBI to the address of the Multiboot information structure. */
-    mbi = (multiboot_info_t *)addr;
-
-    if (check_magic_and_mbi(magic, mbi)) {
-        // Just stop if checks fail.
-        return;
-    }
+    int32_t shell_pid;
 
     /* Construct an LDT entry in the GDT */
     {
@@ -141,31 +140,21 @@ void entry(unsigned long magic, unsigned long addr)
         lldt(KERNEL_LDT);
     }
 
-    /* Construct a TSS entry in the GDT */
-    {
-        seg_desc_t the_tss_desc;
-        the_tss_desc.granularity = 0;
-        the_tss_desc.opsize = 0;
-        the_tss_desc.reserved = 0;
-        the_tss_desc.avail = 0;
-        the_tss_desc.seg_lim_19_16 = TSS_SIZE & 0x000F0000;
-        the_tss_desc.present = 1;
-        the_tss_desc.dpl = 0x0;
-        the_tss_desc.sys = 0;
-        the_tss_desc.type = 0x9;
-        the_tss_desc.seg_lim_15_00 = TSS_SIZE & 0x0000FFFF;
-
-        SET_TSS_PARAMS(the_tss_desc, &tss, tss_size);
-
-        tss_desc_ptr = the_tss_desc;
-
-        tss.ldt_segment_selector = KERNEL_LDT;
-        tss.ss0 = KERNEL_DS;
-        tss.esp0 = 0x800000;
-        ltr(KERNEL_TSS);
+    /* Give the boot processor its own copy of the GDT and a TSS. Needed
+     * before anything calls this_cpu(). */
+    smp_cpu_init(&cpus[0]);
+
+    /* Clear the screen. */
+    clear();
+
+    /* Set MBI to the address of the Multiboot information structure. */
+    mbi = (multiboot_info_t *)addr;
+
+    if (check_magic_and_mbi(magic, mbi)) {
+        // Just stop if checks fail.
+        return;
     }
 
-    // pcb_init();
     idt_init();
 
     /* Init the PIC */
@@ -178,8 +167,28 @@ void entry(unsigned long magic, unsigned long addr)
 
     init_rtc();
 
+    /* Have to look at low memory before paging hides it */
+    mp_init();
+    frame_scan_mmap(mbi);
+
     page_table_init();
 
+    /* Hands out all the RAM in the memory map from here on */
+    frame_init();
+    slab_init();
+    pcb_init();
+
+    tsc_init();
+
+#ifdef BENCHMARK
+    /* While the 8259 still delivers the timer and keyboard IRQs */
+    bench_irq_ack();
+#endif
+
+    /* Takes over the device interrupts and the tick from the 8259 and PIT */
+    apic_init();
+
+    smp_init();
 
     /* Enable interrupts */
     /* Do not enable the following until after you have set up your
@@ -187,11 +196,22 @@ void entry(unsigned long magic, unsigned long addr)
      * without showing you any output */
     //printf("Enabling Interrupts\n");
 
+    /* Before the benchmarks, which make syscalls */
     setup_syscalls();
 
-    /* Execute the first program (`shell') ... */
-    execute((uint8_t *)"shell");
+#ifdef BENCHMARK
+    run_benchmarks();
+#endif
+
+    /* Queue the first program (`shell') ... */
+    shell_pid = create_process((uint8_t *)"shell", visible_terminal, -1);
+    if (shell_pid != -1) {
+        sched_enqueue(shell_pid);
+    }
+
+    /* Runs the keyboard bottom half, among other deferred work */
+    workqueue_init();
 
-    /* Spin (nicely, so we don't chew up cycles) */
-    infinite_halt();
+    /* ... and become the idle loop of the boot processor, which runs it */
+    cpu_idle();
 }
@@ -1,8 +1,16 @@
 #include "keyboard.h"
 #include "i8259.h"
+#include "idt.h"
 #include "lib.h"
 #include "terminal.h"
 #include "schedule.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "wait.h"
+
+/* Scancodes that can wait for the bottom half. A power of two, so the
+ * free running indices below wrap correctly. */
+#define SCANCODE_QUEUE_SIZE 64
 
 // static   //global keyboard buffer
 // static  //global keyboard buffer
@@ -12,6 +20,19 @@
 // one keyboard state per terminal
 keyboard_t keyboards[MAX_NUM_TERMINALS];
 
+// Scancodes read by the interrupt handler and not yet decoded. head and tail
+// only ever grow; the queue holds tail - head of them.
+static uint8_t scancodes[SCANCODE_QUEUE_SIZE];
+static uint32_t scancode_head = 0;
+static uint32_t scancode_tail = 0;
+static spinlock_t scancode_lock = SPINLOCK_INIT;
+
+// Readers waiting for a line on the visible terminal.
+static wait_queue_t keyboard_wait = WAIT_QUEUE_INIT;
+
+static void keyboard_bottom_half(work_t *work);
+static work_t keyboard_work = WORK_INIT(keyboard_bottom_half);
+
 /* This is a scancode table used to layout a standard US keyboard.*/
 unsigned int uskm[USKM_SIZE] = {
         /*First Row*/
@@ -130,9 +151,8 @@ int32_t keyboard_read(char *buf, int32_t nbytes)
         return -1;
     }
 
-    while (!keyboards[visible_terminal].keyboard_buff_to_go || (TERMINAL_INDEX != visible_terminal)) {
-        /*wait for enter to be pressed*/
-    };
+    /*sleep until enter is pressed on this process's terminal*/
+    wait_event(&keyboard_wait, keyboards[visible_terminal].keyboard_buff_to_go && (TERMINAL_INDEX == visible_terminal));
     //printf("I just left the loop\n");
 
     /* Copy over everything until the newline character*/
@@ -160,6 +180,16 @@ int32_t keyboard_read(char *buf, int32_t nbytes)
     return i;
 }
 
+/*
+ * keyboard_wake_readers
+ *   DESCRIPTION: wake the processes sleeping in keyboard_read so they recheck
+ *   whether a line is ready on their terminal
+ */
+void keyboard_wake_readers()
+{
+    wake_up(&keyboard_wait);
+}
+
 /*
  * keyboard_write
  *   DESCRIPTION: return -1 since the keyboard is read only
@@ -195,12 +225,10 @@ void keyboard_init()
 void echo(uint8_t c) {
     unsigned long flags;
     cli_and_save(flags);
-    // switching to kernel pd so we can write directory to video memory
-    SET_CR3(&pd_kernel[0]);
+    // The video memory is mapped for the kernel in every page directory, so
+    // this writes to it with whatever one is loaded.
     internel_terminal_putc(c, visible_terminal);
     terminal_cursor(get_cursor_row_index(visible_terminal), get_cursor_col_index(visible_terminal));
-    // switching back to the scheduled process
-    SET_CR3(&pds[curr_pid]);
     restore_flags(flags);
 }
 
@@ -297,6 +325,7 @@ void other_keys_helper(unsigned int scan)
             memcpy(keyboards[visible_terminal].keyboard_buf_in, keyboards[visible_terminal].keyboard_buf_out, keyboard_buf_size);
             memcpy(keyboards[visible_terminal].keyboard_buf_out, temp, keyboard_buf_size);
             keyboards[visible_terminal].keyboard_buff_to_go = 1;
+            keyboard_wake_readers();
         }
 
     }
@@ -320,6 +349,7 @@ void other_keys_helper(unsigned int scan)
             /*clear the keyboard buffers*/
             flush(2);
             keyboards[visible_terminal].keyboard_buff_to_go = 1;
+            keyboard_wake_readers();
             break;
         case ALT_F1_MAGIC:
             switch_visible_terminal(0);
@@ -330,6 +360,10 @@ void other_keys_helper(unsigned int scan)
         case ALT_F3_MAGIC:
             switch_visible_terminal(2);
             break;
+        case ALT_F12_MAGIC:
+            sched_print_stats();
+            irq_print_stats();
+            break;
         default:
             break;
         }
@@ -337,25 +371,13 @@ void other_keys_helper(unsigned int scan)
 }
 
 /*
-keyboard_driver
-Description: handle the keyboard interrupt
+keyboard_handle_scancode
+Description: decode one scancode, update the key flags and echo or act on the key.
+Runs on the worker thread, which uses the kernel page directory, so video memory
+can be written directly.
 */
-void keyboard_driver()
+static void keyboard_handle_scancode(unsigned int scan)
 {
-    unsigned long flags;
-    cli_and_save(flags);
-    // switching to kernel pd so we can write directory to video memory
-    SET_CR3(&pd_kernel[0]);
-
-    unsigned int scan;
-    unsigned int i;
-    scan = inb(KEYBOARD_IN); //at this moment the buffer of the keyboard is cleared by the
-                             //keyboard controller in the motherboard
-
-    i = inb(OLD_PORT);
-    outb(i | SCANCODE_MASK, OLD_PORT); //use 0x80 to disable the keyboard
-    outb(i, OLD_PORT);                 //enable the keyboard
-
     /*if a key is pressed*/
     if (!(scan & SCANCODE_MASK)) { //scan & 0x80 is to mask out the scan code, so the released scan code
                                    //will be 0, pressed scan code is not 0
@@ -422,8 +444,56 @@ void keyboard_driver()
             break;
         }
     }
+}
 
-    // switching back to the scheduled process
-    SET_CR3(&pds[curr_pid]);
-    restore_flags(flags);
+/*
+keyboard_bottom_half
+Description: handle every scancode the interrupt handler queued, in order
+*/
+static void keyboard_bottom_half(work_t *work)
+{
+    unsigned long flags;
+    unsigned int scan;
+
+    while (1) {
+        spin_lock_irqsave(&scancode_lock, flags);
+        if (scancode_head == scancode_tail) {
+            spin_unlock_irqrestore(&scancode_lock, flags);
+            return;
+        }
+        scan = scancodes[scancode_head % SCANCODE_QUEUE_SIZE];
+        scancode_head++;
+        spin_unlock_irqrestore(&scancode_lock, flags);
+
+        keyboard_handle_scancode(scan);
+    }
+}
+
+/*
+keyboard_driver
+Description: handle the keyboard interrupt. Only reads and acknowledges the
+scancode; decoding, echoing and terminal switches happen in keyboard_bottom_half.
+*/
+void keyboard_driver()
+{
+    unsigned long flags;
+    unsigned int scan;
+    unsigned int i;
+
+    scan = inb(KEYBOARD_IN); //at this moment the buffer of the keyboard is cleared by the
+                             //keyboard controller in the motherboard
+
+    i = inb(OLD_PORT);
+    outb(i | SCANCODE_MASK, OLD_PORT); //use 0x80 to disable the keyboard
+    outb(i, OLD_PORT);                 //enable the keyboard
+
+    spin_lock_irqsave(&scancode_lock, flags);
+    // Drop the key if the bottom half is this far behind.
+    if (scancode_tail - scancode_head < SCANCODE_QUEUE_SIZE) {
+        scancodes[scancode_tail % SCANCODE_QUEUE_SIZE] = scan;
+        scancode_tail++;
+    }
+    spin_unlock_irqrestore(&scancode_lock, flags);
+
+    queue_work(&keyboard_work);
 }
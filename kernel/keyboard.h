@@ -44,6 +44,7 @@ function keys along with value keys*/
 #define ALT_F1_MAGIC 0x7D3B //ALT_OFFSET+'F1'
 #define ALT_F2_MAGIC 0x7D3C //ALT_OFFSET+'F2'
 #define ALT_F3_MAGIC 0x7D3D //ALT_OFFSET+'F3'
+#define ALT_F12_MAGIC 0x7D58 //ALT_OFFSET+'F12', prints scheduler and IRQ statistics
 
 /*scancode for function keys*/
 #define PRE_KEY 0xE0
@@ -74,9 +75,13 @@ extern unsigned int uskm[145]; //an array of ascii coressdponding to the scan co
 
 /* Initializes globals for keyboard. Primarly initializes stuff in Keyboard.*/
 void keyboard_init();
-/*Keyboard driver function: used to handle the keyboard interrupt*/
+/*Keyboard driver function: used to handle the keyboard interrupt. Queues the
+scancode for the worker thread, which does the rest*/
 void keyboard_driver();
 
+/*Echoes a character to the visible terminal and moves the cursor after it*/
+void echo(uint8_t c);
+
 /*helper functions:*/
 /*back_space_helper handles the delete keys*/
 void back_space_helper();
@@ -90,6 +95,8 @@ int32_t keyboard_open();
 int32_t keyboard_close();
 /*Read from the keyboard buffer to the buffer*/
 int32_t keyboard_read(char *buf, int32_t nbytes);
+/*Wake sleeping readers after a line is entered or the visible terminal changes*/
+void keyboard_wake_readers();
 /*return -1*/
 int32_t keyboard_write(int32_t fd, const void *buf, int32_t nbytes);
 /*Return the address of the keyboard buffer*/
@@ -0,0 +1,71 @@
+/* kthread.c - Kernel threads: processes that only run kernel code
+ * vim:ts=4
+ */
+
+#include "kthread.h"
+#include "lib.h"
+#include "pcb.h"
+#include "pt.h"
+#include "schedule.h"
+#include "switch.h"
+
+/* The first switch_to() into a kernel thread "returns" here, with interrupts
+ * disabled as they are across every switch. */
+static void kthread_entry(void (*fn)(void *), void *arg)
+{
+    pcb_hot_t *hot;
+
+    sti();
+    fn(arg);
+
+    cli();
+    hot = GET_PCB_HOT(curr_pid);
+    hot->runnable = false;
+    pcb_release(curr_pid);
+    // Never switched back to since it is not runnable.
+    schedule();
+}
+
+int32_t kthread_create(void (*fn)(void *), void *arg)
+{
+    return kthread_create_on(fn, arg, -1);
+}
+
+int32_t kthread_create_on(void (*fn)(void *), void *arg, int32_t cpu)
+{
+    pcb_entry_t *pcb;
+    uint32_t *kernel_stack;
+    int32_t pid;
+    int i;
+
+    pid = pcb_alloc(false);
+    if (pid == -1) {
+        return -1;
+    }
+    pcb = GET_PCB_ENTRY(pid);
+
+    GET_PCB_HOT(pid)->terminal = -1;
+    pcb->in_kernel = true;
+    pcb->myparent_pid = -1;
+    pcb->my_pid = pid;
+    pcb->arguments[0] = '\0';
+    for (i = 0; i < MAX_FILES_PER_PROCESS; i++) {
+        (pcb->files[i]).flags = AVAILABLE;
+    }
+
+    // Frame of a call to kthread_entry(fn, arg) that switch_to() returns into.
+    kernel_stack = (uint32_t *)pcb->context.esp0;
+    *--kernel_stack = (uint32_t)arg;
+    *--kernel_stack = (uint32_t)fn;
+    *--kernel_stack = 0; // kthread_entry() never returns
+    *--kernel_stack = (uint32_t)kthread_entry;
+    pcb->context.esp = (uint32_t)kernel_stack;
+
+    if (cpu >= 0) {
+        GET_PCB_HOT(pid)->cpu = cpu;
+        GET_PCB_HOT(pid)->pinned = true;
+    }
+    GET_PCB_HOT(pid)->runnable = true;
+    sched_enqueue(pid);
+    return pid;
+}
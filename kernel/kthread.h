@@ -0,0 +1,22 @@
+/* kthread.h - Kernel threads: processes that only run kernel code
+ * vim:ts=4
+ */
+
+#ifndef _KTHREAD_H
+#define _KTHREAD_H
+
+#include "types.h"
+
+// Creates a kernel thread running |fn|(|arg|) in the kernel address space and
+// queues it. It takes up a PCB like a process, but has no terminal or files
+// and never enters user mode. If |fn| returns the thread ends.
+// Return: the pid of the thread, -1 if every PCB is in use.
+int32_t kthread_create(void (*fn)(void *), void *arg);
+
+// kthread_create(), but the thread is pinned to processor |cpu|: it is only
+// ever queued on and run by that one. -1 leaves it free to move, like
+// kthread_create().
+// Return: the pid of the thread, -1 if every PCB is in use.
+int32_t kthread_create_on(void (*fn)(void *), void *arg, int32_t cpu);
+
+#endif /* _KTHREAD_H */
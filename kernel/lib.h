@@ -136,7 +136,7 @@ static inline uint32_t inl(port)
     } while (0)
 
 /* Clear interrupt flag - disables interrupts on this processor */
-#define cli()                           \
+#define raw_cli()                       \
     do {                                \
         asm volatile("cli"              \
                      :                  \
@@ -144,22 +144,25 @@ static inline uint32_t inl(port)
                      : "memory", "cc"); \
     } while (0)
 
+/* IF flag in EFLAGS: interrupts are enabled */
+#define EFLAGS_IF 0x200
+
 /* Save flags and then clear interrupt flag
  * Saves the EFLAGS register into the variable "flags", and then
  * disables interrupts on this processor */
-#define cli_and_save(flags)    \
-    do {                       \
-        asm volatile(          \
+#define raw_cli_and_save(flags)  \
+    do {                         \
+        asm volatile(            \
             "pushfl          \n\
              popl %0         \n\
-             cli"              \
-            : "=r"(flags)      \
-            :                  \
-            : "memory", "cc"); \
+             cli"                \
+            : "=r"(flags)        \
+            :                    \
+            : "memory", "cc");   \
     } while (0)
 
 /* Set interrupt flag - enable interrupts on this processor */
-#define sti()                           \
+#define raw_sti()                       \
     do {                                \
         asm volatile("sti"              \
                      :                  \
@@ -171,15 +174,56 @@ static inline uint32_t inl(port)
  * Puts the value in "flags" into the EFLAGS register.  Most
  * often used
  * after a cli_and_save_flags(flags) */
-#define restore_flags(flags)    \
-    do {                        \
-        asm volatile(           \
+#define raw_restore_flags(flags)  \
+    do {                          \
+        asm volatile(             \
             "pushl %0         \n\
-             popfl"             \
-             :                  \
-             : "r"(flags)       \
-             : "memory", "cc"); \
+             popfl"               \
+             :                    \
+             : "r"(flags)         \
+             : "memory", "cc");   \
+    } while (0)
+
+#ifdef IRQSOFF_TRACE
+/* Called by the macros below when they disable interrupts, with the EFLAGS
+ * from before, and before they enable them. Implemented in irqsoff.c. */
+void trace_irqs_off(uint32_t flags);
+void trace_irqs_on(void);
+
+/* The same as the raw_ versions, but time how long interrupts stay disabled
+ * for the irqsoff tracer */
+#define cli()                           \
+    do {                                \
+        uint32_t __flags;               \
+        raw_cli_and_save(__flags);      \
+        trace_irqs_off(__flags);        \
+    } while (0)
+
+#define cli_and_save(flags)             \
+    do {                                \
+        raw_cli_and_save(flags);        \
+        trace_irqs_off(flags);          \
+    } while (0)
+
+#define sti()                           \
+    do {                                \
+        trace_irqs_on();                \
+        raw_sti();                      \
+    } while (0)
+
+#define restore_flags(flags)            \
+    do {                                \
+        if ((flags) & EFLAGS_IF) {      \
+            trace_irqs_on();            \
+        }                               \
+        raw_restore_flags(flags);       \
     } while (0)
+#else
+#define cli() raw_cli()
+#define cli_and_save(flags) raw_cli_and_save(flags)
+#define sti() raw_sti()
+#define restore_flags(flags) raw_restore_flags(flags)
+#endif
 
 // Format string for printing all the registers.
 extern const char *const ALL_REG_FMT_STR;
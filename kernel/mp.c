@@ -0,0 +1,165 @@
+/* mp.c - Finds the processors listed in the MultiProcessor Specification tables
+ * vim:ts=4
+ */
+
+#include "mp.h"
+#include "apic.h"
+#include "lib.h"
+#include "smp.h"
+
+/* BIOS data area words giving the EBDA segment and base memory size in KB */
+#define BDA_EBDA_SEGMENT 0x40E
+#define BDA_BASE_MEMORY_KB 0x413
+/* BIOS ROM area also searched for the floating pointer */
+#define BIOS_ROM_START 0xF0000
+#define BIOS_ROM_END 0x100000
+/* The floating pointer is 16 byte aligned */
+#define MP_FLOATING_ALIGN 16
+/* Bytes searched at the start of the EBDA and the end of base memory */
+#define MP_SEARCH_SIZE 1024
+/* Bus type string of ISA buses, padded with spaces */
+#define MP_BUS_ISA "ISA   "
+/* Bus IDs are below this */
+#define MP_MAX_BUSES 32
+
+uint32_t mp_ioapic_addr = 0;
+int32_t mp_imcr_present = 0;
+uint8_t mp_isa_irq_pin[NUM_ISA_IRQS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+uint16_t mp_isa_irq_flags[NUM_ISA_IRQS];
+
+/* Returns the byte sum of |len| bytes at |addr|. Valid tables sum to 0. */
+static uint8_t mp_checksum(uint8_t *addr, uint32_t len)
+{
+    uint8_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        sum += addr[i];
+    }
+    return sum;
+}
+
+/* Looks for the floating pointer in [start, start + len) */
+static mp_floating_t *mp_search(uint32_t start, uint32_t len)
+{
+    uint32_t addr;
+
+    for (addr = start; addr + sizeof(mp_floating_t) <= start + len; addr += MP_FLOATING_ALIGN) {
+        mp_floating_t *mpf = (mp_floating_t *)addr;
+        if (mpf->signature == MP_FLOATING_SIGNATURE &&
+            mp_checksum((uint8_t *)mpf, sizeof(mp_floating_t)) == 0) {
+            return mpf;
+        }
+    }
+    return NULL;
+}
+
+/* Searches the three places the MP specification allows, in order */
+static mp_floating_t *mp_find(void)
+{
+    uint32_t ebda = *(uint16_t *)BDA_EBDA_SEGMENT << 4;
+    uint32_t base_top = *(uint16_t *)BDA_BASE_MEMORY_KB * 1024;
+    mp_floating_t *mpf = NULL;
+
+    if (ebda) {
+        mpf = mp_search(ebda, MP_SEARCH_SIZE);
+    }
+    if (!mpf && base_top) {
+        mpf = mp_search(base_top - MP_SEARCH_SIZE, MP_SEARCH_SIZE);
+    }
+    if (!mpf) {
+        mpf = mp_search(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START);
+    }
+    return mpf;
+}
+
+/*
+ * mp_init
+ *   DESCRIPTION: Walks the MP configuration table. The boot processor goes in
+ *                cpus[0] and every other enabled processor after it.
+ *   INPUTS: none
+ *   OUTPUTS: Prints the number of processors found.
+ *   RETURN VALUE: 0 if the tables were found, -1 if the machine looks like a
+ *                 uniprocessor.
+ *   SIDE EFFECTS: Sets num_cpus, cpus[].apic_id, lapic and the mp_ IO APIC
+ *                 globals.
+ */
+int32_t mp_init(void)
+{
+    mp_floating_t *mpf = mp_find();
+    mp_config_t *conf;
+    uint8_t *entry;
+    uint32_t isa_buses = 0;
+    uint8_t ioapic_id = 0;
+    int i;
+
+    // A zero address means one of the default configurations, which are all
+    // for hardware that is long gone. Treat them as a uniprocessor.
+    if (!mpf || !mpf->config_addr) {
+        printf("MP: no configuration table, using one processor\n");
+        return -1;
+    }
+
+    conf = (mp_config_t *)mpf->config_addr;
+    if (conf->signature != MP_CONFIG_SIGNATURE ||
+        mp_checksum((uint8_t *)conf, conf->length) != 0) {
+        printf("MP: bad configuration table, using one processor\n");
+        return -1;
+    }
+
+    lapic = (volatile uint32_t *)(conf->lapic_addr ? conf->lapic_addr : LAPIC_DEFAULT_BASE);
+    mp_imcr_present = !!(mpf->features[1] & MP_FEATURE2_IMCR);
+
+    entry = (uint8_t *)(conf + 1);
+    for (i = 0; i < conf->entry_count; i++) {
+        switch (*entry) {
+        case MP_ENTRY_PROCESSOR: {
+            mp_processor_t *proc = (mp_processor_t *)entry;
+            if (!(proc->flags & MP_CPU_ENABLED)) {
+                break;
+            }
+            if (proc->flags & MP_CPU_BSP) {
+                cpus[0].apic_id = proc->apic_id;
+            } else if (num_cpus < MAX_CPUS) {
+                cpus[num_cpus++].apic_id = proc->apic_id;
+            }
+            break;
+        }
+        case MP_ENTRY_BUS: {
+            mp_bus_t *bus = (mp_bus_t *)entry;
+            if (bus->bus_id < MP_MAX_BUSES &&
+                !strncmp((int8_t *)bus->bus_type, (int8_t *)MP_BUS_ISA, sizeof(bus->bus_type))) {
+                isa_buses |= 1 << bus->bus_id;
+            }
+            break;
+        }
+        case MP_ENTRY_IOAPIC: {
+            mp_ioapic_t *ioapic = (mp_ioapic_t *)entry;
+            // Only one IO APIC is used. The first one gets the ISA IRQs.
+            if ((ioapic->flags & MP_IOAPIC_ENABLED) && !mp_ioapic_addr) {
+                mp_ioapic_addr = ioapic->addr;
+                ioapic_id = ioapic->apic_id;
+            }
+            break;
+        }
+        case MP_ENTRY_IO_INTERRUPT: {
+            // Bus and IO APIC entries come before these in the table.
+            mp_io_interrupt_t *irq = (mp_io_interrupt_t *)entry;
+            if (irq->int_type == MP_INT_VECTORED && irq->src_bus_id < MP_MAX_BUSES &&
+                (isa_buses & (1 << irq->src_bus_id)) && irq->src_bus_irq < NUM_ISA_IRQS &&
+                irq->dst_ioapic_id == ioapic_id) {
+                mp_isa_irq_pin[irq->src_bus_irq] = irq->dst_ioapic_pin;
+                mp_isa_irq_flags[irq->src_bus_irq] = irq->flags;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        entry += (*entry == MP_ENTRY_PROCESSOR) ? sizeof(mp_processor_t) : MP_ENTRY_SIZE;
+    }
+
+    printf("MP: %d processors, local APIC at 0x%x, IO APIC at 0x%x\n", num_cpus,
+           (uint32_t)lapic, mp_ioapic_addr);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/* mp.h - Intel MultiProcessor Specification tables
+ * vim:ts=4
+ */
+
+#ifndef _MP_H
+#define _MP_H
+
+#include "types.h"
+
+/* "_MP_" and "PCMP" as little endian integers */
+#define MP_FLOATING_SIGNATURE 0x5F504D5F
+#define MP_CONFIG_SIGNATURE 0x504D4350
+
+/* Configuration table entry types */
+#define MP_ENTRY_PROCESSOR 0
+#define MP_ENTRY_BUS 1
+#define MP_ENTRY_IOAPIC 2
+#define MP_ENTRY_IO_INTERRUPT 3
+#define MP_ENTRY_LOCAL_INTERRUPT 4
+
+/* Processor entry flags */
+#define MP_CPU_ENABLED 0x01
+#define MP_CPU_BSP 0x02
+
+/* IO APIC entry flags */
+#define MP_IOAPIC_ENABLED 0x01
+
+/* Interrupt type of an IO interrupt entry that is a normal vectored one */
+#define MP_INT_VECTORED 0
+/* Polarity (bits 0-1) and trigger mode (bits 2-3) of an IO interrupt entry.
+ * 0 means "conforms to the bus", i.e. active high and edge for ISA. */
+#define MP_IRQ_POLARITY_MASK 0x3
+#define MP_IRQ_ACTIVE_LOW 0x3
+#define MP_IRQ_TRIGGER_MASK 0xC
+#define MP_IRQ_LEVEL 0xC
+
+/* Bit 7 of feature byte 2: the IMCR is present and the machine boots in PIC
+ * mode */
+#define MP_FEATURE2_IMCR 0x80
+
+/* Number of ISA IRQ lines */
+#define NUM_ISA_IRQS 16
+
+#ifndef ASM
+
+/* MP floating pointer structure, found by scanning low memory */
+typedef struct mp_floating {
+    uint32_t signature;
+    uint32_t config_addr;
+    uint8_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_floating_t;
+
+/* Header of the MP configuration table. Entries follow it. */
+typedef struct mp_config {
+    uint32_t signature;
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t oem_id[8];
+    uint8_t product_id[12];
+    uint32_t oem_table_addr;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_table_length;
+    uint8_t ext_table_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+/* Processor entry (20 bytes). Every other entry type is 8 bytes. */
+typedef struct mp_processor {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+/* Bus entry */
+typedef struct mp_bus {
+    uint8_t type;
+    uint8_t bus_id;
+    uint8_t bus_type[6];
+} __attribute__((packed)) mp_bus_t;
+
+/* IO APIC entry */
+typedef struct mp_ioapic {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t addr;
+} __attribute__((packed)) mp_ioapic_t;
+
+/* IO interrupt assignment entry: which IO APIC pin a bus IRQ arrives on */
+typedef struct mp_io_interrupt {
+    uint8_t type;
+    uint8_t int_type;
+    uint16_t flags;
+    uint8_t src_bus_id;
+    uint8_t src_bus_irq;
+    uint8_t dst_ioapic_id;
+    uint8_t dst_ioapic_pin;
+} __attribute__((packed)) mp_io_interrupt_t;
+
+// Size of all entries other than processor entries.
+#define MP_ENTRY_SIZE 8
+
+// Physical address of the (first) IO APIC, 0 if the MP table lists none.
+extern uint32_t mp_ioapic_addr;
+// 1 if the IMCR has to be switched to route interrupts to the APICs.
+extern int32_t mp_imcr_present;
+// IO APIC pin and MP polarity/trigger flags of each ISA IRQ. Identity mapped
+// with bus default flags unless the MP table says otherwise.
+extern uint8_t mp_isa_irq_pin[NUM_ISA_IRQS];
+extern uint16_t mp_isa_irq_flags[NUM_ISA_IRQS];
+
+// Finds the MP tables and fills in cpus[], num_cpus, lapic and the IO APIC
+// routing above. Must run before paging is enabled since the tables are in
+// low memory that is not mapped afterwards.
+// Return: 0 if the tables were found, -1 otherwise.
+int32_t mp_init(void);
+
+#endif /* ASM */
+#endif /* _MP_H */
@@ -1,12 +1,203 @@
 #include "pcb.h"
+#include "pt.h"
+#include "schedule.h"
+#include "slab.h"
 
-pcb_entry_t pcb[MAX_NUM_PROCESSES];
+pcb_entry_t *pcb_table[MAX_NUM_PROCESSES];
+pcb_hot_t pcb_hot[MAX_NUM_PROCESSES];
 
-pcb_entry_t *curr_pcb_entry = &pcb[0];
+pid_map_t pid_in_use;
 
-int curr_pid = -1;
+spinlock_t process_lock = SPINLOCK_INIT;
+
+// Processes given up by pcb_release() whose memory is not freed yet.
+static pid_map_t pid_dead;
+// Where the search for a free pid starts, so pids are not reused right away.
+static int32_t next_pid;
+
+static kmem_cache_t *pcb_cache;
+
+// PCBs of exited processes kept with their kernel stack and emptied page
+// directory, so the next process to start needs no allocations. Up to
+// pcb_pool_limit of them.
+static pcb_entry_t *pcb_pool[PCB_POOL_MAX];
+static int32_t pcb_pool_count;
+static int32_t pcb_pool_limit = PCB_POOL_MAX;
+
+int32_t get_curr_pid(void)
+{
+    return curr_pid;
+}
+
+int32_t pid_map_next(const pid_map_t *map, int32_t pid)
+{
+    int32_t i;
+
+    for (i = pid / 32; i < MAX_NUM_PROCESSES / 32; i++) {
+        // Leave out the pids below |pid| in its own word.
+        uint32_t bits = map->bits[i] & ((i == pid / 32) ? ~0U << (pid % 32) : ~0U);
+
+        if (bits) {
+            return i * 32 + __builtin_ctz(bits);
+        }
+    }
+    return -1;
+}
+
+/* Frees the memory of the released processes that no processor runs on any
+ * more. A process that just halted keeps running on its kernel stack until
+ * it switches away. Called with process_lock held. */
+static void pcb_reap(void)
+{
+    int32_t pid;
+
+    for (pid = pid_map_next(&pid_dead, 0); pid != -1; pid = pid_map_next(&pid_dead, pid + 1)) {
+        pcb_entry_t *pcb = pcb_table[pid];
+
+        if (pcb->context.on_cpu) {
+            continue;
+        }
+        // Only processes with an address space are worth keeping. Theirs
+        // is empty again apart from the kernel part.
+        if (pcb->page_directory && pcb_pool_count < pcb_pool_limit) {
+            pd_reset(pcb->page_directory);
+            pcb_pool[pcb_pool_count++] = pcb;
+        } else {
+            frame_free(pcb->kernel_stack, KERNEL_STACK_ORDER);
+            frame_free((uint32_t)pcb->page_directory, 0);
+            kmem_cache_free(pcb_cache, pcb);
+        }
+        pcb_table[pid] = NULL;
+        pid_map_clear(&pid_dead, pid);
+        pid_map_clear(&pid_in_use, pid);
+    }
+}
+
+/* Returns a free pid, searching from next_pid on, or -1. Called with
+ * process_lock held. */
+static int32_t pid_find_free(void)
+{
+    int32_t i;
+
+    for (i = next_pid / 32; i < next_pid / 32 + MAX_NUM_PROCESSES / 32 + 1; i++) {
+        int32_t word = i % (MAX_NUM_PROCESSES / 32);
+        uint32_t bits = ~pid_in_use.bits[word];
+
+        // The first time round, only the pids from next_pid on.
+        if (i == next_pid / 32) {
+            bits &= ~0U << (next_pid % 32);
+        }
+        if (bits) {
+            return word * 32 + __builtin_ctz(bits);
+        }
+    }
+    return -1;
+}
+
+int32_t pcb_alloc(bool user)
+{
+    unsigned long flags;
+    pcb_entry_t *pcb = NULL;
+    pcb_hot_t *hot;
+    page_directory_t *page_directory = NULL;
+    uint32_t stack = 0;
+    int32_t pid;
+
+    spin_lock_irqsave(&process_lock, flags);
+
+    pcb_reap();
+    pid = pid_find_free();
+    if (pid == -1) {
+        spin_unlock_irqrestore(&process_lock, flags);
+        return -1;
+    }
+    if (user && pcb_pool_count > 0) {
+        pcb = pcb_pool[--pcb_pool_count];
+        stack = pcb->kernel_stack;
+        page_directory = pcb->page_directory;
+    } else {
+        pcb = kmem_cache_alloc(pcb_cache);
+        stack = frame_alloc(KERNEL_STACK_ORDER);
+        if (user) {
+            page_directory = pd_alloc();
+        }
+        if (pcb == NULL || stack == 0 || (user && page_directory == NULL)) {
+            if (pcb) {
+                kmem_cache_free(pcb_cache, pcb);
+            }
+            frame_free(stack, KERNEL_STACK_ORDER);
+            frame_free((uint32_t)page_directory, 0);
+            spin_unlock_irqrestore(&process_lock, flags);
+            return -1;
+        }
+    }
+
+    memset(pcb, 0, sizeof(*pcb));
+    pcb->kernel_stack = stack;
+    pcb->page_directory = page_directory;
+    pcb->context.esp0 = KERNEL_STACK_TOP(pcb);
+    pcb->context.cr3 = page_directory ? (uint32_t)page_directory : (uint32_t)pd_kernel;
+    // current_pid() finds the pid here.
+    *(int32_t *)stack = pid;
+
+    // Claim it so no other processor takes it while it is set up.
+    pid_map_set(&pid_in_use, pid);
+    next_pid = (pid + 1) % MAX_NUM_PROCESSES;
+    pcb_table[pid] = pcb;
+    hot = GET_PCB_HOT(pid);
+    hot->active = true;
+    hot->runnable = false;
+    hot->on_rq = false;
+    hot->policy = SCHED_NORMAL;
+    hot->rt_priority = 0;
+    hot->time_slice = 0;
+    hot->terminal = -1;
+    hot->cpu = 0;
+    hot->pinned = false;
+    hot->rq_next = -1;
+
+    spin_unlock_irqrestore(&process_lock, flags);
+    return pid;
+}
+
+void __pcb_release(int32_t pid)
+{
+    GET_PCB_HOT(pid)->active = false;
+    pid_map_set(&pid_dead, pid);
+}
+
+void pcb_release(int32_t pid)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&process_lock, flags);
+    __pcb_release(pid);
+    spin_unlock_irqrestore(&process_lock, flags);
+}
 
 void pcb_init()
 {
-    return;
+    pcb_cache = kmem_cache_create("pcb", sizeof(pcb_entry_t), 0);
+}
+
+void pcb_pool_set_limit(int32_t limit)
+{
+    unsigned long flags;
+
+    if (limit < 0) {
+        limit = 0;
+    } else if (limit > PCB_POOL_MAX) {
+        limit = PCB_POOL_MAX;
+    }
+
+    spin_lock_irqsave(&process_lock, flags);
+    pcb_pool_limit = limit;
+    while (pcb_pool_count > limit) {
+        pcb_entry_t *pcb = pcb_pool[--pcb_pool_count];
+
+        frame_free(pcb->kernel_stack, KERNEL_STACK_ORDER);
+        frame_free((uint32_t)pcb->page_directory, 0);
+        kmem_cache_free(pcb_cache, pcb);
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
 }
@@ -3,6 +3,7 @@
 
 #include "fs.h"
 #include "keyboard.h"
+#include "switch.h"
 
 /*
  * Process Control Block (PCB) is a data structure in the operating system kernel
@@ -11,54 +12,224 @@
  */
 
 #define MAX_FILES_PER_PROCESS 8
-#define MAX_NUM_PROCESSES 8
+// Pids go from 0 to MAX_NUM_PROCESSES - 1. A multiple of 32.
+#define MAX_NUM_PROCESSES 512
+// Most exited processes whose PCB, kernel stack and page directory are kept
+// for reuse by pcb_alloc().
+#define PCB_POOL_MAX 16
 
 #ifndef ASM
 #include "stdbool.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "syscall.h"
+#include "trace.h"
+#include "frame.h"
 
 #define KB 1024
 #define MB (KB * 1024)
 #define GB (MB * 1024)
+// Kernel stacks are blocks of frames this big, aligned to their size.
 #define KERNEL_STACK_SIZE (8 * KB)
-#define KERNEL_PAGE_END (8 * MB)
+#define KERNEL_STACK_ORDER 1
+
+/* PCB of |pid|, NULL if the pid is free */
+#define GET_PCB_ENTRY(pid) (pcb_table[pid])
+/* Scheduling state of |pid| */
+#define GET_PCB_HOT(pid) (&pcb_hot[pid])
+
 /*
- * PCB[i] starts at 8MB - (pid + 1) * 8KB
+ * The part of a process the scheduler looks at on every run queue walk and
+ * wakeup. Kept out of the PCB, in pcb_hot[] indexed by pid, so walking a
+ * queue reads a few packed cache lines instead of one PCB per process.
  */
-#define GET_PCB_ENTRY(pid) ((pcb_entry_t *)(KERNEL_PAGE_END - ((pid + 1) * KERNEL_STACK_SIZE)))
-
-/* A single pcb entry that goes in the pcb */
-typedef struct pcb_entry {
-    // True means this pcb_entry is currently representing a process. False
-    // means there is no process being stored here.
+typedef struct pcb_hot {
+    // True means this pid is currently representing a process. False means
+    // the process exited, or the pid is free.
     bool active;
     // True if process should be run by the scheduler. Set to false to stop
     // scheduler from running this.
     bool runnable;
-    // The terminal this process belongs to.
-    int32_t terminal;
-    // Jump back point for schedule().
-    uint32_t sched_jump_back;
+    // True while the process is running or waiting on a run queue. Only
+    // changed with the run queue lock of |cpu| held, so a wakeup can tell
+    // whether the process still needs queueing.
+    bool on_rq;
+    // Scheduling policy (SCHED_*), real-time priority (0 for SCHED_NORMAL)
+    // and ticks left in the time slice of a SCHED_RR process.
+    int8_t policy;
+    int8_t rt_priority;
+    // True if the process only ever runs on |cpu|: it is always queued there
+    // and never stolen by another processor.
+    bool pinned;
+    // The terminal this process belongs to, -1 for kernel threads.
+    int16_t terminal;
+    int16_t time_slice;
+    // Processor whose run queue this process is on, or that last ran it.
+    int16_t cpu;
+    // Next pid in the run queue this process waits on, -1 at the tail.
+    int32_t rq_next;
+} pcb_hot_t;
+
+/* A set of pids, one bit each */
+typedef struct pid_map {
+    uint32_t bits[MAX_NUM_PROCESSES / 32];
+} pid_map_t;
+
+/* A single pcb entry that goes in the pcb */
+typedef struct pcb_entry {
+    // Kernel registers saved by switch_to() while this process isn't running.
+    context_t context;
+    // Bottom of the kernel stack, a KERNEL_STACK_ORDER block of frames.
+    uint32_t kernel_stack;
+    // Page directory, from the frame allocator. NULL for kernel threads,
+    // which run on pd_kernel.
+    struct page_directory *page_directory;
+
+    // CPU time used in user mode and in the kernel, and time spent runnable
+    // on a run queue, in TSC cycles. Time in IRQ handlers is charged to
+    // whatever the process was doing when the IRQ came.
+    uint64_t utime;
+    uint64_t stime;
+    uint64_t rq_wait;
+    // When time was last charged to utime or stime.
+    uint64_t acct_stamp;
+    // When the process was put on its run queue, 0 while it isn't on one.
+    uint64_t rq_stamp;
+    // Context switches away from the process because it blocked (voluntary)
+    // or was preempted (involuntary).
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    // True while the process runs kernel code: in a syscall, or always for a
+    // kernel thread. Picks whether running time goes to utime or stime.
+    bool in_kernel;
+    // True while syscall tracing is on for this process (see trace.c), and
+    // the syscall it is in, filled in on entry and written out on return.
+    bool traced;
+    trace_rec_t trace_rec;
+    // Syscall the process is in and when it started, and the latencies and
+    // counts of its syscalls so far.
+    int32_t syscall_nr;
+    uint64_t syscall_stamp;
+    hist_t syscall_hist;
+    uint32_t syscall_counts[NUM_SYSCALLS];
 
     /*
     * Each task can have up to 8 open files.
     * These open files are represented with a file array, stored in the process control block (PCB).
     * The integer index into this array is called the "file descriptor", and this integer is how user-level programs indentify the open file.
+    * Kept in the PCB rather than in a cache of its own: the whole table is
+    * 8 x 16 bytes, every process has one, no file outlives its process or is
+    * shared with another, and the PCB already comes from pcb_cache and the
+    * PCB pool. A file_t cache would add an allocation, and a way to fail, to
+    * every open() and fork() and save nothing.
     */
     file_t files[MAX_FILES_PER_PROCESS];
     int myparent_pid; //do i still need parent pcb pointer?
+    // True for a child of fork() or spawn(). Its parent runs on instead of
+    // waiting for it in execute(), so halt() has nobody to switch back to.
+    // The parent collects |exit_status| with waitpid() once |zombie| is set.
+    // Once the process runs, these and |myparent_pid| only change with
+    // process_lock held.
+    bool spawned;
+    bool zombie;
+    uint32_t exit_status;
+    // Counts the children of this process that became zombies. waitpid()
+    // sleeps until it changes, so it never needs process_lock to decide.
+    volatile uint32_t child_exits;
     int my_pid;
     uint8_t arguments[keyboard_buf_size + 1]; //+1 to ensure that there is a room to put NULL at the end
     uint32_t program_entry;
-    uint32_t esp;
-    uint32_t esp0;
-    uint32_t ebp;
+    // User pages mapped, and how many of them were mapped by the page fault
+    // handler.
+    uint32_t rss;
+    uint32_t min_flt;
     uint32_t child_status;
 } pcb_entry_t;
 
+extern pcb_entry_t *pcb_table[MAX_NUM_PROCESSES];
+extern pcb_hot_t pcb_hot[MAX_NUM_PROCESSES];
+
+/*
+ * Returns the pid of the process running on this processor (not the
+ * currently visible one), -1 while the processor is idle. Worked out from the
+ * stack pointer: a process always runs on its own kernel stack, which comes
+ * from the frame allocator and has the pid in its lowest word, while the boot
+ * and idle stacks are in the kernel image below FRAME_BASE. Unlike
+ * this_cpu()->running_pid this stays right if the process is preempted and
+ * moved to another processor halfway through.
+ */
+static inline int32_t current_pid(void)
+{
+    uint32_t esp;
+
+    asm volatile("movl %%esp, %0"
+                 : "=r"(esp));
+    if (esp < FRAME_BASE) {
+        return -1;
+    }
+    return *(int32_t *)(esp & ~(KERNEL_STACK_SIZE - 1));
+}
+
+/* Top of the kernel stack of |pcb|, where esp0 points. 4 is the size of
+ * the first element on the stack. */
+#define KERNEL_STACK_TOP(pcb) ((pcb)->kernel_stack + KERNEL_STACK_SIZE - 4)
+
+/* User registers of |pcb| saved on entry to the syscall it is in */
+#define SYSCALL_FRAME(pcb) ((syscall_frame_t *)KERNEL_STACK_TOP(pcb) - 1)
+
+static inline void pid_map_set(pid_map_t *map, int32_t pid)
+{
+    map->bits[pid / 32] |= 1 << (pid % 32);
+}
+
+static inline void pid_map_clear(pid_map_t *map, int32_t pid)
+{
+    map->bits[pid / 32] &= ~(1 << (pid % 32));
+}
+
+// Returns the first pid in |map| from |pid| on, -1 if there is none.
+int32_t pid_map_next(const pid_map_t *map, int32_t pid);
+
+// Pids of the processes that exist, including ones that exited but still
+// have their PCB. Only changes with process_lock held.
+extern pid_map_t pid_in_use;
+
+// Visits every pid in pid_in_use. Hold process_lock to keep the PCBs from
+// being freed meanwhile.
+#define for_each_pid(pid) \
+    for ((pid) = pid_map_next(&pid_in_use, 0); (pid) != -1; (pid) = pid_map_next(&pid_in_use, (pid) + 1))
+
 // Process identifier of currently running process (not the currently visible
 // one).
-extern int curr_pid;
+#define curr_pid (current_pid())
+
+// Serializes allocation and freeing of PCBs between processors.
+extern spinlock_t process_lock;
+
+// Returns curr_pid. For assembly code, which can't use the macro.
+int32_t get_curr_pid(void);
+
+// Claims a free pid and gives it a zeroed PCB and a kernel stack, and if
+// |user| is set a page directory with the kernel mappings and an empty user
+// memory (see pd_alloc()). The context has esp0 and cr3 filled in already.
+// These come from the pool of exited processes when it has any. The process
+// comes back active but not runnable.
+// Return: the pid, -1 if every one is in use or memory ran out.
+int32_t pcb_alloc(bool user);
+
+// Marks process |pid| inactive and gives it up. Its PCB, kernel stack and
+// page directory are freed by a later pcb_alloc() once no processor runs on
+// them any more, so an exiting process may call this on itself.
+void pcb_release(int32_t pid);
+
+// pcb_release() for callers that hold process_lock.
+void __pcb_release(int32_t pid);
+
+// Keeps up to |limit| (at most PCB_POOL_MAX) exited processes for reuse,
+// freeing the ones over it. 0 turns the pool off.
+void pcb_pool_set_limit(int32_t limit);
 
+// Makes the PCB cache. Needs slab_init() to have run.
 void pcb_init();
 
 #endif //ASM
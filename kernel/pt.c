@@ -3,6 +3,15 @@
 #include "pt.h"
 #include "sys_vidmap.h"
 #include "schedule.h"
+#include "apic.h"
+#include "smp.h"
+#include "syscall.h"
+#include "frame.h"
+
+/* What every process page directory starts out as: the kernel mappings and
+ * an empty user memory. Built once by page_table_init(), copied by
+ * pd_alloc(). */
+static page_directory_t pd_template __attribute__((aligned(sizeof(page_directory_t))));
 
 /* Maps a virtual address to a physical address in a page directory with the correct flags */
 void map_page_directory_entry(page_directory_t *page_directory, uint32_t virtual_memory, uint32_t physical_memory, uint32_t flags)
@@ -27,6 +36,60 @@ void map_page_table_entry(page_table_t *page_table, uint32_t virtual_memory, uin
     SET_PTE_ADDRESS(*entry, physical_memory);
 }
 
+/* Maps the kernel, the memory frame_alloc() hands out, the video memory, the
+ * APIC registers and the vsyscall page, which every address space needs. All
+ * of it is global: with CR4.PGE on, switching address spaces leaves it in the
+ * TLB, and interrupt handlers can use it with any page directory loaded. */
+void map_kernel_pages(page_directory_t *page_directory)
+{
+    uint32_t addr;
+
+    /* The first 4 MB of memory is broken down into 4 kB pages, of which only
+     * the VGA buffer, the video pages of the terminals and the AP start up
+     * page are mapped, for the kernel. */
+    map_page_directory_entry(page_directory, 0, (uint32_t)vid_mem_pt, P | RW);
+
+    /* The kernel is loaded at physial address 0x400000 (4 MB),
+     * and also mapped at virtual address 4 MB.
+     * A global page directory entry with its Supervisor bit set
+     * should be set up to map the kernel to virtual address 0x400000 (4 MB).
+     * Writable, since write protection applies to the kernel as well.
+     */
+    map_page_directory_entry(page_directory, KERNEL_MEMORY, KERNEL_MEMORY, P | RW | PS | G);
+
+    /* All RAM the frame allocator manages, at its physical address and for
+     * the kernel only, so frames can be used without mapping them first. */
+    for (addr = FRAME_BASE; addr < lowmem_end; addr += 4 * MB) {
+        map_page_directory_entry(page_directory, addr, addr, P | RW | PS | G);
+    }
+
+    /* Local APIC and IO APIC registers. Device memory, so never cached. IRQ
+     * and IPI handlers touch them with whatever page directory is loaded. */
+    map_page_directory_entry(page_directory, APIC_MMIO_BASE, APIC_MMIO_BASE, P | RW | PS | PCD | PWT | G);
+
+    /* The fast syscall stub, which user programs call into. Read-only. */
+    map_page_directory_entry(page_directory, VSYSCALL_ADDR, (uint32_t)vsyscall_pt, P | US);
+}
+
+page_directory_t *pd_alloc(void)
+{
+    page_directory_t *page_directory = (page_directory_t *)frame_alloc(0);
+
+    if (page_directory) {
+        memcpy(page_directory, &pd_template, sizeof(page_directory_t));
+    }
+    return page_directory;
+}
+
+void pd_reset(page_directory_t *page_directory)
+{
+    uint32_t vidmap = VIR_VIDEO_MEMORY >> NUM_4MB_OFFSET_BITS;
+
+    /* The only entry a process adds besides its user memory */
+    page_directory->entries[vidmap] = pd_template.entries[vidmap];
+    user_space_init(page_directory);
+}
+
 /*
  * is_user
  *   DESCRIPTION: Check if a virtual address is in a user page
@@ -38,81 +101,265 @@ void map_page_table_entry(page_table_t *page_table, uint32_t virtual_memory, uin
  */
 uint8_t is_user(uint32_t virtual_memory)
 {   
-    page_directory_t* curr_pd = &pds[curr_pid]; 
+    page_directory_t* curr_pd = GET_PCB_ENTRY(curr_pid)->page_directory; 
 
     uint32_t index = virtual_memory >> NUM_4MB_OFFSET_BITS;
     pde_t *pd_entry = &curr_pd->entries[index];
 
-
+    /* The page tables of the user memory are only made once a page in
+     * their 4 MB is mapped. Untouched pages are user pages all the same. */
+    if (!GET_P(*pd_entry))
+        return in_user_memory(virtual_memory);
 
     if (!GET_US(*pd_entry))
         return 0;
 
     if(!GET_PS(*pd_entry)){
         page_table_t* page_table = (page_table_t*)GET_4KB_PDE_ADDRESS(*pd_entry);
-        printf("pd_entry:%x\n", pd_entry);
 
         index = (virtual_memory & 0x3FFFFF) >> NUM_4KB_OFFSET_BITS;
-        printf("page_table:%x\n", page_table);
-
         pte_t *pt_entry = &page_table->entries[index];
 
-        printf("pt_entry:%x\n", pt_entry);
+        /* Pages of the user memory that were never touched are user pages
+         * too. The page fault handler maps them on first access. */
+        if (!GET_P(*pt_entry))
+            return in_user_memory(virtual_memory);
 
         if (!GET_US(*pt_entry))
             return 0;
-
-        printf("is_user:here");
     }
 
     return 1;
 }
 
+/* Returns the page table of the user memory of |page_directory| that covers
+ * |virtual_memory|. If there is none yet, makes an empty one when |alloc| is
+ * set and returns NULL otherwise, or if there is no frame for it. */
+static page_table_t *user_page_table(page_directory_t *page_directory, uint32_t virtual_memory, bool alloc)
+{
+    pde_t *entry = &page_directory->entries[virtual_memory >> NUM_4MB_OFFSET_BITS];
+    uint32_t page_table;
+
+    if (GET_P(*entry)) {
+        return (page_table_t *)GET_4KB_PDE_ADDRESS(*entry);
+    }
+    if (!alloc || (page_table = frame_alloc(0)) == 0) {
+        return NULL;
+    }
+    memset((void *)page_table, 0x00, sizeof(page_table_t));
+    /* Whether a page is writable is up to its page-table entry */
+    map_page_directory_entry(page_directory, virtual_memory, page_table, P | RW | US);
+    return (page_table_t *)page_table;
+}
+
+void user_space_init(page_directory_t *page_directory)
+{
+    memset(&page_directory->entries[USER_PDE_FIRST], 0x00, USER_PDE_COUNT * sizeof(pde_t));
+}
+
+uint32_t user_page_lookup(page_directory_t *page_directory, uint32_t virtual_memory)
+{
+    page_table_t *page_table;
+    pte_t entry;
+
+    if (!in_user_memory(virtual_memory) ||
+        (page_table = user_page_table(page_directory, virtual_memory, false)) == NULL) {
+        return 0;
+    }
+    entry = page_table->entries[(virtual_memory & 0x3FFFFF) >> NUM_4KB_OFFSET_BITS];
+    return GET_P(entry) ? GET_PTE_ADDRESS(entry) : 0;
+}
+
+uint32_t user_page_alloc(page_directory_t *page_directory, uint32_t virtual_memory, uint32_t flags)
+{
+    page_table_t *page_table;
+    pte_t *entry;
+    uint32_t frame;
+
+    if (!in_user_memory(virtual_memory) ||
+        (page_table = user_page_table(page_directory, virtual_memory, true)) == NULL) {
+        return 0;
+    }
+    entry = &page_table->entries[(virtual_memory & 0x3FFFFF) >> NUM_4KB_OFFSET_BITS];
+    if (GET_P(*entry)) {
+        *entry |= flags;
+        return GET_PTE_ADDRESS(*entry);
+    }
+    frame = frame_alloc(0);
+    if (frame == 0) {
+        return 0;
+    }
+    memset((void *)frame, 0x00, FRAME_SIZE);
+    map_page_table_entry(page_table, virtual_memory, frame, P | US | flags);
+    return frame;
+}
+
+void user_space_free(page_directory_t *page_directory)
+{
+    pde_t entries[USER_PDE_COUNT];
+    uint32_t cr3;
+    int i, j;
+
+    /* Unmap first, so nothing can reach the frames once they are reused */
+    memcpy(entries, &page_directory->entries[USER_PDE_FIRST], sizeof(entries));
+    user_space_init(page_directory);
+    GET_CR3(cr3);
+    if (cr3 == (uint32_t)page_directory) {
+        SET_CR3(page_directory);
+    }
+
+    for (i = 0; i < USER_PDE_COUNT; i++) {
+        page_table_t *page_table = (page_table_t *)GET_4KB_PDE_ADDRESS(entries[i]);
+
+        if (!GET_P(entries[i])) {
+            continue;
+        }
+        for (j = 0; j < NUM_PTE_ENTRIES; j++) {
+            if (GET_P(page_table->entries[j])) {
+                frame_put(GET_PTE_ADDRESS(page_table->entries[j]));
+            }
+        }
+        frame_free((uint32_t)page_table, 0);
+    }
+}
+
+int32_t user_space_copy(page_directory_t *dst, page_directory_t *src)
+{
+    uint32_t virtual_memory;
+    uint32_t cr3;
+    int32_t ret = 0;
+    int i;
+
+    for (virtual_memory = USER_MEMORY; virtual_memory - USER_MEMORY < USER_MEMORY_SIZE;
+         virtual_memory += 1 << NUM_4MB_OFFSET_BITS) {
+        page_table_t *src_table = user_page_table(src, virtual_memory, false);
+        page_table_t *dst_table;
+
+        if (src_table == NULL) {
+            continue;
+        }
+        dst_table = user_page_table(dst, virtual_memory, true);
+        if (dst_table == NULL) {
+            ret = -1;
+            break;
+        }
+        for (i = 0; i < NUM_PTE_ENTRIES; i++) {
+            pte_t *entry = &src_table->entries[i];
+
+            if (!GET_P(*entry)) {
+                continue;
+            }
+            if (GET_RW(*entry)) {
+                *entry = (*entry & ~RW) | PTE_COW;
+            }
+            dst_table->entries[i] = *entry;
+            frame_get(GET_PTE_ADDRESS(*entry));
+        }
+    }
+
+    /* The pages of |src| that were writable are not any more */
+    GET_CR3(cr3);
+    if (cr3 == (uint32_t)src) {
+        SET_CR3(src);
+    }
+    return ret;
+}
+
+/* Gives the running process its own writable copy of the copy-on-write page
+ * at |entry|, which maps |virtual_memory|. The last one to write keeps the
+ * frame. Returns 0, or -1 if there is no frame for the copy. */
+static int32_t cow_break(pte_t *entry, uint32_t virtual_memory)
+{
+    uint32_t old = GET_PTE_ADDRESS(*entry);
+    uint32_t frame;
+
+    if (frame_refcount(old) > 1) {
+        frame = frame_alloc(0);
+        if (frame == 0) {
+            return -1;
+        }
+        memcpy((void *)frame, (void *)old, FRAME_SIZE);
+        SET_PTE_ADDRESS(*entry, frame);
+        frame_put(old);
+    }
+    *entry = (*entry & ~PTE_COW) | RW;
+    asm volatile("invlpg (%0)"
+                 :
+                 : "r"(virtual_memory)
+                 : "memory");
+    return 0;
+}
+
+int32_t do_page_fault(uint32_t error_code)
+{
+    int32_t pid = curr_pid;
+    page_table_t *page_table;
+    pcb_entry_t *pcb;
+    pte_t *entry;
+    uint32_t addr;
+    uint32_t cr3;
+
+    asm volatile("movl %%cr2, %0"
+                 : "=r"(addr));
+    GET_CR3(cr3);
+
+    /* Only a missing page or a write to a copy-on-write page of the user
+     * memory of the running process, in its own address space, is handled.
+     * Whether the program or a syscall touched it does not matter. */
+    if (pid < 0) {
+        return -1;
+    }
+    pcb = GET_PCB_ENTRY(pid);
+    if (cr3 != (uint32_t)pcb->page_directory || !in_user_memory(addr)) {
+        return -1;
+    }
+    if (error_code & PF_ERROR_PRESENT) {
+        page_table = user_page_table(pcb->page_directory, addr, false);
+        if (page_table == NULL) {
+            return -1;
+        }
+        entry = &page_table->entries[(addr & 0x3FFFFF) >> NUM_4KB_OFFSET_BITS];
+        if (!(error_code & PF_ERROR_WRITE) || !(*entry & PTE_COW) ||
+            cow_break(entry, addr & ~(FRAME_SIZE - 1)) == -1) {
+            return -1;
+        }
+        pcb->min_flt++;
+        return 0;
+    }
+    if (user_page_alloc(pcb->page_directory, addr & ~(FRAME_SIZE - 1), RW) == 0) {
+        return -1;
+    }
+
+    pcb->rss++;
+    pcb->min_flt++;
+    return 0;
+}
+
 // Inititialize the page directory and table. Sets up page directory entry for
 // kernel memory (0x400000) and for initial video memory.
 void page_table_init()
 {
     pde_t *kernel_pd = (pde_t *)&pd_kernel[0];
-    int pid;
     int i;
 
     /* Setting up static page tables */
-    /* The kernel is loaded at physial address 0x400000 (4 MB),
-     * and also mapped at virtual address 4 MB.
-     * A global page directory entry with its Supervisor bit set
-     * should be set up to map the kernel to virtual address 0x400000 (4 MB).
-     */
-    map_page_directory_entry((page_directory_t *)kernel_pd, KERNEL_MEMORY, KERNEL_MEMORY, P | PS | G);
-
-    /* Whereas the first 4 MB of memory should broken down into 4 kB pages.*/
-    /* Mapping first 4 MB of memory to a page table that breaks the 4mb of memory into 4k pages */
-    map_page_directory_entry((page_directory_t *)kernel_pd, 0, (uint32_t)vid_mem_pt, P);
+    map_kernel_pages((page_directory_t *)kernel_pd);
+    map_kernel_pages(&pd_template);
 
     /* mapping video memory for the kernel */
     /*VGA memory*/
-    map_page_table_entry((page_table_t *)vid_mem_pt, VIDEO_MEMORY, VIDEO_MEMORY, P);
-    /*invisible video page for terminal 1*/
-    map_page_table_entry((page_table_t *)vid_mem_pt, VIDEO_MEMORY + VIDEO_MEMORY_SIZE, VIDEO_MEMORY + VIDEO_MEMORY_SIZE, P);
-    /*invisible video page for terminal 2*/
-    map_page_table_entry((page_table_t *)vid_mem_pt, VIDEO_MEMORY + VIDEO_MEMORY_SIZE * 2, VIDEO_MEMORY + VIDEO_MEMORY_SIZE * 2, P);
-    /*invisible video page for terminal 3*/
-    map_page_table_entry((page_table_t *)vid_mem_pt, VIDEO_MEMORY + VIDEO_MEMORY_SIZE * 3, VIDEO_MEMORY + 3 * VIDEO_MEMORY_SIZE, P);
-
-    // Setup terminal page tables.
-    for (i = 1; i <= MAX_NUM_TERMINALS; i++) {
-        map_page_table_entry((page_table_t *)us_vid_mem_pt[0], VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, P | RW);
-        map_page_table_entry((page_table_t *)us_vid_mem_pt[1], VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, P | RW);
-        map_page_table_entry((page_table_t *)us_vid_mem_pt[2], VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, VIDEO_MEMORY + i * VIDEO_MEMORY_SIZE, P | RW);
+    map_page_table_entry((page_table_t *)vid_mem_pt, VIDEO_MEMORY, VIDEO_MEMORY, P | RW | G);
+    /*invisible video pages of the terminals*/
+    for (i = 0; i < MAX_NUM_TERMINALS; i++) {
+        map_page_table_entry((page_table_t *)vid_mem_pt, TERMINAL_VIDEO_PAGE(i), TERMINAL_VIDEO_PAGE(i), P | RW | G);
     }
+    /*page smp_init() copies the AP start up code to*/
+    map_page_table_entry((page_table_t *)vid_mem_pt, AP_TRAMPOLINE_ADDR, AP_TRAMPOLINE_ADDR, P | RW | G);
+
+    // Setup terminal page tables, which vidmap() maps for user programs.
     map_page_table_entry((page_table_t *)us_vid_mem_pt[0], VIDEO_MEMORY, VIDEO_MEMORY, P | RW | US);
-    map_page_table_entry((page_table_t *)us_vid_mem_pt[1], VIDEO_MEMORY, VIDEO_MEMORY + 2 * VIDEO_MEMORY_SIZE, P | RW | US);
-    map_page_table_entry((page_table_t *)us_vid_mem_pt[2], VIDEO_MEMORY, VIDEO_MEMORY + 3 * VIDEO_MEMORY_SIZE, P | RW | US);
- 
-    /* Setting up user program virutal to physical mapping from kernel's perspective */
-    for (pid = 0; pid < MAX_NUM_PROCESSES; pid++) {
-        uint32_t addr = PID_TO_PHYSICAL_ADDRESS(pid);
-        map_page_directory_entry((page_directory_t *)kernel_pd, addr, addr, P | PS);
-    }
+    map_page_table_entry((page_table_t *)us_vid_mem_pt[1], VIDEO_MEMORY, TERMINAL_VIDEO_PAGE(1), P | RW | US);
+    map_page_table_entry((page_table_t *)us_vid_mem_pt[2], VIDEO_MEMORY, TERMINAL_VIDEO_PAGE(2), P | RW | US);
 
     ENABLE_PAGING();
 }
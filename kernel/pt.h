@@ -45,15 +45,35 @@
 /*Size of a 4KB page*/
 #define VIDEO_MEMORY_SIZE (1 << NUM_4KB_OFFSET_BITS)/*in bytes*/
 
+// Where the video memory of a terminal is kept while it isn't visible, in the
+// pages after the VGA buffer. The kernel reaches these and the VGA buffer at
+// their physical addresses in every address space (see map_kernel_pages()).
+#define TERMINAL_VIDEO_PAGE(terminal) (VIDEO_MEMORY + VIDEO_MEMORY_SIZE * ((terminal) + 1))
+
 // Where in physical (and virtual) memory the kernel page is.
 #define KERNEL_MEMORY 0x400000
 
-// Where in virtual memory a program is loaded.
-#define PROGRAM_VIRTUAL_ADDRESS 0x08048000
+// The user memory of a process: the 128 MB from 128 MB, which holds the
+// segments of the program (see elf_load()), its bss and, at the top, its
+// stack. It is mapped with 4 KB pages, and the pages outside the file parts
+// of the segments are allocated as the program first touches them (see
+// do_page_fault()). Page tables are made as pages in their 4 MB are mapped.
+#define USER_MEMORY 0x08000000
+#define USER_MEMORY_SIZE 0x08000000
+// Page directory entries of the user memory.
+#define USER_PDE_FIRST (USER_MEMORY >> NUM_4MB_OFFSET_BITS)
+#define USER_PDE_COUNT (USER_MEMORY_SIZE >> NUM_4MB_OFFSET_BITS)
+
+// Set in the page fault error code if the page was present, i.e. the access
+// broke its protection.
+#define PF_ERROR_PRESENT 0x1
+// Set in the page fault error code if the access was a write.
+#define PF_ERROR_WRITE 0x2
 
-// Converts a zero index pid to it's starting physical addresss
-// 4mb is the space of a program page
-#define PID_TO_PHYSICAL_ADDRESS(pid) (KERNEL_MEMORY + (pid + 1) * 4 * MB)
+// Available bit 9 of a page-table entry. Marks a user page that was writable
+// before fork() made it read-only and shared; the first write to it copies it
+// (see do_page_fault()).
+#define PTE_COW 0x200
 
 #ifndef ASM
 /* A Page-Directory Entry */
@@ -65,8 +85,6 @@ typedef struct page_directory {
 
 /*Page directory for the kernel itself*/
 page_directory_t pd_kernel[1] __attribute__((aligned(sizeof(page_directory_t))));
-/*An array of page directory. Index this array using pid*/
-page_directory_t pds[MAX_NUM_PROCESSES] __attribute__((aligned(sizeof(page_directory_t))));
 
 /* A Page-Table Entry */
 typedef uint32_t pte_t;
@@ -77,6 +95,9 @@ typedef struct page_table {
 
 pte_t vid_mem_pt[NUM_PTE_ENTRIES] __attribute__((aligned(sizeof(page_table_t))));
 
+/* Page table of the user-readable vsyscall page (see syscall.c) */
+extern pte_t vsyscall_pt[NUM_PTE_ENTRIES] __attribute__((aligned(sizeof(page_table_t))));
+
 /* Gets bit n from a bit map and return the result as a bool */
 #define GET_BIT_N(bitmap, n) (!!((bitmap >> n) & 0x1))
 /* Sets bit n in a bit map a with the provided flag (clamps to ensure a bool) */
@@ -145,15 +166,69 @@ void map_page_directory_entry(page_directory_t *page_directory, uint32_t virtual
 /* Maps a virtual address to a physical address in a page table with the correct flags */
 void map_page_table_entry(page_table_t *page_table, uint32_t virtual_memory, uint32_t physical_memory, uint32_t flags);
 
+/* Maps the kernel, its view of the video memory, the APIC registers and the
+ * vsyscall page, which every address space needs. The pages are global, as
+ * they are the same in all of them. */
+void map_kernel_pages(page_directory_t *page_directory);
+
+/* Returns a page directory holding the kernel mappings every process has and
+ * an empty user memory, copied from a template, or NULL if there is no frame
+ * for it. Give it back with frame_free(). */
+page_directory_t *pd_alloc(void);
+
+/* Puts |page_directory|, whose user memory was freed, back the way pd_alloc()
+ * hands it out, so it can be reused for another process */
+void pd_reset(page_directory_t *page_directory);
+
 /*Check if a virtual address is in a user pages*/
 uint8_t is_user(uint32_t virtual_memory);
 
+/* Returns 1 if |virtual_memory| is in the user memory of a process */
+static inline uint8_t in_user_memory(uint32_t virtual_memory)
+{
+    return virtual_memory - USER_MEMORY < USER_MEMORY_SIZE;
+}
+
+/* Leaves |page_directory| with an empty user memory. Does not free what was
+ * mapped there. */
+void user_space_init(page_directory_t *page_directory);
+
+/* Returns the frame mapped at the page |virtual_memory| of the user memory of
+ * |page_directory|, 0 if there is none. */
+uint32_t user_page_lookup(page_directory_t *page_directory, uint32_t virtual_memory);
+
+/* Maps a zeroed frame at the page |virtual_memory| of the user memory of
+ * |page_directory|, user accessible and with |flags| (RW or 0). A page that
+ * is mapped already keeps its frame and gains |flags|. Returns the frame,
+ * which the kernel can use at that (physical) address, or 0 if there is no
+ * frame or page table for it. */
+uint32_t user_page_alloc(page_directory_t *page_directory, uint32_t virtual_memory, uint32_t flags);
+
+/* Unmaps the user memory of |page_directory| and frees its frames and page
+ * table. Frames shared with other address spaces stay until the last one
+ * lets go. */
+void user_space_free(page_directory_t *page_directory);
+
+/* Maps the user pages of |src| into the empty user memory of |dst|, sharing
+ * the frames. Writable pages become read-only and copy-on-write in both.
+ * Flushes the TLB if |src| is loaded. Returns 0, or -1 if there was no frame
+ * for a page table, in which case |dst| has only some of the pages. */
+int32_t user_space_copy(page_directory_t *dst, page_directory_t *src);
+
+/* Called by page_fault_handler with the error code the processor pushed.
+ * Returns 0 if the fault was a first touch of the running process's user
+ * memory or a write to one of its copy-on-write pages and the page is now
+ * there, -1 if it is a real error. */
+int32_t do_page_fault(uint32_t error_code);
+
 // Inititialize the page directory and table.
 void page_table_init();
 
 /*
-# Enables paging mode in x86 processor. Also enables 4 MB pages and loads
-# register cr3 with the page table pointed to by 'pds'.
+# Enables paging mode in x86 processor. Also enables 4 MB and global pages and
+# loads register cr3 with the page table pointed to by 'pds'. Write protection is on
+# for the kernel too, so it takes the copy-on-write faults when it writes to a
+# user buffer.
 # Input: None
 # Output: Enables paging bits in control registers.
 # Return: None
@@ -164,10 +239,10 @@ void page_table_init();
                      "movl  $pd_kernel, %%edx;"                                                                                                                                                                                             \
                      "movl  %%edx, %%cr3;" /* PSE flag in CR4 (bit 4) is set, */ /* both 4-MByte pages and page tables for 4-KByte pages can be accessed from the same page directory.*/                                                    \
                      "movl  %%cr4, %%edx;"                                                                                                                                                                                                  \
-                     "orl   $0x00000010, %%edx;"                                                                                                                                                                                            \
+                     "orl   $0x00000090, %%edx;" /* and PGE (bit 7), so global pages stay in the TLB across CR3 loads */                                                                                                                    \
                      "movl  %%edx, %%cr4;" /* Set the paging (PG) and protection (PE) bits of CR0. */ /* PE flag (bit 0)  in control register CR0—Enables protected mode */ /* PG flag (bit 31) in control register CR0—Enables paging */ \
                      "movl  %%cr0,  %%edx;"                                                                                                                                                                                                 \
-                     "orl   $0x80000001, %%edx;"                                                                                                                                                                                            \
+                     "orl   $0x80010001, %%edx;" /* WP flag (bit 16) too */                                                                                                                                                                 \
                      "movl  %%edx,  %%cr0;" ::                                                                                                                                                                                              \
                              : "memory", "edx");                                                                                                                                                                                            \
     } while (0)
@@ -183,5 +258,15 @@ void page_table_init();
                 : "memory", "edx");    \
     } while (0)
 
+/* Reads the CR3 Register into |pd_addr| */
+#define GET_CR3(pd_addr)               \
+    do {                               \
+        asm volatile(                  \
+                "movl   %%cr3, %0;"    \
+                : "=r"(pd_addr)        \
+                :                      \
+                : "memory");           \
+    } while (0)
+
 #endif /* ASM */
 #endif /*_PT_H */
@@ -3,6 +3,7 @@
 #include "rtc.h"
 #include "i8259.h"
 #include "lib.h"
+#include "wait.h"
 
 /*port select*/
 #define RTC_INDEX_PORT 0x70
@@ -20,15 +21,12 @@
 /*IRQ Interrupt Line*/
 #define RTC_IRQ_NUM 8
 
-/*Interrupt Flag States*/
-#define SET 1
-#define CLEAR 0
-
 /*check if the input number is a power of 2*/
 #define CHECK_POWER2(num) (num != 0 && (num & (num - 1)) == 0)
 
-/*a flag is cleared, if a rtc interrupt is handled*/
-volatile char rtc_flag = SET;
+/*counts handled rtc interrupts; readers sleep on rtc_wait until it changes*/
+static volatile uint32_t rtc_ticks = 0;
+static wait_queue_t rtc_wait = WAIT_QUEUE_INIT;
 
 /*
  * init_rtc
@@ -84,9 +82,9 @@ rtc_open(const uint8_t *file_name)
 int32_t
 rtc_read(int32_t fd, void *buf, int32_t nbytes)
 {
-    rtc_flag = SET;    //reset the flag
-    while (rtc_flag) { /*printf("rtc reading\n");*/
-    };                 //wait until the interrupt handler clear the flag
+    uint32_t start = rtc_ticks;
+
+    wait_event(&rtc_wait, rtc_ticks != start); //sleep until the next interrupt
 
     return 0;
 }
@@ -143,10 +141,10 @@ void rtc_interrupt_handler(void)
 {
     // printf("rtc_interrupt_handler\n");
 
-    rtc_flag = CLEAR;
     outb(RTC_REGISTER_C, RTC_INDEX_PORT); // select register C
     inb(RTC_DATA_PORT);                   // just throw away contents
-    rtc_flag = CLEAR;
+    rtc_ticks++;
+    wake_up(&rtc_wait);
 }
 
 /*
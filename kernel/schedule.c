@@ -7,17 +7,93 @@
 #include "keyboard.h"
 #include "terminal.h"
 #include "i8259.h"
+#include "switch.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "tsc.h"
+#include "trace.h"
+#include "irqsoff.h"
+
+/* Load average: exponentially decaying averages of the number of runnable
+ * processes over 1, 5 and 15 minutes, sampled every LOAD_FREQ_MS, in fixed
+ * point with FSHIFT fractional bits. EXP_n is FIXED_1 / e^(5s / n min). */
+#define FSHIFT 11
+#define FIXED_1 (1 << FSHIFT)
+#define LOAD_FREQ_MS 5000
+#define EXP_1 1884
+#define EXP_5 2014
+#define EXP_15 2037
+
+/* Real-time bandwidth: real-time processes get at most RT_RUNTIME_PCT percent
+ * of every RT_PERIOD_MS on a processor while normal ones are waiting */
+#define RT_PERIOD_MS 1000
+#define RT_RUNTIME_PCT 90
+/* Ticks a SCHED_RR process runs before others of its priority get a turn */
+#define RR_TIMESLICE 10
+
+/* Fair share: SCHED_NORMAL time is split between the terminals (plus one
+ * group for kernel threads) by weight, then round-robin between the
+ * processes of a terminal. Each group has a virtual runtime, its CPU time
+ * on all processors scaled by FAIR_WEIGHT / weight, and on every processor
+ * the group furthest behind runs next. */
+#define NUM_SCHED_GROUPS (MAX_TERMINAL + 1)
+#define KTHREAD_GROUP MAX_TERMINAL
+#define FAIR_WEIGHT 1024
+/* Default weight of the visible terminal in percent of the others */
+#define VISIBLE_BOOST_PCT 200
+/* Virtual runtime a group that slept may be behind the others when it wakes,
+ * so it can't make up for all of the time it did not use */
+#define FAIR_SLEEP_CREDIT_MS 30
 
 int32_t visible_terminal = 0;
 terminal_components_t myTerminals[MAX_TERMINAL];
 //There are three video page table, one for each terminal.
-//When user process starts, points to the video paget table of the terminal it belongs to
+//vidmap() maps the video paget table of the terminal a process belongs to into its memory.
 //Each terminal page table points to either VGA memory or the invisible video page belonging
-//to that terminal.
+//to that terminal. The kernel itself writes to either directly (see terminal_video()).
 //When switching visible terminal, copy VGA memory to the invisible video page. Redirect
 //the video page table to the invisible video page. Then copy the new terminal's video
 //page to the VGA, and redirect the new terminal's video page table to VGA.
 
+// Load averages in FSHIFT fixed point. Updated by the boot processor's tick.
+static uint32_t avenrun[3];
+// TSC value at which the load average is next sampled.
+static uint64_t next_load_update;
+
+// Virtual runtime and CPU time (both in TSC cycles) of each fair share group.
+// Shared by all processors, so a terminal gets its share of the machine and
+// not of each processor it happens to have processes on. Only changed with
+// atomic 64-bit operations, so charging and picking never take a lock.
+typedef struct fair_group {
+    volatile uint64_t vruntime;
+    volatile uint64_t exec_time;
+} fair_group_t;
+
+static fair_group_t fair_groups[NUM_SCHED_GROUPS];
+// Virtual runtime of the group picked last. Only goes up.
+static volatile uint64_t fair_floor;
+
+/* Processes waiting on one processor, linked through rq_next: a FIFO per
+ * real-time priority, with a bit in |rt_bitmap| set for each one that isn't
+ * empty, and a FIFO per fair share group. Picking a process looks at the
+ * head of a few of these, never at the whole queue. Protected by the run
+ * queue lock of the processor, whose nr_queued counts them all. */
+typedef struct rq_list {
+    int32_t head;
+    int32_t tail;
+} rq_list_t;
+
+typedef struct rq_queues {
+    rq_list_t rt[RT_PRIO_MAX + 1];
+    uint32_t rt_bitmap[RT_PRIO_MAX / 32 + 1];
+    rq_list_t fair[NUM_SCHED_GROUPS];
+    // Processes on each of the |fair| lists.
+    int32_t fair_nr[NUM_SCHED_GROUPS];
+} rq_queues_t;
+
+static rq_queues_t rq_queues[MAX_CPUS];
+static int32_t visible_boost_pct = VISIBLE_BOOST_PCT;
+
 // Remembers whether a shell was opened on this terminal or not.
 bool terminal_started_shell[MAX_TERMINAL] = {true, false, false};
 
@@ -36,7 +112,7 @@ void save_terminal_state(int terminal) {
     // /* Save current keyboard buffer to safe place for current terminal.*/
     // memcpy(myTerminals[terminal].keyboard_buf, get_keyboard_in_buf(), myTerminals[terminal].buf_index);
     /* Save current video buffer to safe place for current terminal.*/
-    uint32_t invisible_video_memory = VIDEO_MEMORY + VIDEO_MEMORY_SIZE * (terminal + 1);
+    uint32_t invisible_video_memory = TERMINAL_VIDEO_PAGE(terminal);
     memcpy((void *)invisible_video_memory,(void *)VIDEO_MEMORY, VIDEO_MEMORY_SIZE);
     /* Redirect current terminal's entry in video page table to some safe place.*/
     map_page_table_entry((page_table_t *)us_vid_mem_pt[visible_terminal], VIDEO_MEMORY, invisible_video_memory, P | RW | US);
@@ -56,24 +132,51 @@ void restore_terminal_state(int terminal) {
     // /* Restore keyboard buffer*/
     // memcpy(get_keyboard_in_buf(), myTerminals[terminal].keyboard_buf, myTerminals[terminal].buf_index);
     /* Restore video memory */
-    uint32_t new_invisible_video_memory = VIDEO_MEMORY + VIDEO_MEMORY_SIZE * (terminal + 1);
+    uint32_t new_invisible_video_memory = TERMINAL_VIDEO_PAGE(terminal);
     memcpy((void *)VIDEO_MEMORY, (void *)new_invisible_video_memory, VIDEO_MEMORY_SIZE);
     /* Redirect new visible terminals entry in video page table to VGA buf. */
     map_page_table_entry((page_table_t *)us_vid_mem_pt[terminal], VIDEO_MEMORY, VIDEO_MEMORY, P | RW | US);
 }
 
 
+/* Returns a mask with bit i set if cpus[i] runs a process of terminal |a|
+ * or |b| */
+static uint32_t terminal_cpus(int32_t a, int32_t b)
+{
+    uint32_t mask = 0;
+    int32_t i;
+
+    for (i = 0; i < num_cpus; i++) {
+        int32_t pid = cpus[i].running_pid;
+        int32_t terminal;
+
+        if (pid < 0) {
+            continue;
+        }
+        terminal = GET_PCB_HOT(pid)->terminal;
+        if (terminal == a || terminal == b) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
 int32_t switch_visible_terminal(int32_t new_terminal)
 {
+    int32_t old_terminal;
+    int32_t new_pid;
+
     if (new_terminal == visible_terminal) {
         return 0;
     }
     unsigned long flags;
-    cli_and_save(flags);
-
-    // Use kernel page table to make things easier.
-    SET_CR3(&pd_kernel[0]);
+    // Keeps other processors from writing to video memory while it moves.
+    // Interrupts are only off for the two page copies.
+    spin_lock_irqsave(&terminal_lock, flags);
+    old_terminal = visible_terminal;
 
+    // The VGA buffer and the video pages of the terminals are mapped for the
+    // kernel in every page directory, so whichever is loaded will do.
     // save visible terminal state
     save_terminal_state(visible_terminal);
 
@@ -83,149 +186,960 @@ int32_t switch_visible_terminal(int32_t new_terminal)
     /*update visible terminal number*/
     visible_terminal = new_terminal;
 
-    // Switch back to the user program pd that called this function.
-    SET_CR3(&pds[curr_pid]);
+    // The vidmap() page of the process loaded here, if it has one, moved.
+    asm volatile("invlpg (%0)"
+                 :
+                 : "r"(VIR_VIDEO_MEMORY)
+                 : "memory");
+    spin_unlock_irqrestore(&terminal_lock, flags);
+
+    // Processes of the two terminals may be running elsewhere with the old
+    // vidmap() page in their TLB. Processors that switch to one later load
+    // its page directory, which drops it.
+    smp_mb();
+    smp_flush_tlb_page(VIR_VIDEO_MEMORY, terminal_cpus(old_terminal, new_terminal));
+
+    // A reader of the new terminal may have a line waiting.
+    keyboard_wake_readers();
 
     if (!terminal_started_shell[new_terminal]) {
-        int pid;
-        for (pid = 0; pid < MAX_NUM_PROCESSES; pid++) {
-            if (!GET_PCB_ENTRY(pid)->active) {
-                break;
-            }
-        }
-        if (pid == MAX_NUM_PROCESSES) {
-            SET_CR3(&pd_kernel[0]);
+        // The shell is only queued here. Some processor starts running it
+        // later, so the keyboard work returns normally.
+        new_pid = create_process((uint8_t *)"shell", new_terminal, -1);
+        if (new_pid == -1) {
             printf("Can't start new terminal because out of processes.\n");
-            SET_CR3(&pds[curr_pid]);
             return -1;
         }
 
         terminal_started_shell[new_terminal] = true;
+        sched_enqueue(new_pid);
+    }
 
-        pcb_entry_t *curr_pcb = GET_PCB_ENTRY(curr_pid);
-
-        // Need to enable all IRQs because switching contexts.
-        // System timer.
-        enable_irq(0);
-        // Keyboard.
-        enable_irq(1);
-        // RTC.
-        enable_irq(8);
-
-//        asm volatile(
-//                "movl $switch_term_jump_back, (%0);"
-//            :: "g"(&curr_pcb->sched_jump_back)
-//            );
-
-        curr_pid = -1;
-
-//        asm volatile(
-//                "pushl  %%edi;"
-//                "pushl  %%esi;"
-//                "pushl  %%edx;"
-//                "pushl  %%ecx;"
-//                "pushl  %%ebx;"
-//                "pushl  %%eax;"
-//        :);
-
-        // Save kernel stack registers (%esp, %ebp) in current PCB.
-        STORE_REGISTER_VALUE(esp, &curr_pcb->esp);
-        STORE_REGISTER_VALUE(ebp, &curr_pcb->ebp);
-        execute((uint8_t*)"shell");
-
-//        asm volatile("switch_term_jump_back:");
-//        asm volatile(
-//                "popl  %%eax;"
-//                "popl  %%ebx;"
-//                "popl  %%ecx;"
-//                "popl  %%edx;"
-//                "popl  %%esi;"
-//                "popl  %%edi;"
-//        :);
-
-    }
-
-    // TODO: Need to handle starting new shell for first time (or do it in keyboard handler).
-    restore_flags(flags);
     return 0;
 }
 
+/* Fair share group of the process with scheduling state |hot| */
+static inline int32_t sched_group(pcb_hot_t *hot)
+{
+    return (hot->terminal >= 0) ? hot->terminal : KTHREAD_GROUP;
+}
+
+/* Weight of group |group|. The visible terminal gets its boost. */
+static uint32_t group_weight(int32_t group)
+{
+    if (group == visible_terminal) {
+        return FAIR_WEIGHT * visible_boost_pct / 100;
+    }
+    return FAIR_WEIGHT;
+}
+
+/* If |*v| equals |*old| replaces it with |new|, else loads it into |*old|.
+ * Returns true if it replaced it. */
+static inline bool cmpxchg64(volatile uint64_t *v, uint64_t *old, uint64_t new)
+{
+    uint64_t expected = *old;
+
+    asm volatile("lock cmpxchg8b %1"
+                 : "+A"(*old), "+m"(*v)
+                 : "b"((uint32_t)new), "c"((uint32_t)(new >> 32))
+                 : "memory", "cc");
+    return *old == expected;
+}
+
+/* Reads |*v| in one piece */
+static inline uint64_t read64(volatile uint64_t *v)
+{
+    uint64_t val = 0;
+
+    // Stores 0 back if it is 0, loads it otherwise.
+    cmpxchg64(v, &val, 0);
+    return val;
+}
+
+/* Adds |delta| to |*v| */
+static inline void add64(volatile uint64_t *v, uint64_t delta)
+{
+    uint64_t old = read64(v);
+
+    while (!cmpxchg64(v, &old, old + delta)) {
+    }
+}
+
+/* Raises |*v| to |val| if it is below */
+static inline void max64(volatile uint64_t *v, uint64_t val)
+{
+    uint64_t old = read64(v);
+
+    while (old < val && !cmpxchg64(v, &old, val)) {
+    }
+}
+
+/* Charges the time since the last charge on |cpu|, the caller's processor,
+ * to the group of the normal process running there */
+static void fair_account(cpu_t *cpu, uint64_t now)
+{
+    int32_t pid = cpu->running_pid;
+
+    if (pid >= 0 && GET_PCB_HOT(pid)->policy == SCHED_NORMAL) {
+        int32_t group = sched_group(GET_PCB_HOT(pid));
+        uint64_t delta = now - cpu->fair_stamp;
+
+        add64(&fair_groups[group].exec_time, delta);
+        add64(&fair_groups[group].vruntime, div64_32(delta * FAIR_WEIGHT, group_weight(group)));
+    }
+    cpu->fair_stamp = now;
+}
+
+/* Brings the group of a process that starts or wakes up to within
+ * FAIR_SLEEP_CREDIT_MS of the others */
+static void fair_place(pcb_hot_t *hot)
+{
+    uint64_t floor = read64(&fair_floor);
+    uint64_t credit = (uint64_t)FAIR_SLEEP_CREDIT_MS * tsc_khz;
+
+    if (floor > credit) {
+        max64(&fair_groups[sched_group(hot)].vruntime, floor - credit);
+    }
+}
+
+void sched_cpu_init(cpu_t *cpu)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+    int32_t i;
+
+    for (i = 0; i <= RT_PRIO_MAX; i++) {
+        q->rt[i].head = q->rt[i].tail = -1;
+    }
+    for (i = 0; i < NUM_SCHED_GROUPS; i++) {
+        q->fair[i].head = q->fair[i].tail = -1;
+    }
+}
+
+/* The list of |cpu| that process |hot| waits on */
+static rq_list_t *rq_list(cpu_t *cpu, pcb_hot_t *hot)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+
+    if (hot->policy != SCHED_NORMAL) {
+        return &q->rt[(int32_t)hot->rt_priority];
+    }
+    return &q->fair[sched_group(hot)];
+}
+
+// Puts |pid| on the run queue of |cpu|, last in the list of its priority (or
+// fair share group), or first if |head| is set. The lock of the queue must be
+// held.
+static void rq_insert(cpu_t *cpu, int32_t pid, bool head)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+    pcb_hot_t *hot = GET_PCB_HOT(pid);
+    rq_list_t *list = rq_list(cpu, hot);
+
+    if (list->head == -1) {
+        hot->rq_next = -1;
+        list->head = list->tail = pid;
+    } else if (head) {
+        hot->rq_next = list->head;
+        list->head = pid;
+    } else {
+        hot->rq_next = -1;
+        GET_PCB_HOT(list->tail)->rq_next = pid;
+        list->tail = pid;
+    }
+    if (hot->policy != SCHED_NORMAL) {
+        q->rt_bitmap[hot->rt_priority / 32] |= 1U << (hot->rt_priority % 32);
+    } else {
+        q->fair_nr[sched_group(hot)]++;
+    }
+
+    hot->on_rq = true;
+    hot->cpu = cpu->id;
+    GET_PCB_ENTRY(pid)->rq_stamp = rdtsc();
+    cpu->rq.nr_queued++;
+}
+
+// Takes |pid|, which follows |prev| (-1 at the head) on its list, off the run
+// queue of |cpu|. The lock of the queue must be held.
+static void rq_unlink(cpu_t *cpu, int32_t prev, int32_t pid)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+    pcb_hot_t *hot = GET_PCB_HOT(pid);
+    rq_list_t *list = rq_list(cpu, hot);
+
+    if (prev == -1) {
+        list->head = hot->rq_next;
+    } else {
+        GET_PCB_HOT(prev)->rq_next = hot->rq_next;
+    }
+    if (list->tail == pid) {
+        list->tail = prev;
+    }
+    if (hot->policy != SCHED_NORMAL) {
+        if (list->head == -1) {
+            q->rt_bitmap[hot->rt_priority / 32] &= ~(1U << (hot->rt_priority % 32));
+        }
+    } else {
+        q->fair_nr[sched_group(hot)]--;
+    }
+    cpu->rq.nr_queued--;
+}
+
+// Returns true if the context of |pid| may be resumed: it is not still being
+// switched away from by another processor, or it is |self|, the caller's own
+// process.
+static inline bool context_free(int32_t pid, int32_t self)
+{
+    return pid == self || !GET_PCB_ENTRY(pid)->context.on_cpu;
+}
+
+// Returns the first process on |list| whose context_free(), and in |*prev|
+// the one before it. Usually the head. Pinned processes are skipped if
+// |steal| is set. -1 if there is none.
+static int32_t rq_list_first(rq_list_t *list, int32_t self, bool steal, int32_t *prev)
+{
+    int32_t pid;
+
+    *prev = -1;
+    for (pid = list->head; pid != -1; *prev = pid, pid = GET_PCB_HOT(pid)->rq_next) {
+        if (context_free(pid, self) && !(steal && GET_PCB_HOT(pid)->pinned)) {
+            return pid;
+        }
+    }
+    return -1;
+}
+
+// Removes and returns the next process to run from the run queue of |cpu|:
+// the first of the highest real-time priority, else the first of the fair
+// share group with the least virtual runtime. Only processes whose
+// context_free() count, and with |steal| set (for another processor) only
+// ones that aren't pinned. Returns -1 if there is none. With |skip_rt| set,
+// real-time processes are only picked if no normal one can run. The lock of
+// the queue must be held.
+static int32_t rq_pop(cpu_t *cpu, int32_t self, bool steal, bool skip_rt)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+    int32_t rt_pid = -1, rt_prev = -1;
+    int32_t best = -1, best_prev = -1;
+    uint64_t best_vruntime = 0;
+    int32_t pid, prev;
+    int32_t word, group;
+
+    for (word = RT_PRIO_MAX / 32; word >= 0 && rt_pid == -1; word--) {
+        uint32_t bits = q->rt_bitmap[word];
+        while (bits != 0 && rt_pid == -1) {
+            int32_t bit = 31 - __builtin_clz(bits);
+            rt_pid = rq_list_first(&q->rt[word * 32 + bit], self, steal, &rt_prev);
+            bits &= ~(1U << bit);
+        }
+    }
+
+    if (rt_pid == -1 || skip_rt) {
+        for (group = 0; group < NUM_SCHED_GROUPS; group++) {
+            uint64_t vruntime;
+            if (q->fair[group].head == -1) {
+                continue;
+            }
+            vruntime = read64(&fair_groups[group].vruntime);
+            if (best != -1 && vruntime >= best_vruntime) {
+                continue;
+            }
+            pid = rq_list_first(&q->fair[group], self, steal, &prev);
+            if (pid != -1) {
+                best = pid;
+                best_prev = prev;
+                best_vruntime = vruntime;
+            }
+        }
+    }
+
+    if (best == -1) {
+        pid = rt_pid;
+        prev = rt_prev;
+    } else {
+        pid = best;
+        prev = best_prev;
+        max64(&fair_floor, best_vruntime);
+    }
+    if (pid != -1) {
+        rq_unlink(cpu, prev, pid);
+    }
+    return pid;
+}
+
+// How urgently the processes waiting on |cpu| want a processor, for picking
+// whom to steal from: 0 if a real-time one waits, else one more than the
+// least virtual runtime of a group with processes there, ~0 if none. Read
+// without the lock, so only a hint.
+static uint64_t rq_urgency(cpu_t *cpu)
+{
+    rq_queues_t *q = &rq_queues[cpu->id];
+    uint64_t urgency = ~0ULL;
+    int32_t i;
+
+    for (i = 0; i <= RT_PRIO_MAX / 32; i++) {
+        if (q->rt_bitmap[i] != 0) {
+            return 0;
+        }
+    }
+    for (i = 0; i < NUM_SCHED_GROUPS; i++) {
+        if (q->fair_nr[i] > 0) {
+            uint64_t vruntime = read64(&fair_groups[i].vruntime) + 1;
+            if (vruntime < urgency) {
+                urgency = vruntime;
+            }
+        }
+    }
+    return urgency;
+}
+
+// Takes a waiting process from another online processor: the one whose
+// waiting processes are furthest behind (see rq_urgency()), the longest
+// queue of those. Returns -1 if every other queue is empty.
+static int32_t steal_task(cpu_t *cpu)
+{
+    cpu_t *victim = NULL;
+    uint64_t best = 0;
+    int32_t pid;
+    int32_t i;
+
+    for (i = 0; i < num_cpus; i++) {
+        uint64_t urgency;
+        if (&cpus[i] == cpu || !cpu_online(i) || cpus[i].rq.nr_queued == 0) {
+            continue;
+        }
+        urgency = rq_urgency(&cpus[i]);
+        if (victim == NULL || urgency < best ||
+            (urgency == best && cpus[i].rq.nr_queued > victim->rq.nr_queued)) {
+            victim = &cpus[i];
+            best = urgency;
+        }
+    }
+    if (victim == NULL) {
+        return -1;
+    }
+
+    spin_lock(&victim->rq.lock);
+    pid = rq_pop(victim, -1, true, cpu->rt_throttled);
+    if (pid != -1) {
+        GET_PCB_HOT(pid)->cpu = cpu->id;
+    }
+    spin_unlock(&victim->rq.lock);
+    return pid;
+}
+
+/* Real-time priority of whatever |cpu| runs, -1 for its idle loop */
+static int32_t running_prio(cpu_t *cpu)
+{
+    int32_t pid = cpu->running_pid;
+    return (pid >= 0) ? GET_PCB_HOT(pid)->rt_priority : -1;
+}
+
+/* Fair share group of the normal process |cpu| runs, -1 if it runs
+ * something else */
+static int32_t running_group(cpu_t *cpu)
+{
+    int32_t pid = cpu->running_pid;
+
+    if (pid < 0 || GET_PCB_HOT(pid)->policy != SCHED_NORMAL) {
+        return -1;
+    }
+    return sched_group(GET_PCB_HOT(pid));
+}
+
+void sched_enqueue(int32_t pid)
+{
+    unsigned long flags;
+    pcb_hot_t *hot = GET_PCB_HOT(pid);
+    int32_t prio = hot->rt_priority;
+    int32_t group = sched_group(hot);
+    int32_t running;
+    cpu_t *target = NULL;
+    int32_t best = 0;
+    int32_t i;
+
+    cli_and_save(flags);
+
+    fair_place(hot);
+
+    // Normal processes go where the fewest processes of their own group are,
+    // the least loaded processor of those, so each terminal spreads out over
+    // the processors and a lone shell doesn't land behind its own. Real-time
+    // ones go where they preempt the lowest priority, to keep them off
+    // processors that other real-time processes are using. Pinned ones stay
+    // where they are.
+    if (hot->pinned) {
+        target = &cpus[hot->cpu];
+    }
+    for (i = 0; i < num_cpus && !hot->pinned; i++) {
+        int32_t load;
+        if (!cpu_online(i)) {
+            continue;
+        }
+        load = cpus[i].rq.nr_queued + (cpus[i].running_pid >= 0);
+        if (prio > 0) {
+            load += running_prio(&cpus[i]) * MAX_NUM_PROCESSES;
+        } else {
+            load += (rq_queues[i].fair_nr[group] + (running_group(&cpus[i]) == group)) * MAX_NUM_PROCESSES;
+        }
+        if (target == NULL || load < best) {
+            target = &cpus[i];
+            best = load;
+        }
+    }
+
+    spin_lock(&target->rq.lock);
+    rq_insert(target, pid, false);
+    spin_unlock(&target->rq.lock);
+
+    // An idle processor needs waking, and one running a lower priority
+    // process needs preempting, as does one running a normal process of a
+    // group that is ahead of this one. Otherwise it gets to the process on a
+    // later tick.
+    running = running_group(target);
+    if (prio > running_prio(target) ||
+        (prio == 0 && running >= 0 && running != group &&
+         read64(&fair_groups[group].vruntime) < read64(&fair_groups[running].vruntime))) {
+        if (target == this_cpu()) {
+            target->need_resched = 1;
+        } else {
+            smp_send_reschedule(target->id);
+        }
+    }
+
+    restore_flags(flags);
+}
+
+/* Charges the real-time runtime of |cpu| up to |now| and throttles real-time
+ * processes on it once they used up RT_RUNTIME_PCT of the current period */
+static void rt_account(cpu_t *cpu, uint64_t now)
+{
+    uint64_t period = (uint64_t)RT_PERIOD_MS * tsc_khz;
+
+    if (running_prio(cpu) > 0) {
+        cpu->rt_time += now - cpu->rt_stamp;
+    }
+    cpu->rt_stamp = now;
+
+    if (now - cpu->rt_period_start >= period) {
+        cpu->rt_period_start = now;
+        cpu->rt_time = 0;
+        cpu->rt_throttled = 0;
+    } else if (cpu->rt_time > (uint64_t)(RT_PERIOD_MS * RT_RUNTIME_PCT / 100) * tsc_khz) {
+        cpu->rt_throttled = 1;
+    }
+}
+
+/* Charges the time since the last charge to the user or system time of
+ * |pcb| */
+static void acct_charge(pcb_entry_t *pcb, uint64_t now)
+{
+    if (pcb->in_kernel) {
+        pcb->stime += now - pcb->acct_stamp;
+    } else {
+        pcb->utime += now - pcb->acct_stamp;
+    }
+    pcb->acct_stamp = now;
+}
+
+// Hands the processor to |next_pid| by switching kernel contexts. Returns
+// when some processor switches back to the caller. Must be called with
+// interrupts disabled.
+void switch_to_process(int32_t next_pid)
+{
+    cpu_t *cpu = this_cpu();
+    context_t *prev = (cpu->running_pid >= 0) ? &GET_PCB_ENTRY(cpu->running_pid)->context : &cpu->idle_context;
+    context_t *next = (next_pid >= 0) ? &GET_PCB_ENTRY(next_pid)->context : &cpu->idle_context;
+    uint64_t now = rdtsc();
+
+    rt_account(cpu, now);
+    fair_account(cpu, now);
+    if (cpu->running_pid < 0) {
+        cpu->idle_time += now - cpu->idle_stamp;
+    } else {
+        pcb_entry_t *prev_pcb = GET_PCB_ENTRY(cpu->running_pid);
+        acct_charge(prev_pcb, now);
+        if (GET_PCB_HOT(cpu->running_pid)->runnable) {
+            prev_pcb->nivcsw++;
+        } else {
+            prev_pcb->nvcsw++;
+        }
+    }
+    if (next_pid < 0) {
+        cpu->idle_stamp = now;
+    } else {
+        pcb_entry_t *next_pcb = GET_PCB_ENTRY(next_pid);
+        // Also covers processes handed the processor directly by execute()
+        // and halt(), which never went through a run queue.
+        GET_PCB_HOT(next_pid)->on_rq = true;
+        GET_PCB_HOT(next_pid)->cpu = cpu->id;
+        next_pcb->acct_stamp = now;
+        if (next_pcb->rq_stamp) {
+            next_pcb->rq_wait += now - next_pcb->rq_stamp;
+            next_pcb->rq_stamp = 0;
+        }
+    }
+    cpu->running_pid = next_pid;
+    // |cpu| is stale once this returns, the caller may have moved.
+    switch_to(prev, next);
+}
+
 void schedule()
 {
-    cli();
-
-    // Find next process (or return immediately if none)
-    pcb_entry_t *curr_pcb = GET_PCB_ENTRY(curr_pid);
-
-    int next_pid = -1;
-    pcb_entry_t *next_pcb = NULL;
-    int pid;
-    for (pid = (curr_pid + 1) % MAX_NUM_PROCESSES;
-         pid != curr_pid;
-         pid = (pid + 1) % MAX_NUM_PROCESSES) {
-        next_pcb = GET_PCB_ENTRY(pid);
-        if (next_pcb->runnable) {
-            next_pid = pid;
-            //printf("sched from %d to %d\n", curr_pid, next_pid);
-            break;
+    unsigned long flags;
+    cpu_t *cpu;
+    int32_t curr;
+    int32_t next_pid;
+
+    cli_and_save(flags);
+
+    cpu = this_cpu();
+    cpu->need_resched = 0;
+    curr = cpu->running_pid;
+
+    spin_lock(&cpu->rq.lock);
+    if (curr >= 0) {
+        pcb_hot_t *hot = GET_PCB_HOT(curr);
+        // A process that blocked leaves the queues until wake_up_process().
+        if (!hot->runnable) {
+            hot->on_rq = false;
+        } else if (hot->policy == SCHED_RR && hot->time_slice <= 0) {
+            // Round-robin behind the others of the same priority.
+            hot->time_slice = RR_TIMESLICE;
+            rq_insert(cpu, curr, false);
+        } else {
+            // Real-time processes keep the processor until something of
+            // higher priority shows up.
+            rq_insert(cpu, curr, hot->policy != SCHED_NORMAL);
         }
     }
+    next_pid = rq_pop(cpu, curr, false, cpu->rt_throttled);
+    spin_unlock(&cpu->rq.lock);
+
     if (next_pid == -1) {
+        next_pid = steal_task(cpu);
+    }
+
+    // With nothing to run the idle loop takes over.
+    if (next_pid != curr) {
+        switch_to_process(next_pid);
+    }
+
+    restore_flags(flags);
+}
+
+/*
+ * wake_up_process
+ *   DESCRIPTION: Makes a process that blocked by clearing |runnable| run
+ *                again. If it has not reached schedule() yet it simply stays
+ *                on its processor, otherwise it is queued.
+ *   INPUTS: pid -- process to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May send a reschedule IPI.
+ */
+void wake_up_process(int32_t pid)
+{
+    pcb_hot_t *hot = GET_PCB_HOT(pid);
+    unsigned long flags;
+    runqueue_t *rq;
+    bool queue;
+
+    cli_and_save(flags);
+
+    hot->runnable = true;
+
+    // A blocked process does not migrate, so |cpu| only changes here if the
+    // process was already woken and stolen. Recheck it under the lock.
+    while (1) {
+        rq = &cpus[hot->cpu].rq;
+        spin_lock(&rq->lock);
+        if (rq == &cpus[hot->cpu].rq) {
+            break;
+        }
+        spin_unlock(&rq->lock);
+    }
+    queue = !hot->on_rq;
+    hot->on_rq = true;
+    spin_unlock(&rq->lock);
+
+    if (queue) {
+        sched_enqueue(pid);
+    }
+
+    restore_flags(flags);
+}
+
+// Returns true if process |caller| may change the scheduling of |pid|: its
+// own, or that of a process it started, directly or not. Kernel threads only
+// change their own.
+static bool sched_may_change(int32_t caller, int32_t pid)
+{
+    unsigned long flags;
+    int32_t parent;
+    int32_t i;
+    bool ok = (pid == caller);
+
+    if (ok || GET_PCB_HOT(pid)->terminal < 0) {
+        return ok;
+    }
+    spin_lock_irqsave(&process_lock, flags);
+    parent = GET_PCB_ENTRY(pid)->myparent_pid;
+    // Bounded in case a pid was reused while its children lived on.
+    for (i = 0; i < MAX_NUM_PROCESSES && parent >= 0; i++) {
+        if (parent == caller) {
+            ok = true;
+            break;
+        }
+        parent = GET_PCB_ENTRY(parent)->myparent_pid;
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+    return ok;
+}
+
+// Takes |pid| off the run queue of |cpu| if it waits there. Returns true if
+// it did. The lock of the queue must be held.
+static bool rq_remove(cpu_t *cpu, int32_t pid)
+{
+    int32_t prev = -1;
+    int32_t next;
+
+    for (next = rq_list(cpu, GET_PCB_HOT(pid))->head; next != -1; prev = next, next = GET_PCB_HOT(next)->rq_next) {
+        if (next == pid) {
+            rq_unlink(cpu, prev, pid);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * sched_setscheduler
+ *   DESCRIPTION: Sets the scheduling policy of a process. Real-time
+ *                processes (SCHED_FIFO and SCHED_RR) always run before normal
+ *                ones, highest priority first, except that together they get
+ *                at most RT_RUNTIME_PCT of each processor per RT_PERIOD_MS
+ *                while normal processes are waiting.
+ *   INPUTS: pid -- process to change, -1 for the caller. Must be the caller
+ *                  or a process it started (see sched_may_change()).
+ *           policy -- SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ *           priority -- 1 to RT_PRIO_MAX for real-time policies, else 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a bad argument or if the caller may
+ *                 not change |pid|
+ *   SIDE EFFECTS: A waiting process moves to its new place in its run queue
+ *                 right away. The processor it is on reschedules, so a
+ *                 process that now outranks the running one gets in.
+ */
+int32_t sched_setscheduler(int32_t pid, int32_t policy, int32_t priority)
+{
+    pcb_hot_t *hot;
+    pcb_entry_t *pcb;
+    unsigned long flags;
+    runqueue_t *rq;
+    uint64_t rq_stamp;
+    int32_t cpu;
+
+    if (pid == -1) {
+        pid = curr_pid;
+    }
+    if (pid < 0 || pid >= MAX_NUM_PROCESSES || !GET_PCB_HOT(pid)->active) {
+        return -1;
+    }
+    if (policy == SCHED_NORMAL) {
+        if (priority != 0) {
+            return -1;
+        }
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (priority < 1 || priority > RT_PRIO_MAX) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    if (!sched_may_change(curr_pid, pid)) {
+        return -1;
+    }
+
+    hot = GET_PCB_HOT(pid);
+    pcb = GET_PCB_ENTRY(pid);
+    cli_and_save(flags);
+
+    // Same dance as wake_up_process(): |cpu| may change until the lock of
+    // its run queue is held.
+    while (1) {
+        rq = &cpus[hot->cpu].rq;
+        spin_lock(&rq->lock);
+        if (rq == &cpus[hot->cpu].rq) {
+            break;
+        }
+        spin_unlock(&rq->lock);
+    }
+    cpu = hot->cpu;
+
+    // The queue has a list per priority and group, so a waiting process is
+    // taken off its list and put on the one for its new policy.
+    if (rq_remove(&cpus[cpu], pid)) {
+        rq_stamp = pcb->rq_stamp;
+        hot->policy = policy;
+        hot->rt_priority = priority;
+        hot->time_slice = RR_TIMESLICE;
+        rq_insert(&cpus[cpu], pid, false);
+        pcb->rq_stamp = rq_stamp;
+    } else {
+        hot->policy = policy;
+        hot->rt_priority = priority;
+        hot->time_slice = RR_TIMESLICE;
+    }
+    spin_unlock(&rq->lock);
+
+    // Let a process that now outranks the running one in, or the running one
+    // give way to one that now outranks it.
+    if (&cpus[cpu] == this_cpu()) {
+        this_cpu()->need_resched = 1;
+    } else {
+        smp_send_reschedule(cpu);
+    }
+
+    restore_flags(flags);
+    return 0;
+}
+
+void sched_set_visible_boost(int32_t percent)
+{
+    if (percent > 0) {
+        visible_boost_pct = percent;
+    }
+}
+
+/* Folds the current number of runnable processes into the load averages */
+static void calc_load(void)
+{
+    static const uint32_t exp[3] = {EXP_1, EXP_5, EXP_15};
+    uint32_t active = 0;
+    int32_t i;
+
+    for (i = 0; i < num_cpus; i++) {
+        if (cpu_online(i)) {
+            active += cpus[i].rq.nr_queued + (cpus[i].running_pid >= 0);
+        }
+    }
+    active *= FIXED_1;
+
+    for (i = 0; i < 3; i++) {
+        avenrun[i] = (avenrun[i] * exp[i] + active * (FIXED_1 - exp[i])) >> FSHIFT;
+    }
+}
+
+void sched_tick(void)
+{
+    cpu_t *cpu = this_cpu();
+    int32_t pid = cpu->running_pid;
+    uint64_t now = rdtsc();
+
+    cpu->need_resched = 1;
+
+    if (pid >= 0 && GET_PCB_HOT(pid)->policy == SCHED_RR) {
+        GET_PCB_HOT(pid)->time_slice--;
+    }
+    rt_account(cpu, now);
+    fair_account(cpu, now);
+
+    if (cpu->id != 0) {
+        return;
+    }
+    if (now >= next_load_update) {
+        next_load_update = now + (uint64_t)LOAD_FREQ_MS * tsc_khz;
+        calc_load();
+    }
+}
+
+void acct_syscall_enter(int32_t nr)
+{
+    int32_t pid = curr_pid;
+    pcb_entry_t *pcb;
+    uint64_t now;
+
+    // Only the syscall benchmark makes syscalls from outside a process.
+    if (pid < 0) {
+        return;
+    }
+    pcb = GET_PCB_ENTRY(pid);
+    now = rdtsc();
+    acct_charge(pcb, now);
+    pcb->in_kernel = true;
+    pcb->syscall_nr = nr;
+    pcb->syscall_stamp = now;
+}
+
+void acct_syscall_exit(void)
+{
+    int32_t pid = curr_pid;
+    pcb_entry_t *pcb;
+    uint64_t now;
+
+    if (pid < 0) {
         return;
     }
+    pcb = GET_PCB_ENTRY(pid);
+    now = rdtsc();
+    acct_charge(pcb, now);
+    pcb->in_kernel = false;
+    syscall_stats_add(pcb, pcb->syscall_nr, now - pcb->syscall_stamp);
+}
+
+void acct_update(void)
+{
+    int32_t pid = curr_pid;
+
+    if (pid >= 0) {
+        acct_charge(GET_PCB_ENTRY(pid), rdtsc());
+    }
+}
+
+void sched_get_loadavg(uint32_t loads[3])
+{
+    int32_t i;
+
+    // Scaled by 100, rounded.
+    for (i = 0; i < 3; i++) {
+        loads[i] = (avenrun[i] * 100 + FIXED_1 / 2) >> FSHIFT;
+    }
+}
+
+/*
+ * sched_print_stats
+ *   DESCRIPTION: Prints the load average, how idle each processor has been
+ *                and, for every process, its CPU time, run queue wait and
+ *                context switch counts. The times of running processes are up
+ *                to their last switch or syscall.
+ *   INPUTS: none
+ *   OUTPUTS: Prints to the terminal of the caller.
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sched_print_stats(void)
+{
+    uint64_t now = rdtsc();
+    unsigned long flags;
+    uint32_t loads[3];
+    int32_t pid;
+    int32_t i;
+
+    sched_get_loadavg(loads);
+    printf("load average: %u.%u%u %u.%u%u %u.%u%u\n",
+           loads[0] / 100, loads[0] / 10 % 10, loads[0] % 10,
+           loads[1] / 100, loads[1] / 10 % 10, loads[1] % 10,
+           loads[2] / 100, loads[2] / 10 % 10, loads[2] % 10);
+
+    for (i = 0; i < num_cpus; i++) {
+        cpu_t *cpu = &cpus[i];
+        uint64_t idle = cpu->idle_time;
+        uint32_t total_ms;
+
+        if (!cpu_online(i)) {
+            continue;
+        }
+        // Count the idle period in progress too.
+        if (cpu->running_pid < 0) {
+            idle += now - cpu->idle_stamp;
+        }
+        total_ms = div64_32(now - cpu->boot_stamp, tsc_khz);
+        printf("cpu %d: %u%% idle\n", i,
+               (total_ms >= 100) ? div64_32(idle, tsc_khz) / (total_ms / 100) : 0);
+    }
+
+    for (i = 0; i < NUM_SCHED_GROUPS; i++) {
+        uint64_t exec_time = read64(&fair_groups[i].exec_time);
+
+        if (i == KTHREAD_GROUP) {
+            printf("kthreads: %u ms\n", div64_32(exec_time, tsc_khz));
+        } else {
+            printf("term %d: weight %u, %u ms\n", i, group_weight(i),
+                   div64_32(exec_time, tsc_khz));
+        }
+    }
+
+    printf("pid term state user(ms) sys(ms) wait(ms) vcsw ivcsw\n");
+
+    spin_lock_irqsave(&process_lock, flags);
+    for_each_pid(pid) {
+        pcb_entry_t *pcb = GET_PCB_ENTRY(pid);
+        pcb_hot_t *hot = GET_PCB_HOT(pid);
+        if (!hot->active) {
+            continue;
+        }
+        printf("%d   %d    %c     %u %u %u %u %u\n", pid, hot->terminal,
+               hot->runnable ? 'R' : 'S',
+               div64_32(pcb->utime, tsc_khz), div64_32(pcb->stime, tsc_khz),
+               div64_32(pcb->rq_wait, tsc_khz), pcb->nvcsw, pcb->nivcsw);
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+void cpu_idle(void)
+{
+    while (1) {
+        cli();
+        schedule();
+        // sti only takes effect after the next instruction, so an interrupt
+        // that makes something runnable can't slip in before the hlt.
+        asm volatile("sti; hlt" ::: "memory");
+    }
+}
+
+void irq_enter(void)
+{
+#ifdef IRQSOFF_TRACE
+    trace_hardirq_enter();
+#endif
+    this_cpu()->irq_depth++;
+}
+
+void irq_exit(void)
+{
+    cpu_t *cpu = this_cpu();
+
+    if (--cpu->irq_depth == 0 && cpu->preempt_count == 0 && cpu->need_resched) {
+        schedule();
+    }
+}
+
+// Interrupts are disabled around the counter updates so the caller can't
+// move to another processor between finding its cpu_t and changing it.
+void preempt_disable(void)
+{
+    unsigned long flags;
 
-    // Need to enable all IRQs because switching contexts.
-    // System timer.
-    enable_irq(0);
-    // Keyboard.
-    enable_irq(1);
-    // RTC.
-    enable_irq(8);
-
-    tss.esp0 = next_pcb->esp0;
-
-    SET_CR3(&pds[next_pid]);
-
-    curr_pid = next_pid;
-
-    // TODO: See if necessary to save all registers locally.
-
-//    asm volatile(
-//        "movl $sched_jump_back, (%0);"
-//        :: "g"(&curr_pcb->sched_jump_back)
-//        );
-
-//    asm volatile(
-//            "pushl  %%edi;"
-//            "pushl  %%esi;"
-//            "pushl  %%edx;"
-//            "pushl  %%ecx;"
-//            "pushl  %%ebx;"
-//            "pushl  %%eax;"
-//    :);
-
-    // Save kernel stack registers (%esp, %ebp) in current PCB.
-    STORE_REGISTER_VALUE(esp, &curr_pcb->esp);
-    STORE_REGISTER_VALUE(ebp, &curr_pcb->ebp);
-
-    // Switch stacks to new process's version of schedule.
-    asm volatile(
-            "movl %0, %%esp;"
-            "movl %1, %%ebp;"
-//            "jmp  *%2;"
-            "sched_jump_back:"
-        ::"g"(next_pcb->esp), "g"(next_pcb->ebp)//, "g"(next_pcb->sched_jump_back));
-    );
-
-//    asm volatile(
-//            "popl  %%eax;"
-//            "popl  %%ebx;"
-//            "popl  %%ecx;"
-//            "popl  %%edx;"
-//            "popl  %%esi;"
-//            "popl  %%edi;"
-//    :);
-
-
-    // TODO: Restore original process's registers if necessary.
+    cli_and_save(flags);
+    this_cpu()->preempt_count++;
+    restore_flags(flags);
+}
+
+void preempt_enable(void)
+{
+    unsigned long flags;
+    cpu_t *cpu;
+    bool resched;
+
+    cli_and_save(flags);
+    cpu = this_cpu();
+    // An IRQ that asked for a reschedule while preemption was off left it to
+    // us. With interrupts disabled by the caller it is left to whoever
+    // enables them.
+    resched = (--cpu->preempt_count == 0 && cpu->irq_depth == 0 &&
+               cpu->need_resched && (flags & EFLAGS_IF));
+    restore_flags(flags);
+
+    if (resched) {
+        schedule();
+    }
+}
+
+void cond_resched(void)
+{
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->need_resched && cpu->preempt_count == 0 && cpu->irq_depth == 0) {
+        schedule();
+    }
 }
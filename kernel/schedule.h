@@ -13,7 +13,18 @@
 
 #define MAX_NUM_TERMINALS 3
 
-#define TERMINAL_INDEX (((pcb_entry_t *)GET_PCB_ENTRY(curr_pid))->terminal)
+/* Scheduling policies. SCHED_FIFO and SCHED_RR are real-time: they run
+ * before every SCHED_NORMAL process, highest rt_priority first. */
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+/* Highest real-time priority */
+#define RT_PRIO_MAX 99
+
+// Terminal of the process running on this processor. The visible one while
+// the processor is idle or running a kernel thread.
+#define TERMINAL_INDEX ((curr_pid >= 0 && GET_PCB_HOT(curr_pid)->terminal >= 0) ? \
+                        GET_PCB_HOT(curr_pid)->terminal : visible_terminal)
 
 //Components needed by a terminal
 typedef struct terminal_components{
@@ -44,10 +55,91 @@ extern terminal_components_t myTerminals[MAX_TERMINAL];
 // Return: 0 on success, -1 on failure.
 int32_t switch_visible_terminal(int32_t new_terminal);
 
+// Whether a shell was opened on each terminal yet.
+extern bool terminal_started_shell[MAX_TERMINAL];
+
+// Hands the processor to process |next_pid| (-1 for the idle loop) and
+// returns once the caller is switched back to, possibly on another processor.
+// Interrupts must be disabled.
+void switch_to_process(int32_t next_pid);
+
+struct cpu;
+
+// Sets up the run queue of |cpu| empty. Called by the processor itself before
+// it schedules anything.
+void sched_cpu_init(struct cpu *cpu);
+
+// Puts runnable process |pid| on the run queue of the processor with the
+// fewest processes of its group, the least busy of those, and pokes that
+// processor if the process should run before its current one.
+void sched_enqueue(int32_t pid);
+
 // Call to trigger possibly switching to new current process. This will return
 // when the calling process is chosen to be run (perhaps after others have been
-// chosen). This function identifies runnable processes by the |runnable| field
-// in the PCB.
+// chosen). The current process goes to the back of this processor's run queue
+// if it is still |runnable|. Normal processes are picked by terminal, the
+// terminal that got the least of its fair share of CPU time going first. When the queue is empty a process is stolen from
+// the busiest other processor.
 void schedule();
 
+// Wakes process |pid| after it blocked, i.e. cleared its |runnable| flag
+// and called schedule(). The waker must set whatever condition the process
+// waits for before calling this, under the same lock the process checks it
+// with.
+void wake_up_process(int32_t pid);
+
+// Sets the scheduling policy and real-time priority of process |pid| (-1 for
+// the caller), which must be the caller or a process it started. Kernel
+// threads can only be changed by themselves. Priority must be 1 to
+// RT_PRIO_MAX for SCHED_FIFO and SCHED_RR and 0 for SCHED_NORMAL. A queued
+// process is requeued at its new priority right away.
+// Return: 0 on success, -1 on a bad argument or a process the caller may not
+// change.
+int32_t sched_setscheduler(int32_t pid, int32_t policy, int32_t priority);
+
+// Sets the weight of the visible terminal in the fair share between
+// terminals, in percent of the weight of the others (200 by default).
+void sched_set_visible_boost(int32_t percent);
+
+// Called on every scheduler tick (local APIC timer or PIT). Asks for a
+// reschedule and, on the boot processor, updates the load average.
+void sched_tick(void);
+
+// Called by the syscall entry code around every syscall, with the syscall
+// number on entry, to split CPU time into user and system time and to time
+// the syscall for the statistics in trace.c.
+void acct_syscall_enter(int32_t nr);
+void acct_syscall_exit(void);
+
+// Charges the CPU time of the calling process up to now.
+void acct_update(void);
+
+// Returns the 1, 5 and 15 minute load averages, times 100.
+void sched_get_loadavg(uint32_t loads[3]);
+
+// Prints the load average and per-process CPU time and scheduling counts.
+void sched_print_stats(void);
+
+// Idle loop of a processor. Runs whatever schedule() finds and halts until the
+// next interrupt when there is nothing. Never returns.
+void cpu_idle(void);
+
+// Called by the IRQ wrappers on entry and exit. irq_exit() calls schedule()
+// when leaving the outermost handler if a reschedule was requested.
+void irq_enter(void);
+void irq_exit(void);
+
+// Keep the caller on its processor and in its address space until the
+// matching preempt_enable(), while leaving interrupts enabled. Needed around
+// code that borrows another page directory, since switch_to() only restores
+// the one in the context. Sections nest. preempt_enable() reschedules if a
+// reschedule was asked for in the meantime. The caller must not block inside.
+void preempt_disable(void);
+void preempt_enable(void);
+
+// Preemption point for long loops in the kernel: gives up the processor if a
+// reschedule is pending and preemption is allowed. Interrupts must be
+// enabled.
+void cond_resched(void);
+
 #endif // #ifndef _SCHEDULE_H
@@ -0,0 +1,300 @@
+/* slab.c - Object caches and kmalloc() on top of the frame allocator
+ * vim:ts=4
+ *
+ * Every slab is one frame. It starts with a slab_t, followed by the objects,
+ * and its free objects are linked through their first word. The slab of an
+ * object is found by rounding its address down to the frame, so freeing
+ * needs no lookup. kmalloc() picks the smallest power of two size class that
+ * fits; its bigger blocks come straight from frame_alloc(), and are told
+ * apart in kfree() by being frame aligned, which objects in a slab never are.
+ */
+
+#include "slab.h"
+#include "frame.h"
+#include "lib.h"
+#include "stats.h"
+
+/* Alignment of objects unless the cache asks for more */
+#define SLAB_DEFAULT_ALIGN 8
+
+/* The smallest kmalloc() size class is 2^KMALLOC_MIN_SHIFT bytes */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define NUM_KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+/* Header at the start of every slab */
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    kmem_cache_t *cache;
+    // First free object, NULL if there is none.
+    void *free;
+    uint32_t inuse;
+} slab_t;
+
+static kmem_cache_t caches[MAX_KMEM_CACHES];
+static int32_t num_caches;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+static kmem_cache_t *kmalloc_caches[NUM_KMALLOC_CLASSES];
+static const char *const kmalloc_names[NUM_KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+/* Large kmalloc() blocks handed out, in frames */
+static uint32_t kmalloc_large_frames;
+
+/* Offset of the first object in a slab of objects aligned to |align| */
+static uint32_t slab_first(uint32_t align)
+{
+    return (sizeof(slab_t) + align - 1) & ~(align - 1);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align)
+{
+    unsigned long flags;
+    kmem_cache_t *cache;
+
+    if (align == 0) {
+        align = SLAB_DEFAULT_ALIGN;
+    }
+    // Free objects hold a pointer.
+    if (size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+    size = (size + align - 1) & ~(align - 1);
+    if (slab_first(align) + size > FRAME_SIZE) {
+        return NULL;
+    }
+
+    spin_lock_irqsave(&caches_lock, flags);
+    if (num_caches == MAX_KMEM_CACHES) {
+        spin_unlock_irqrestore(&caches_lock, flags);
+        return NULL;
+    }
+    cache = &caches[num_caches++];
+    spin_unlock_irqrestore(&caches_lock, flags);
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->size = size;
+    cache->per_slab = (FRAME_SIZE - slab_first(align)) / size;
+    cache->lock = (spinlock_t)SPINLOCK_INIT;
+    return cache;
+}
+
+/* Puts |slab| at the head of the list |*head| */
+static void slab_list_add(slab_t **head, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+/* Takes |slab| off the list |*head| */
+static void slab_list_del(slab_t **head, slab_t *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* Gets a frame and links up its objects. Returns NULL if there is no frame. */
+static slab_t *slab_grow(kmem_cache_t *cache)
+{
+    slab_t *slab = (slab_t *)frame_alloc(0);
+    uint8_t *obj;
+    uint32_t i;
+
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = NULL;
+    // The objects end at the end of the frame, which keeps them aligned.
+    // Link them back to front so the first one is handed out first.
+    obj = (uint8_t *)slab + (FRAME_SIZE - cache->per_slab * cache->size);
+    for (i = cache->per_slab; i > 0; i--) {
+        uint8_t *o = obj + (i - 1) * cache->size;
+
+        *(void **)o = slab->free;
+        slab->free = o;
+    }
+    cache->nr_slabs++;
+    return slab;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    unsigned long flags;
+    slab_t *slab;
+    void *obj;
+
+    spin_lock_irqsave(&cache->lock, flags);
+
+    slab = cache->partial;
+    if (slab == NULL) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_del(&cache->empty, slab);
+        } else if ((slab = slab_grow(cache)) == NULL) {
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return NULL;
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    obj = slab->free;
+    slab->free = *(void **)obj;
+    slab->inuse++;
+    cache->nr_active++;
+    if (slab->free == NULL) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+    slab_t *slab = (slab_t *)((uint32_t)obj & ~(FRAME_SIZE - 1));
+    unsigned long flags;
+
+    spin_lock_irqsave(&cache->lock, flags);
+
+    if (slab->free == NULL) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->nr_active--;
+
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        // Keep one empty slab so a cache that goes back and forth between
+        // zero and one objects does not keep asking for frames.
+        if (cache->empty == NULL) {
+            slab_list_add(&cache->empty, slab);
+        } else {
+            cache->nr_slabs--;
+            frame_free((uint32_t)slab, 0);
+        }
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* Returns the order of the smallest block of frames that holds |size| bytes */
+static int32_t size_to_order(uint32_t size)
+{
+    int32_t order = 0;
+
+    while ((FRAME_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+void *kmalloc(uint32_t size)
+{
+    uint32_t addr;
+    int32_t order;
+    int32_t i;
+
+    if (size <= KMALLOC_MAX_CACHE_SIZE) {
+        for (i = 0; i < NUM_KMALLOC_CLASSES; i++) {
+            if (size <= (1 << (KMALLOC_MIN_SHIFT + i))) {
+                return kmem_cache_alloc(kmalloc_caches[i]);
+            }
+        }
+    }
+
+    order = size_to_order(size);
+    if (order > FRAME_MAX_ORDER) {
+        return NULL;
+    }
+    addr = frame_alloc(order);
+    if (addr) {
+        kmalloc_large_frames += 1 << order;
+    }
+    return (void *)addr;
+}
+
+void kfree(void *ptr)
+{
+    slab_t *slab;
+    int32_t order;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    if ((uint32_t)ptr & (FRAME_SIZE - 1)) {
+        slab = (slab_t *)((uint32_t)ptr & ~(FRAME_SIZE - 1));
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    order = frame_block_order((uint32_t)ptr);
+    kmalloc_large_frames -= 1 << order;
+    frame_free((uint32_t)ptr, order);
+}
+
+void slab_init(void)
+{
+    int32_t i;
+
+    for (i = 0; i < NUM_KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i), 0);
+    }
+}
+
+/* Builds the text of the slabinfo device */
+static void slabinfo_fill(textbuf_t *tb)
+{
+    int32_t i;
+
+    tb_puts(tb, "cache objsize active total slabs use%\n");
+    for (i = 0; i < num_caches; i++) {
+        kmem_cache_t *cache = &caches[i];
+        uint32_t total = cache->nr_slabs * cache->per_slab;
+
+        tb_puts(tb, cache->name);
+        tb_puts(tb, " ");
+        tb_putn(tb, cache->size, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, cache->nr_active, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, total, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, cache->nr_slabs, 10, 0);
+        tb_puts(tb, " ");
+        tb_putn(tb, total ? cache->nr_active * 100 / total : 0, 10, 0);
+        tb_puts(tb, "\n");
+    }
+    tb_puts(tb, "large kmalloc frames ");
+    tb_putn(tb, kmalloc_large_frames, 10, 0);
+    tb_puts(tb, "\n");
+}
+
+static stats_file_t slabinfo_file = {SPINLOCK_INIT, slabinfo_fill};
+
+int32_t slabinfo_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    (void)id;
+    return stats_file_read(&slabinfo_file, offset, buf, nbytes);
+}
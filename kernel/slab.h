@@ -0,0 +1,69 @@
+/* slab.h - Object caches and kmalloc() on top of the frame allocator
+ * vim:ts=4
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+#include "spinlock.h"
+
+// Most caches that can exist, including the kmalloc() size classes.
+#define MAX_KMEM_CACHES 32
+
+// kmalloc() serves sizes up to this from caches. Bigger ones get whole
+// frames.
+#define KMALLOC_MAX_CACHE_SIZE 1024
+
+// Name of the device file the cache statistics are read from.
+#define SLABINFO_DEVICE_NAME "slabinfo"
+
+#ifndef ASM
+
+struct slab;
+
+/* A cache of equally sized objects, carved out of one-frame slabs */
+typedef struct kmem_cache {
+    const char *name;
+    // Object size, rounded up to the alignment, and objects per slab.
+    uint32_t size;
+    uint32_t per_slab;
+    spinlock_t lock;
+    // Slabs with some, no and only free objects. At most one empty slab is
+    // kept, the rest go back to the frame allocator.
+    struct slab *partial;
+    struct slab *full;
+    struct slab *empty;
+    // Slabs and objects handed out.
+    uint32_t nr_slabs;
+    uint32_t nr_active;
+} kmem_cache_t;
+
+// Makes a cache of objects of |size| bytes aligned to |align| (a power of
+// two, 0 for the default of 8). Returns NULL if there are MAX_KMEM_CACHES
+// already or the object does not fit in a slab.
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align);
+
+// Returns a free object from |cache|, or NULL if memory ran out. O(1) unless
+// a new slab is needed.
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+// Returns |obj| to |cache|.
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Returns |size| bytes of kernel memory aligned to 8 bytes (to a frame if
+// bigger than KMALLOC_MAX_CACHE_SIZE), or NULL.
+void *kmalloc(uint32_t size);
+
+// Frees memory from kmalloc(). Does nothing for NULL.
+void kfree(void *ptr);
+
+// Makes the kmalloc() size classes. Needs frame_init() to have run.
+void slab_init(void);
+
+// Read operation of the slabinfo device. Returns, for every cache, its
+// objects in use, its capacity and how full it is, as text.
+int32_t slabinfo_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+#endif /* ASM */
+#endif /* _SLAB_H */
@@ -0,0 +1,209 @@
+/* smp.c - Per-processor descriptor tables and bring-up of the other processors
+ * vim:ts=4
+ */
+
+#include "smp.h"
+#include "apic.h"
+#include "idt.h"
+#include "lib.h"
+#include "pt.h"
+#include "schedule.h"
+#include "syscall.h"
+#include "tsc.h"
+
+/* How long the boot processor waits for a started processor to check in */
+#define AP_START_TIMEOUT_US 100000
+
+cpu_t cpus[MAX_CPUS];
+int32_t num_cpus = 1;
+
+// Stack the next application processor switches to in ap_start32. Set by
+// smp_init() before each STARTUP IPI.
+uint32_t ap_boot_stack;
+
+// Boot (and idle) stacks of the application processors.
+static uint8_t ap_stacks[MAX_CPUS][CPU_STACK_SIZE] __attribute__((aligned(16)));
+
+// Index in cpus[] of the processor being started.
+static volatile int32_t ap_booting;
+
+// Serializes TLB shootdowns, and the page of the current one and the
+// processors done with it.
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile uint32_t tlb_flush_addr;
+static volatile int32_t tlb_acks;
+
+/* Code in smp_boot.S */
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+
+/*
+ * smp_cpu_init
+ *   DESCRIPTION: Gives the calling processor its own copy of the GDT whose TSS
+ *                descriptor points at the TSS in |cpu|, then loads both.
+ *                Segment registers do not need reloading since the copy has
+ *                the same code and data descriptors.
+ *   INPUTS: cpu -- the cpu_t of the calling processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Loads GDTR, LDTR and TR. this_cpu() returns |cpu| afterwards.
+ */
+void smp_cpu_init(cpu_t *cpu)
+{
+    seg_desc_t the_tss_desc;
+    x86_desc_t the_gdt_desc;
+
+    cpu->id = cpu - cpus;
+    cpu->running_pid = -1;
+    sched_cpu_init(cpu);
+    cpu->idle_context.cr3 = (uint32_t)pd_kernel;
+    // Every processor starts out in its idle loop.
+    cpu->idle_time = 0;
+    cpu->idle_stamp = rdtsc();
+    cpu->boot_stamp = cpu->idle_stamp;
+
+    memcpy(cpu->gdt, gdt, sizeof(cpu->gdt));
+
+    the_tss_desc.granularity = 0;
+    the_tss_desc.opsize = 0;
+    the_tss_desc.reserved = 0;
+    the_tss_desc.avail = 0;
+    the_tss_desc.present = 1;
+    the_tss_desc.dpl = 0x0;
+    the_tss_desc.sys = 0;
+    the_tss_desc.type = 0x9;
+    SET_TSS_PARAMS(the_tss_desc, &cpu->tss, TSS_SIZE - 1);
+    cpu->gdt[GDT_TSS_INDEX] = the_tss_desc;
+
+    memset(&cpu->tss, 0, sizeof(cpu->tss));
+    cpu->tss.ldt_segment_selector = KERNEL_LDT;
+    cpu->tss.ss0 = KERNEL_DS;
+
+    the_gdt_desc.size = sizeof(cpu->gdt) - 1;
+    the_gdt_desc.addr = (uint32_t)cpu->gdt;
+    lgdt(the_gdt_desc);
+    lldt(KERNEL_LDT);
+    ltr(KERNEL_TSS);
+    sysenter_init(&cpu->tss);
+
+    cpu->started = 1;
+}
+
+/* First C code run by an application processor. Called from ap_start32 with
+ * paging on and interrupts off. */
+void ap_main(void)
+{
+    smp_cpu_init(&cpus[ap_booting]);
+    lidt(idt_desc);
+    lapic_init();
+    lapic_timer_start();
+
+    cpu_idle();
+}
+
+/*
+ * smp_init
+ *   DESCRIPTION: Copies the trampoline to low memory and starts the
+ *                application processors one at a time, each on its own stack.
+ *                apic_init() must have enabled the local APIC already.
+ *   INPUTS: none
+ *   OUTPUTS: Prints how many processors came up.
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Processors that start begin running cpu_idle().
+ */
+void smp_init(void)
+{
+    int32_t online = 1;
+    int32_t i;
+
+    if (lapic == NULL || num_cpus == 1) {
+        return;
+    }
+
+    memcpy((void *)AP_TRAMPOLINE_ADDR, ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    for (i = 1; i < num_cpus; i++) {
+        uint64_t timeout;
+
+        ap_boot_stack = (uint32_t)&ap_stacks[i][CPU_STACK_SIZE];
+        ap_booting = i;
+        lapic_start_ap(cpus[i].apic_id, AP_TRAMPOLINE_ADDR);
+
+        timeout = rdtsc() + div64_32((uint64_t)AP_START_TIMEOUT_US * tsc_khz, 1000);
+        while (!cpus[i].started && rdtsc() < timeout) {
+            cpu_relax();
+        }
+        if (cpus[i].started) {
+            online++;
+        } else {
+            printf("SMP: processor with APIC ID %d did not start\n", cpus[i].apic_id);
+        }
+    }
+
+    printf("SMP: %d processors online\n", online);
+}
+
+void smp_send_reschedule(int32_t id)
+{
+    lapic_send_ipi(cpus[id].apic_id, RESCHEDULE_VECTOR);
+}
+
+void smp_send_reschedule_all(void)
+{
+    // The PIT ticks before apic_init() too, e.g. for the IRQ benchmark.
+    if (num_cpus > 1 && lapic != NULL) {
+        lapic_send_ipi_all_but_self(RESCHEDULE_VECTOR);
+    }
+}
+
+/*
+ * smp_flush_tlb_page
+ *   DESCRIPTION: Makes the online processors in |cpu_mask| other than the
+ *                caller's drop the page |addr| from their TLB, then waits
+ *                until they all have. Needed after changing a mapping that
+ *                another processor may have cached, e.g. the vidmap() page
+ *                of a terminal.
+ *   INPUTS: addr -- virtual address of the page
+ *           cpu_mask -- bit i set for cpus[i]
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Spins with interrupts disabled until every processor acks.
+ */
+void smp_flush_tlb_page(uint32_t addr, uint32_t cpu_mask)
+{
+    unsigned long flags;
+    int32_t others = 0;
+    int32_t i;
+
+    spin_lock_irqsave(&tlb_lock, flags);
+    cpu_mask &= ~(1 << this_cpu()->id);
+    tlb_flush_addr = addr;
+    tlb_acks = 0;
+    for (i = 0; i < num_cpus; i++) {
+        if ((cpu_mask & (1 << i)) && cpu_online(i)) {
+            lapic_send_ipi(cpus[i].apic_id, TLB_FLUSH_VECTOR);
+            others++;
+        }
+    }
+    while (tlb_acks < others) {
+        cpu_relax();
+    }
+    spin_unlock_irqrestore(&tlb_lock, flags);
+}
+
+void smp_reschedule_interrupt(void)
+{
+    this_cpu()->need_resched = 1;
+}
+
+void smp_tlb_flush_interrupt(void)
+{
+    asm volatile("invlpg (%0)"
+                 :
+                 : "r"(tlb_flush_addr)
+                 : "memory");
+    asm volatile("lock incl %0"
+                 : "+m"(tlb_acks)
+                 :
+                 : "memory");
+}
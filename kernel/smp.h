@@ -0,0 +1,121 @@
+/* smp.h - Per-processor state and bring-up of the other processors
+ * vim:ts=4
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+#include "switch.h"
+
+/* Most processors that will be started */
+#define MAX_CPUS 8
+
+/* Size of the stack each processor boots and idles on */
+#define CPU_STACK_SIZE 8192
+
+/* Physical address the application processors start executing at. Must be
+ * 4 KB aligned, below 1 MB and inside the first 4 MB page table. */
+#define AP_TRAMPOLINE_ADDR 0x7000
+
+/* Byte offset of |tss| in cpu_t. switch.S uses it to find the TSS of the
+ * processor it runs on. */
+#define CPU_TSS (GDT_ENTRIES * 8)
+
+#ifndef ASM
+#include "spinlock.h"
+
+/* Processes waiting to run on one processor. The lists themselves are private
+ * to schedule.c. The process running on the processor is not on its queue. */
+typedef struct runqueue {
+    spinlock_t lock;
+    int32_t nr_queued;
+} runqueue_t;
+
+/* State private to one processor */
+typedef struct cpu {
+    // Must come first: this_cpu() finds the cpu_t from the GDT base.
+    seg_desc_t gdt[GDT_ENTRIES];
+    tss_t tss;
+    // Index in cpus[].
+    int32_t id;
+    uint32_t apic_id;
+    volatile int32_t started;
+    // Pid running here, -1 while the idle loop runs.
+    int32_t running_pid;
+    // Set when the current process should give up the processor at the next
+    // safe point (the end of the outermost IRQ handler, preempt_enable() or
+    // cond_resched()).
+    volatile int32_t need_resched;
+    // How many IRQ handlers are on the stack (they nest since handlers run
+    // with interrupts enabled).
+    int32_t irq_depth;
+    // Nesting of preempt_disable() sections. The process running here is
+    // only switched away from involuntarily while this is 0.
+    int32_t preempt_count;
+    // Context of the idle loop, which runs on the boot stack of this
+    // processor.
+    context_t idle_context;
+    // TSC cycles spent in the idle loop, when it was last entered, and when
+    // the processor came up. Give the utilization in the scheduler stats.
+    uint64_t idle_time;
+    uint64_t idle_stamp;
+    uint64_t boot_stamp;
+    // Real-time runtime in the current bandwidth period, when it was last
+    // charged and when the period started. While |rt_throttled| is set,
+    // normal processes go before real-time ones.
+    uint64_t rt_time;
+    uint64_t rt_stamp;
+    uint64_t rt_period_start;
+    int32_t rt_throttled;
+    // When the fair share group of the running process was last charged.
+    uint64_t fair_stamp;
+    runqueue_t rq;
+} __attribute__((aligned(64))) cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+// Number of processors found in the MP table (1 if there is none).
+extern int32_t num_cpus;
+
+/* Returns the cpu_t of the calling processor. Every processor loads its own
+ * copy of the GDT, which lives at the start of its cpu_t. */
+static inline cpu_t *this_cpu(void)
+{
+    x86_desc_t gdtr;
+    asm volatile("sgdt %0"
+                 : "=m"(gdtr));
+    return (cpu_t *)gdtr.addr;
+}
+
+// Loads a private GDT and TSS for |cpu| on the calling processor, after which
+// this_cpu() returns |cpu|.
+void smp_cpu_init(cpu_t *cpu);
+
+// Starts every processor listed in the MP table. Called by the boot processor
+// once paging, the TSC and the APICs are set up.
+void smp_init(void);
+
+// Returns 1 if processor |id| is running kernel code.
+static inline int32_t cpu_online(int32_t id)
+{
+    return cpus[id].started;
+}
+
+// Asks processor |id| to reschedule.
+void smp_send_reschedule(int32_t id);
+
+// Asks every other processor to reschedule. Used to pass the timer tick on.
+void smp_send_reschedule_all(void);
+
+// Flushes page |addr| from the TLB of the other processors in |cpu_mask| (bit
+// i for cpus[i]) and waits until they are done.
+void smp_flush_tlb_page(uint32_t addr, uint32_t cpu_mask);
+
+// Handlers for the inter-processor interrupts, called from idt.c.
+void smp_reschedule_interrupt(void);
+void smp_tlb_flush_interrupt(void);
+
+#endif /* ASM */
+#endif /* _SMP_H */
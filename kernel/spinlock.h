@@ -0,0 +1,87 @@
+/* spinlock.h - Spinlocks for data shared between processors
+ * vim:ts=4
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "lib.h"
+#include "types.h"
+
+/* A lock that busy waits. 0 means free, 1 means held. */
+typedef struct spinlock {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+/* Atomically stores |val| in |*addr| and returns the old value */
+static inline uint32_t xchg(volatile uint32_t *addr, uint32_t val)
+{
+    asm volatile("xchgl %0, %1"
+                 : "+r"(val), "+m"(*addr)
+                 :
+                 : "memory");
+    return val;
+}
+
+/* Full memory barrier: earlier stores are visible to other processors
+ * before later loads run */
+#define smp_mb()                                                    \
+    do {                                                            \
+        asm volatile("lock; addl $0, (%%esp)" ::: "memory", "cc");  \
+    } while (0)
+
+/* Hint to the processor that this is a spin-wait loop */
+#define cpu_relax()                          \
+    do {                                     \
+        asm volatile("pause" ::: "memory");  \
+    } while (0)
+
+/* Takes |lock|, spinning until it is free. Does not touch interrupts, so the
+ * caller must already have them disabled if an IRQ handler can take it. */
+static inline void spin_lock(spinlock_t *lock)
+{
+    while (xchg(&lock->locked, 1)) {
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+}
+
+/* Tries once to take |lock|. Returns 1 if it is now held, 0 otherwise. */
+static inline int32_t spin_trylock(spinlock_t *lock)
+{
+    return !xchg(&lock->locked, 1);
+}
+
+/* Releases |lock| */
+static inline void spin_unlock(spinlock_t *lock)
+{
+    asm volatile("" ::: "memory");
+    lock->locked = 0;
+}
+
+/* Saves EFLAGS into |flags|, disables interrupts and takes |lock|. While
+ * waiting, interrupts are put back the way they were, so a processor spinning
+ * here still answers IPIs (e.g. TLB shootdowns from the lock holder). */
+#define spin_lock_irqsave(lock, flags)          \
+    do {                                        \
+        cli_and_save(flags);                    \
+        while (!spin_trylock(lock)) {           \
+            restore_flags(flags);               \
+            while ((lock)->locked) {            \
+                cpu_relax();                    \
+            }                                   \
+            cli();                              \
+        }                                       \
+    } while (0)
+
+/* Releases |lock| and restores the EFLAGS saved by spin_lock_irqsave() */
+#define spin_unlock_irqrestore(lock, flags)     \
+    do {                                        \
+        spin_unlock(lock);                      \
+        restore_flags(flags);                   \
+    } while (0)
+
+#endif /* _SPINLOCK_H */
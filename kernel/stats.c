@@ -0,0 +1,89 @@
+/* stats.c - Latency histograms and the text the statistics devices return
+ * vim:ts=4
+ */
+
+#include "stats.h"
+#include "lib.h"
+#include "schedule.h"
+#include "tsc.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+void hist_merge(hist_t *dst, const hist_t *src)
+{
+    int32_t i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+void tb_puts(textbuf_t *tb, const char *s)
+{
+    while (*s && tb->pos < tb->end) {
+        *tb->pos++ = *s++;
+    }
+}
+
+void tb_putn(textbuf_t *tb, uint32_t value, int32_t radix, int32_t sign)
+{
+    int8_t num[12];
+
+    if (sign && (int32_t)value < 0) {
+        tb_puts(tb, "-");
+        value = -value;
+    }
+    if (radix == 16) {
+        tb_puts(tb, "0x");
+    }
+    tb_puts(tb, (char *)itoa(value, num, radix));
+}
+
+void hist_print(textbuf_t *tb, const hist_t *h)
+{
+    int32_t i;
+
+    tb_puts(tb, " n ");
+    tb_putn(tb, h->count, 10, 0);
+    tb_puts(tb, " avg ");
+    tb_putn(tb, h->count ? tsc_to_us(div64_32(h->sum, h->count)) : 0, 10, 0);
+    tb_puts(tb, " us max ");
+    tb_putn(tb, tsc_to_us(h->max), 10, 0);
+    tb_puts(tb, " us |");
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i]) {
+            tb_puts(tb, " ");
+            tb_putn(tb, i, 10, 0);
+            tb_puts(tb, ":");
+            tb_putn(tb, h->buckets[i], 10, 0);
+        }
+    }
+    tb_puts(tb, "\n");
+}
+
+int32_t stats_file_read(stats_file_t *file, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    uint32_t bytes;
+
+    // No IRQ handler takes the lock, so building the text can leave
+    // interrupts on.
+    preempt_disable();
+    spin_lock(&file->lock);
+    if (offset == 0) {
+        textbuf_t tb = {file->text, file->text + STATS_TEXT_SIZE};
+
+        file->fill(&tb);
+        file->len = tb.pos - file->text;
+    }
+    bytes = offset < file->len ? MIN(nbytes, file->len - offset) : 0;
+    memcpy(buf, file->text + offset, bytes);
+    spin_unlock(&file->lock);
+    preempt_enable();
+
+    return bytes;
+}
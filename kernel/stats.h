@@ -0,0 +1,77 @@
+/* stats.h - Latency histograms and the text the statistics devices return
+ * vim:ts=4
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "types.h"
+#include "spinlock.h"
+
+// Histogram buckets. Bucket b counts samples of 2^b up to 2^(b+1) - 1 cycles,
+// bucket 0 also counts 0.
+#define HIST_BUCKETS 32
+
+// Largest text a statistics device returns.
+#define STATS_TEXT_SIZE 16384
+
+/* Log2 histogram of durations in TSC cycles */
+typedef struct hist {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[HIST_BUCKETS];
+} hist_t;
+
+/* Adds a sample of |cycles| to |h|. Durations of 2^32 cycles or more are
+ * counted as 2^32 - 1. The caller keeps other writers out. */
+static inline void hist_add(hist_t *h, uint64_t cycles)
+{
+    uint32_t val = (cycles >> 32) ? 0xFFFFFFFF : (uint32_t)cycles;
+    uint32_t bucket;
+
+    asm("bsrl %1, %0"
+        : "=r"(bucket)
+        : "rm"(val | 1));
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += val;
+    if (val > h->max) {
+        h->max = val;
+    }
+}
+
+/* Adds the samples of |src| to |dst| */
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/* Output position in a text buffer. Output past |end| is cut off. */
+typedef struct textbuf {
+    int8_t *pos;
+    int8_t *end;
+} textbuf_t;
+
+// Appends |s|.
+void tb_puts(textbuf_t *tb, const char *s);
+
+// Appends |value| in base |radix| (with 0x in front for 16), as a negative
+// number if |sign| is set and the top bit is.
+void tb_putn(textbuf_t *tb, uint32_t value, int32_t radix, int32_t sign);
+
+// Appends " n <count> avg <us> max <us> |" and "<b>:<count>" for every bucket
+// b that isn't empty, then a newline.
+void hist_print(textbuf_t *tb, const hist_t *h);
+
+/* A device file whose content is text built on demand */
+typedef struct stats_file {
+    spinlock_t lock;
+    // Fills in the text. Called with |lock| held.
+    void (*fill)(textbuf_t *tb);
+    uint32_t len;
+    int8_t text[STATS_TEXT_SIZE];
+} stats_file_t;
+
+// Read operation for |file|. A read at offset 0 builds the text again, later
+// offsets continue in the same copy so it stays consistent.
+int32_t stats_file_read(stats_file_t *file, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+#endif /* _STATS_H */
@@ -0,0 +1,65 @@
+/* switch.h - Saved kernel context of a process and the switch_to() primitive
+ * vim:ts=4
+ */
+
+#ifndef _SWITCH_H
+#define _SWITCH_H
+
+#include "types.h"
+
+/* Byte offsets of the fields in context_t. Must match the struct below since
+ * switch.S uses them directly. */
+#define CONTEXT_EBX 0
+#define CONTEXT_ESI 4
+#define CONTEXT_EDI 8
+#define CONTEXT_EBP 12
+#define CONTEXT_ESP 16
+#define CONTEXT_ESP0 20
+#define CONTEXT_CR3 24
+#define CONTEXT_ON_CPU 28
+
+/* Offset of esp0 in the TSS. */
+#define TSS_ESP0 4
+
+#ifndef ASM
+
+/*
+ * Kernel state needed to resume a process that gave up the processor inside
+ * switch_to(). Only the callee-saved registers are kept since switch_to() is a
+ * normal C function call and the caller already saved everything else. The
+ * return address is left on the stack pointed to by |esp|.
+ */
+typedef struct context {
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t esp;
+    // Kernel stack loaded into the TSS when entering from user mode.
+    uint32_t esp0;
+    // Page directory of the process. Only reloaded if it changes.
+    uint32_t cr3;
+    // Non-zero from the moment a processor starts switching to this context
+    // until another context has been switched in after it, i.e. while the
+    // registers above are live somewhere. Another processor must not resume
+    // the context until this drops to 0.
+    volatile uint32_t on_cpu;
+} context_t;
+
+// Saves the current kernel context in |prev| and resumes |next|. Returns when
+// something switches back to |prev|. Must be called with interrupts disabled.
+// Implemented in switch.S.
+void switch_to(context_t *prev, context_t *next);
+
+// Entry point of a freshly created process. The first switch_to() into a new
+// process "returns" here, which irets to the user frame built on its kernel
+// stack. Implemented in switch.S.
+void ret_to_user(void);
+
+// Entry point of a child of fork(). Its kernel stack holds a copy of the
+// registers its parent saved on entry to the syscall, which this restores
+// before returning 0 to user mode. Implemented in switch.S.
+void ret_from_fork(void);
+
+#endif /* ASM */
+#endif /* _SWITCH_H */
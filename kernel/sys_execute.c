@@ -8,6 +8,11 @@
 #include "keyboard.h"
 #include "sys_vidmap.h"
 #include "schedule.h"
+#include "switch.h"
+#include "trace.h"
+#include "frame.h"
+#include "elf.h"
+#include "sys_halt.h"
 /*
  * The execute system call attempts to load and exeute a new program,
  * handing off the proessor to the new program until it terminates.
@@ -22,66 +27,21 @@
 */
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
-//The first 4 bytes of the file represent a "magic number" that identies the file as an exeutable.
-#define EXE_MAGIC_NUMBER_LENGTH 4
-// These 4 bytes are, respectively, 0: 0x7f; 1: 0x45; 2: 0x4c; 3: 0x46.
-// Reversed for little endian
-#define EXE_MAGIC_NUMBER 0x464c457f
-
-/*
- * The other important bit of information that you need to execute programs is the entry point into the program,
- * i.e., the virtual address of the first instruction that should be executed.
- * This information is stored as a 4-byte unsigned integer in bytes 24-27 of the exeutable,
- * and the value of it falls somewhere near 0x08048000 for all programs we have provided to you.
- */
-#define ENTRY_MAGIC_INDEX 24
-
-/* Bottom of user program page (virtual address) minus 4 */
+/* Bottom of user memory (virtual address) minus 4 */
 /* Minus 4 to avoid dereferencing the next page */
-#define USER_STACK (128 * MB + 4 * MB - 4)
+/* The stack pages below it are mapped as the program pushes into them */
+#define USER_STACK (USER_MEMORY + USER_MEMORY_SIZE - 4)
 
-// TODO: Add new version of execute (with additional argument) for starting on different terminal.
 /*
- * Executes the program named |command| then returns result to caller.
- * Input: C string containing the command to run (executable name and
- *        arguments).
- * Output: Executes the desired program and then returns the program's return
- *         value.
- * Return: 0-255 for return code of program. -1 if couldn't find program or if
- *         reached max process limit. 256 if exception occurred during program
- *         execution.
+ * Splits |command| into the program name and its arguments, the rest of the
+ * command stripped of leading spaces. Both are cut short if too long.
+ * Input: C string containing the command (executable name and arguments).
+ * Output: Fills in |file_name| and |args| as C strings.
  */
-int32_t execute(const uint8_t *command)
+static void parse_command(const uint8_t *command, uint8_t file_name[FILE_NAME_LENGTH + 1],
+                          uint8_t args[keyboard_buf_size + 1])
 {
-    cli();
-
     uint8_t *iterator;
-    uint8_t file_name[FILE_NAME_LENGTH];
-    uint8_t args_cpy[keyboard_buf_size + 1];
-    uint32_t magic_number;
-    int32_t entry_addr; /*entry address of a program (virtual)*/
-    int parent_pid = curr_pid;
-    pcb_entry_t *parent_pcb = GET_PCB_ENTRY(parent_pid);
-    uint32_t process_physical_addr;
-    dentry_t dentry;
-    int i, num_times;
-
-    int next_pid = -1;
-    pcb_entry_t *next_pcb = NULL;
-    // Need complex logic to handle when curr_pid == -1.
-    for (i = 0, num_times = (curr_pid == -1 ? MAX_NUM_PROCESSES : MAX_NUM_PROCESSES - 1);
-         i < num_times; i++) {
-        int pid = (curr_pid + 1 + i) % MAX_NUM_PROCESSES;
-        next_pcb = GET_PCB_ENTRY(pid);
-        if (!next_pcb->active) {
-            next_pid = pid;
-            break;
-        }
-    }
-    if (next_pid == -1) {
-        printf("Already at maximum number of processes.\n");
-        return -1;
-    }
 
     iterator = (uint8_t *)command;
     /* Skip over leading spaces */
@@ -110,10 +70,35 @@ int32_t execute(const uint8_t *command)
     }
 
     /* Everything else is args for getargs() */
-    strncpy((int8_t *)args_cpy, (int8_t *)args_begin, MIN(iterator - args_begin , sizeof(args_cpy)));
-    args_cpy[MIN(iterator - args_begin , sizeof(args_cpy))] = '\0';
+    strncpy((int8_t *)args, (int8_t *)args_begin, MIN(iterator - args_begin, keyboard_buf_size));
+    args[MIN(iterator - args_begin, keyboard_buf_size)] = '\0';
+}
 
-    //printf("file_name: %s, args: %s\n", file_name, args_cpy);
+/*
+ * Creates a new process running the program named in |command| on
+ * |terminal|, but does not run it. Its kernel stack is set up so the first
+ * switch_to() into it enters the program in user mode.
+ * Input: C string containing the command to run (executable name and
+ *        arguments), the terminal the process belongs to and the pid of its
+ *        parent (-1 if none).
+ * Output: Allocates a PCB, builds the page directory and loads the program.
+ * Return: The pid of the new process. -1 if couldn't find program or if
+ *         reached max process limit.
+ */
+int32_t create_process(const uint8_t *command, int32_t terminal, int32_t parent_pid)
+{
+    uint8_t file_name[FILE_NAME_LENGTH + 1];
+    uint8_t args_cpy[keyboard_buf_size + 1];
+    uint32_t entry_addr; /*entry address of a program (virtual)*/
+    int32_t pages;
+    uint32_t *kernel_stack;
+    dentry_t dentry;
+    int i;
+
+    int next_pid = -1;
+    pcb_entry_t *next_pcb = NULL;
+
+    parse_command(command, file_name, args_cpy);
 
     /*check file validity*/
     /*check if the file exists*/
@@ -121,77 +106,39 @@ int32_t execute(const uint8_t *command)
         return -1;
     }
 
-    /*
-     * The first 4 bytes of the file represent a magic number that identies the file as an executable.
-     * These bytes are, respetively, 0: 0x7f; 1: 0x45; 2: 0x4c; 3: 0x46.
-     */
-    if (read_data(dentry.inode_number, 0, (void *)&magic_number, EXE_MAGIC_NUMBER_LENGTH) < EXE_MAGIC_NUMBER_LENGTH) {
+    // Runs with interrupts enabled. Only the PCB claim is atomic, the new
+    // process is invisible to the scheduler until the caller queues it.
+    next_pid = pcb_alloc(true);
+    if (next_pid == -1) {
+        printf("Already at maximum number of processes.\n");
         return -1;
     }
-
-    /* If the magic number is not present, the execute system call should fail. */
-    if (magic_number != EXE_MAGIC_NUMBER) {
-        return -1;
+    next_pcb = GET_PCB_ENTRY(next_pid);
+    // Children keep the scheduling policy of their parent.
+    if (parent_pid >= 0) {
+        GET_PCB_HOT(next_pid)->policy = GET_PCB_HOT(parent_pid)->policy;
+        GET_PCB_HOT(next_pid)->rt_priority = GET_PCB_HOT(parent_pid)->rt_priority;
     }
 
-    // printf("magic number: %x\n", magic_number);
-
-    /*
-     * The other important bit of information that you need to execute programs is the entry point into the program,
-     * i.e., the virtual address of the first instruction that should be executed.
-     * This information is stored as a 4-byte unsigned integer in bytes 24-27 of the exeutable,
-     * and the value of it falls somewhere near 0x08048000 for all programs we have provided to you.
-     * Size of entry address is 4 bytes.
-     */
-    read_data(dentry.inode_number, ENTRY_MAGIC_INDEX, (void *)&entry_addr, 4);
-    // printf("entry_addr: %x\n", entry_addr);
-
-    /*update pid*/
-    curr_pid = next_pid;
+    /* The page directory already maps the kernel and its view of the video
+     * memory (see pd_alloc()) */
+    GET_PCB_HOT(next_pid)->terminal = terminal;
 
     /*Load file into memory*/
-    /*
-     * Your code should make a note of the entry point,
-     * and then copy the entire file to memory starting at virtual address 0x08048000.
-     */
-    /* The first user-level program (the shell) should be loaded at physical address (8 MB)*/
-    /* The second user-level program (excecuted by the shell) should be loaded at physical address (12 MB)*/
-    process_physical_addr = PID_TO_PHYSICAL_ADDRESS(next_pid);
-
-    /* Setup the user process page directory */
-    /* Zeroing out page directory */
-    memset(&pds[next_pid], 0x00, sizeof(page_directory_t));
-    /* Mapping the kernel for the process*/
-    map_page_directory_entry(&pds[next_pid], KERNEL_MEMORY, KERNEL_MEMORY, P | PS | G);
-    /*
-    *The program image itself is linked to execute at virtual address 0x08048000.
-    * The way to get this working is to set up a single 4 MB page directory entry that maps virtual address 0x08000000 (128 MB)
-    * to the right physical memory address (either 8 MB or 12 MB).
-    * Then, the program image must be copied to the correct offset (0x00048000) within that page.
-    */
-    map_page_directory_entry(&pds[next_pid], PROGRAM_VIRTUAL_ADDRESS, process_physical_addr, P | PS | US | RW);
-
-    // TODO: Need to handle mapping video to correct location based on terminal.
-
-    next_pcb->terminal = visible_terminal;
-    if (parent_pid >= 0) {
-        next_pcb->terminal = parent_pcb->terminal;
+    // The segments of the ELF file go into the user memory at the addresses
+    // it was linked for. Their pages are filled straight through the kernel
+    // mapping of the frames, so the new address space never has to be
+    // loaded. Fails if the file isn't an executable.
+    pages = elf_load(dentry.inode_number, next_pcb->page_directory, &entry_addr);
+    if (pages == -1) {
+        user_space_free(next_pcb->page_directory);
+        pcb_release(next_pid);
+        return -1;
     }
-    /* Whereas the first 4 MB of memory should broken down into 4 kB pages.*/
-    /* Mapping first 4 MB of memory to a page table that breaks the 4mb of memory into 4k pages */
-    map_page_directory_entry(&pds[next_pid], VIDEO_MEMORY, (uint32_t)us_vid_mem_pt[next_pcb->terminal], P | RW);
-
-    /*TLB flushes automatically when CR3 is updated*/
-    SET_CR3(&pds[next_pid]);
-
-    // printf("process_physical_addr: 0x%x\n", process_physical_addr);
-    /* The program image must be opied to the correct offset (0x00048000) within that page. */
-    // 4MB is the upper bound on an executable
-    read_data(dentry.inode_number, 0, (void *)(PROGRAM_VIRTUAL_ADDRESS), 4 * MB);
+    next_pcb->rss = pages;
 
     /*Create kernel stack for each process*/
-    next_pcb->active = true;
-    next_pcb->runnable = true;
+    GET_PCB_HOT(next_pid)->runnable = true;
     next_pcb->myparent_pid = parent_pid;
     next_pcb->my_pid = next_pid;
     next_pcb->program_entry = entry_addr; // remove later
@@ -202,83 +149,188 @@ int32_t execute(const uint8_t *command)
     }
 
     /* Open stdin and stdout */
-    open_stdin();
-    open_stdout();
+    open_stdin(next_pcb->files);
+    open_stdout(next_pcb->files);
 
     //printf("args in execute:%s\n", args_cpy);
     strncpy((int8_t *)next_pcb->arguments, (int8_t *)args_cpy, sizeof(next_pcb->arguments));
     next_pcb->arguments[sizeof(next_pcb->arguments) - 1] = '\0';
 
-    // If not first process, start saving stuff for later return and stop
-    // running parent.
-    if (parent_pid >= 0) {
-        // Stop parent from running.
-        parent_pcb->runnable = false;
-        /* Don't make any function calls after this point b/c saved %esp won't be accurate anymore */
-        /*Save ESP and EBP registers to the current pcb*/
-        STORE_REGISTER_VALUE(esp, &parent_pcb->esp);
-        STORE_REGISTER_VALUE(ebp, &parent_pcb->ebp);
-    }
-
-    /*tss.SS0 points to the kernel's stack segment (-4)*/
-    tss.ss0 = KERNEL_DS;
-    /*Alter the TSS entry in order to be able to IRET back here from the user program*/
-    /*tss.ESP0 points to the start of the current process's kernel-mode stack*/
-    // 4 is the size of first element on the stack
-    tss.esp0 = KERNEL_PAGE_END - (KERNEL_STACK_SIZE * next_pid) - 4;
-    next_pcb->esp0 = tss.esp0;
-
-//    asm volatile(
-//            "pushl  %%edi;"
-//            "pushl  %%esi;"
-//            "pushl  %%edx;"
-//            "pushl  %%ecx;"
-//            "pushl  %%ebx;"
-//            "pushl  %%eax;"
-//    :);
+    /*tss.ESP0 points to the start of the process's kernel-mode stack*/
+    // pcb_alloc() set it and CR3 in the context already.
 
     /*push the right value for the user-level registers to prepare for IRET to the user program*/
     /* Order determined in x86 manual for IRET */
+    kernel_stack = (uint32_t *)next_pcb->context.esp0;
     /*SS <- stack sagment in GDT */
-    pushl(USER_DS);
+    *--kernel_stack = USER_DS;
     /*ESP <- user stack pointer points to the bottom of the page (user virtual adress)*/
-    pushl(USER_STACK);
-    /*EFLAG (pushl EFLAGS)*/
-    /*0x200 is for setting the IF flag in EFLAGS*/
-    asm volatile(
-            "pushf;"
-            "orl $0x200, (%%esp)" ::
-                    : "esp", "memory");
-    //pushfl();
+    *--kernel_stack = USER_STACK;
+    /*EFLAG, 0x200 is for setting the IF flag in EFLAGS*/
+    *--kernel_stack = EFLAGS_IF;
     /*CS <- user-mode code segment in GDT*/
-    pushl(USER_CS);
+    *--kernel_stack = USER_CS;
     /*EIP <- program entry*/
-    // pushl entry_addr
-    asm volatile("pushl %0;"
-                 :
-                 : "g"(entry_addr)
-                 : "memory"); /*DS <- user mode data segment in GDT*/
-                              //movl USER_DS DS
-    asm volatile("movl $" STRINGIFY2(USER_DS) ", %%eax;"
-                         "movl %%eax, %%ds;"
-                 :
-                 :
-                 : "memory", "eax"); /*set CR3*/
-
-    asm volatile("iret");
-
-    asm volatile(".globl EXE_RETURN");
-    asm volatile("EXE_RETURN: ");
-
-//    asm volatile(
-//            "popl  %%eax;"
-//            "popl  %%ebx;"
-//            "popl  %%ecx;"
-//            "popl  %%edx;"
-//            "popl  %%esi;"
-//            "popl  %%edi;"
-//    :);
+    *--kernel_stack = entry_addr;
+    /* switch_to() returns into ret_to_user, which does the IRET */
+    *--kernel_stack = (uint32_t)ret_to_user;
+    next_pcb->context.esp = (uint32_t)kernel_stack;
+
+    // Tracing a process traces the programs it starts as well.
+    if (parent_pid >= 0 && GET_PCB_ENTRY(parent_pid)->traced) {
+        trace_set(next_pid, 1);
+    }
+
+    return next_pid;
+}
+
+/*
+ * Executes the program named |command| then returns result to caller.
+ * Input: C string containing the command to run (executable name and
+ *        arguments).
+ * Output: Executes the desired program and then returns the program's return
+ *         value.
+ * Return: 0-255 for return code of program. -1 if couldn't find program or if
+ *         reached max process limit. 256 if exception occurred during program
+ *         execution.
+ */
+int32_t execute(const uint8_t *command)
+{
+    int32_t terminal = (curr_pid >= 0) ? GET_PCB_HOT(curr_pid)->terminal : visible_terminal;
+
+    return execute_on(command, terminal);
+}
+
+/*
+ * execute() with the program on |terminal| instead of the caller's. Only for
+ * the kernel, e.g. kernel threads, which have no terminal of their own.
+ * Input: C string containing the command to run, and the terminal the
+ *        program belongs to.
+ * Return: Same as execute().
+ */
+int32_t execute_on(const uint8_t *command, int32_t terminal)
+{
+    int parent_pid = curr_pid;
+    // A process without a parent never comes back here, see internal_halt().
+    pcb_entry_t *parent_pcb = (parent_pid >= 0) ? GET_PCB_ENTRY(parent_pid) : NULL;
+    unsigned long flags;
+    int next_pid;
+
+    // Loading the program can take a while, so it happens with interrupts
+    // enabled. Only the hand-off has to be atomic.
+    next_pid = create_process(command, terminal, parent_pid);
+    if (next_pid == -1) {
+        return -1;
+    }
+
+    cli_and_save(flags);
+
+    // Stop parent from running. It is resumed by halt() of the child, which
+    // switches straight back here.
+    if (parent_pid >= 0) {
+        GET_PCB_HOT(parent_pid)->runnable = false;
+    }
+    switch_to_process(next_pid);
 
     // printf("child_status: %d\n", parent_pcb->child_status);
+    restore_flags(flags);
     return parent_pcb->child_status;
 }
+
+/*
+ * Starts the program named |command| as a child of the caller and returns
+ * right away, so the caller can start others or do its own work meanwhile.
+ * Input: C string containing the command to run (executable name and
+ *        arguments).
+ * Output: Queues the new process to run on the caller's terminal.
+ * Return: The pid of the child, whose status waitpid() collects once it
+ *         halts. -1 if couldn't find program or if reached max process
+ *         limit.
+ */
+int32_t spawn(const uint8_t *command)
+{
+    return spawn_on(command, GET_PCB_HOT(curr_pid)->terminal);
+}
+
+/*
+ * spawn() with the child on |terminal| instead of the caller's. Only for the
+ * kernel, e.g. kernel threads, which have no terminal of their own.
+ * Input: C string containing the command to run, and the terminal the child
+ *        belongs to.
+ * Return: Same as spawn().
+ */
+int32_t spawn_on(const uint8_t *command, int32_t terminal)
+{
+    int parent_pid = curr_pid;
+    int next_pid;
+
+    next_pid = create_process(command, terminal, parent_pid);
+    if (next_pid == -1) {
+        return -1;
+    }
+
+    // Nobody looks at the child before it is queued.
+    GET_PCB_ENTRY(next_pid)->spawned = true;
+    sched_enqueue(next_pid);
+    return next_pid;
+}
+
+/*
+ * Replaces the program of the calling process with the one named in
+ * |command|. The process keeps its pid, PCB, terminal, scheduling policy and
+ * open files. Only its user memory is thrown away and loaded anew, so unlike
+ * execute() no second process sits waiting for the program to finish.
+ * Input: C string containing the command to run (executable name and
+ *        arguments).
+ * Output: Loads the program and makes this syscall return into its entry
+ *         point, with the user stack empty.
+ * Return: 0, in the new program. -1, with the old program untouched, if
+ *         couldn't find the program or it isn't an executable. A process
+ *         that runs out of memory once its old program is gone halts as if
+ *         by an exception.
+ */
+int32_t exec(const uint8_t *command)
+{
+    pcb_entry_t *pcb = GET_PCB_ENTRY(curr_pid);
+    page_directory_t *page_directory = pcb->page_directory;
+    syscall_frame_t *frame = SYSCALL_FRAME(pcb);
+    uint8_t file_name[FILE_NAME_LENGTH + 1];
+    uint8_t args_cpy[keyboard_buf_size + 1];
+    uint32_t entry_addr;
+    int32_t pages;
+    dentry_t dentry;
+
+    // |command| is in the user memory that is about to go.
+    parse_command(command, file_name, args_cpy);
+    if (read_dentry_by_name(file_name, &dentry) == -1 || elf_check(dentry.inode_number) == -1) {
+        return -1;
+    }
+
+    /* The vidmap() mapping of the old program goes too. Freeing the user
+     * memory flushes the TLB. */
+    page_directory->entries[VIR_VIDEO_MEMORY >> NUM_4MB_OFFSET_BITS] = 0;
+    user_space_free(page_directory);
+    pcb->rss = 0;
+
+    pages = elf_load(dentry.inode_number, page_directory, &entry_addr);
+    if (pages == -1) {
+        printf("Out of memory for a program page.\n");
+        internal_halt(PROCESS_RETURN_EXCEPT);
+    }
+    pcb->rss = pages;
+    pcb->program_entry = entry_addr;
+    strncpy((int8_t *)pcb->arguments, (int8_t *)args_cpy, sizeof(pcb->arguments));
+    pcb->arguments[sizeof(pcb->arguments) - 1] = '\0';
+
+    /* Leave the syscall the way a new process enters its program */
+    frame->ebp = 0;
+    frame->edi = 0;
+    frame->esi = 0;
+    frame->edx = 0;
+    frame->ecx = 0;
+    frame->ebx = 0;
+    frame->eip = entry_addr;
+    frame->eflags = EFLAGS_IF;
+    frame->esp = USER_STACK;
+    return 0;
+}
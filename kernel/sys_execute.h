@@ -4,29 +4,19 @@
 #include "types.h"
 int32_t execute(const uint8_t *command);
 
-/* Store a register value into a C variable */
-#define STORE_REGISTER_VALUE(register, int_addr)                  \
-    do {                                                          \
-        asm volatile(                                             \
-                "movl   %%" #register ", (%0);" ::"g"(int_addr)); \
-    } while (0)
+/* execute() with the program on |terminal|, for callers without one */
+int32_t execute_on(const uint8_t *command, int32_t terminal);
 
-/* Pushes a constant onto the stack */
-#define pushl(value)                                \
-    do {                                            \
-        asm volatile("pushl $" STRINGIFY(value) ";" \
-                     :                              \
-                     :                              \
-                     : "memory");                   \
-    } while (0)
+/* Starts |command| as a child and returns its pid without waiting for it */
+int32_t spawn(const uint8_t *command);
 
-/* Pushes EFLAGS onto stack */
-#define pushfl()                  \
-    do {                          \
-        asm volatile("pushfl;"    \
-                     :            \
-                     :            \
-                     : "memory"); \
-    } while (0)
+/* spawn() with the child on |terminal|, for callers without one */
+int32_t spawn_on(const uint8_t *command, int32_t terminal);
+
+/* Replaces the program of the calling process with |command| */
+int32_t exec(const uint8_t *command);
+
+/* Creates (but does not run) a process for |command| on |terminal| */
+int32_t create_process(const uint8_t *command, int32_t terminal, int32_t parent_pid);
 
 #endif // _SYS_EXECUTE_H
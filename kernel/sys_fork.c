@@ -0,0 +1,76 @@
+#include "sys_fork.h"
+#include "lib.h"
+#include "pcb.h"
+#include "pt.h"
+#include "sys_vidmap.h"
+#include "schedule.h"
+#include "switch.h"
+#include "syscall.h"
+#include "trace.h"
+#include "frame.h"
+
+/*
+ * fork
+ *   DESCRIPTION: Create a copy of the calling process. The child gets the
+ *                same open files, arguments and terminal, and an address
+ *                space with the same mappings whose user pages are shared
+ *                read-only. Whichever process writes to a page first gets
+ *                its own copy of it (see do_page_fault()). The child returns
+ *                from this syscall to the same place as the parent.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE:  the pid of the child in the parent, 0 in the child
+ *				   -1, if the process limit is reached or memory ran out
+ *   SIDE EFFECTS: Makes the writable user pages of the caller read-only
+ */
+int32_t fork(void){
+	int32_t parent_pid = curr_pid;
+	pcb_entry_t *parent_pcb = GET_PCB_ENTRY(parent_pid);
+	pcb_entry_t *child_pcb;
+	page_directory_t *child_pd;
+	uint32_t *kernel_stack;
+	int32_t child_pid;
+
+	child_pid = pcb_alloc(true);
+	if (child_pid == -1)
+		return -1;
+	child_pcb = GET_PCB_ENTRY(child_pid);
+	child_pd = child_pcb->page_directory;
+
+	/* Same vidmap mapping as the parent, and the same user memory,
+	 * copy-on-write */
+	child_pd->entries[VIR_VIDEO_MEMORY >> NUM_4MB_OFFSET_BITS] =
+		parent_pcb->page_directory->entries[VIR_VIDEO_MEMORY >> NUM_4MB_OFFSET_BITS];
+	if (user_space_copy(child_pd, parent_pcb->page_directory) == -1) {
+		user_space_free(child_pd);
+		pcb_release(child_pid);
+		return -1;
+	}
+	child_pcb->rss = parent_pcb->rss;
+
+	GET_PCB_HOT(child_pid)->terminal = GET_PCB_HOT(parent_pid)->terminal;
+	GET_PCB_HOT(child_pid)->policy = GET_PCB_HOT(parent_pid)->policy;
+	GET_PCB_HOT(child_pid)->rt_priority = GET_PCB_HOT(parent_pid)->rt_priority;
+	child_pcb->myparent_pid = parent_pid;
+	child_pcb->my_pid = child_pid;
+	child_pcb->spawned = true;
+	child_pcb->program_entry = parent_pcb->program_entry;
+	memcpy(child_pcb->files, parent_pcb->files, sizeof(child_pcb->files));
+	memcpy(child_pcb->arguments, parent_pcb->arguments, sizeof(child_pcb->arguments));
+
+	/* The top of the parent's kernel stack holds the user registers saved on
+	 * entry to this syscall. The child starts out from a copy of them. */
+	memcpy(SYSCALL_FRAME(child_pcb), SYSCALL_FRAME(parent_pcb), sizeof(syscall_frame_t));
+	kernel_stack = (uint32_t *)SYSCALL_FRAME(child_pcb);
+	/* switch_to() returns into ret_from_fork, which restores them */
+	*--kernel_stack = (uint32_t)ret_from_fork;
+	child_pcb->context.esp = (uint32_t)kernel_stack;
+
+	if (parent_pcb->traced)
+		trace_set(child_pid, 1);
+
+	GET_PCB_HOT(child_pid)->runnable = true;
+	sched_enqueue(child_pid);
+
+	return child_pid;
+}
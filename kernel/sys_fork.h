@@ -0,0 +1,9 @@
+#ifndef _SYS_FORK_H
+#define _SYS_FORK_H
+
+#include "types.h"
+
+/*Create a copy of the calling process that shares its memory copy-on-write*/
+int32_t fork(void);
+
+#endif /*_SYS_FORK_H*/
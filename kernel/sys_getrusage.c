@@ -0,0 +1,64 @@
+#include "sys_getrusage.h"
+#include "lib.h"
+#include "pcb.h"
+#include "pt.h"
+#include "schedule.h"
+#include "tsc.h"
+#include "frame.h"
+
+/* Converts TSC cycles to seconds and microseconds */
+static void cycles_to_time(uint64_t cycles, rusage_time_t *time)
+{
+    uint32_t ms = div64_32(cycles, tsc_khz);
+
+    time->sec = ms / 1000;
+    time->usec = tsc_to_us(cycles - (uint64_t)time->sec * 1000 * tsc_khz);
+}
+
+/*
+ * getrusage
+ *   DESCRIPTION: Get the CPU time and scheduling statistics of a process
+ *   INPUTS: pid -- process to look at, RUSAGE_SELF for the caller
+ *           usage -- user buffer to fill in
+ *   OUTPUTS: none
+ *   RETURN VALUE:  0, successful
+ *				   -1, if pid is not a process or usage is not a user buffer
+ *   SIDE EFFECTS: Charges the caller's CPU time so far before reading it
+ */
+int32_t getrusage(int32_t pid, rusage_t* usage){
+	pcb_entry_t *pcb;
+	unsigned long flags;
+
+	if (usage == NULL || !is_user((uint32_t)usage) || !is_user((uint32_t)(usage + 1) - 1))
+		return -1;
+
+	if (pid == RUSAGE_SELF)
+		pid = curr_pid;
+	if (pid < 0 || pid >= MAX_NUM_PROCESSES)
+		return -1;
+
+	// Keeps the PCB from being freed while it is read.
+	spin_lock_irqsave(&process_lock, flags);
+	if (!GET_PCB_HOT(pid)->active) {
+		spin_unlock_irqrestore(&process_lock, flags);
+		return -1;
+	}
+	pcb = GET_PCB_ENTRY(pid);
+	// Bring the caller's system time up to now.
+	if (pid == curr_pid) {
+		acct_update();
+	}
+	cycles_to_time(pcb->utime, &usage->utime);
+	cycles_to_time(pcb->stime, &usage->stime);
+	cycles_to_time(pcb->rq_wait, &usage->wait);
+	usage->nvcsw = pcb->nvcsw;
+	usage->nivcsw = pcb->nivcsw;
+	// User pages are only freed when the process exits, so what it has now
+	// is its peak.
+	usage->maxrss = pcb->rss * (FRAME_SIZE / 1024);
+	usage->minflt = pcb->min_flt;
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	sched_get_loadavg(usage->loadavg);
+	return 0;
+}
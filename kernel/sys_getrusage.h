@@ -0,0 +1,34 @@
+#ifndef _SYS_GETRUSAGE_H
+#define _SYS_GETRUSAGE_H
+#include "types.h"
+
+/* Pass as |pid| to getrusage() for the calling process */
+#define RUSAGE_SELF (-1)
+
+/* Time split into seconds and microseconds */
+typedef struct rusage_time {
+    uint32_t sec;
+    uint32_t usec;
+} rusage_time_t;
+
+/* Resource usage of one process, as filled in by getrusage() */
+typedef struct rusage {
+    // CPU time in user mode and in the kernel.
+    rusage_time_t utime;
+    rusage_time_t stime;
+    // Time spent runnable but waiting for a processor.
+    rusage_time_t wait;
+    // Context switches because the process blocked / was preempted.
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    // System wide 1, 5 and 15 minute load averages, times 100.
+    uint32_t loadavg[3];
+    // User memory mapped, in KB, and pages mapped on first touch.
+    uint32_t maxrss;
+    uint32_t minflt;
+} rusage_t;
+
+/*Get the CPU time and scheduling statistics of a process*/
+int32_t getrusage(int32_t pid, rusage_t* usage);
+
+#endif /*_SYS_GETRUSAGE_H*/
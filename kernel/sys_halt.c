@@ -1,72 +1,90 @@
 #include "sys_halt.h"
 #include "lib.h"
 #include "sys_execute.h"
+#include "schedule.h"
+#include "trace.h"
+#include "pt.h"
+#include "sys_waitpid.h"
 
 /*
 Take the current process and close the file it opens, after it calculates which pcb where are at.
 However, it needs to consider whether or not it is a shell. If it is a shell, start another shell;
-If it is not, return to the parent process. (current pid --> parent:pid, stack, esp0; set the esp ->esp[0])
-Make the page again for the parent process; change the current pid to the parent's pid (might not matter);
-reset the esp and ebp value, and move the status (halt's parameter) of the program, put the
-status to the eax; status is the error if there is one. (store esp and ebp to pcb)
+If it is not, return to the parent process: store the status (halt's parameter) in the parent's
+PCB, make the page directory of the parent current again and switch_to() the parent's saved context,
+which resumes it inside execute() where it returns the status.
 */
 int32_t internal_halt(uint32_t status)
 {
-    cli();
+    // Closing files and starting a replacement shell run preemptible like
+    // any syscall. Exceptions get here with interrupts disabled.
+    sti();
+
+    int32_t pid = curr_pid;
+    pcb_entry_t *current_pcb = GET_PCB_ENTRY(pid);
+    int i;
+
+    trace_set(curr_pid, 0);
+
+    /* Close the open files */
+    for (i = 0; i < MAX_FILES_PER_PROCESS; i++) {
+        if ((current_pcb->files[i]).flags != AVAILABLE) {
+            sys_close(i);
+        }
+    }
 
-    pcb_entry_t *current_pcb = GET_PCB_ENTRY(curr_pid);
+    /* Nothing touches user memory from here on */
+    user_space_free(current_pcb->page_directory);
 
-    // No matter what, disable PCB and stop from running.
-    current_pcb->active = false;
-    current_pcb->runnable = false;
+    /* Children from spawn() and fork() can't report to us any more */
+    orphan_children(pid);
+
+    if (current_pcb->spawned) {
+        // The parent collects the status with waitpid() whenever it likes.
+        // Give up the processor for good.
+        cli();
+        GET_PCB_HOT(pid)->runnable = false;
+        child_exit(pid, status);
+        schedule();
+        return -1;
+    }
 
-    // TODO: Think about whether this will work with scheduling and terminal switching.
     if (current_pcb->myparent_pid == -1) {
         printf("Shell has no parent to return to, so just executing another shell\n");
-        // Start off curr_pid at -1 meaning next execute() will be first process.
-        curr_pid = -1;
-        execute((uint8_t *)"shell");
+        int new_pid = create_process((uint8_t *)"shell", GET_PCB_HOT(pid)->terminal, -1);
+        // Stop from running. From here on nothing may switch away from us.
+        // The PCB and kernel stack stay until we have switched away.
+        cli();
+        GET_PCB_HOT(pid)->runnable = false;
+        pcb_release(pid);
+        if (new_pid != -1) {
+            switch_to_process(new_pid);
+        }
 
         // Should never run, but just in case.
+        schedule();
         return -1;
     }
 
     pcb_entry_t *parent_pcb = GET_PCB_ENTRY(current_pcb->myparent_pid);
-    int i;
+
+    cli();
+    GET_PCB_HOT(pid)->runnable = false;
 
     // Enable running parent process.
-    parent_pcb->runnable = true;
+    GET_PCB_HOT(current_pcb->myparent_pid)->runnable = true;
 
     /* Save the 8 bits status to the 8 bits ret-val entry in the parent */
     parent_pcb->child_status = status;
 
-    /* Close the open files */
-    for (i = 0; i < MAX_FILES_PER_PROCESS; i++) {
-        if ((current_pcb->files[i]).flags != AVAILABLE) {
-            sys_close(i);
-        }
-    }
-
-    /* Change the page directory to the parent's page directory */
-    SET_CR3(&pds[current_pcb->myparent_pid]);
-
-    /* Zeroing out page directory */
-    memset(&pds[curr_pid], 0x00, sizeof(page_directory_t));
-
-    /* Restore tss.esp0 to parent's tss.esp0 */
-    tss.esp0 = parent_pcb->esp0;
+    /* Change the page directory to the parent's page directory, pd_kernel
+     * for a kernel thread that ran execute() */
+    SET_CR3(parent_pcb->context.cr3);
 
-    /* Update current_pid */
-    curr_pid = current_pcb->myparent_pid;
+    /* The page directory is freed along with the PCB */
+    pcb_release(pid);
 
-    /* Restore esp, ebp and eip to the parent's value */
-    asm volatile(
-            "movl %0, %%esp;"
-            "movl %1, %%ebp;"
-            "jmp EXE_RETURN;"
-            :
-            : "g"(parent_pcb->esp), "g"(parent_pcb->ebp)
-            : "esp", "ebp");
+    /* Resume the parent inside its execute(). Never comes back here. */
+    switch_to_process(current_pcb->myparent_pid);
 
     return -1; /*A fake return. It should never be executed*/
 }
@@ -19,13 +19,9 @@
  */
 int32_t halt(uint8_t status);
 
-/* Moves a value into the register */
-#define MOVE_REGISTER_VALUE(register, int_addr)              \
-    do {                                                     \
-        asm volatile(                                        \
-                "movl  %0, %%" #register ";" ::"g"(int_addr) \
-                : #register);                                \
-    } while (0)
+/* halt() with the full 32 bit status, PROCESS_RETURN_EXCEPT for a process
+ * that can't go on. Never returns. */
+int32_t internal_halt(uint32_t status);
 
 #endif // ASM
 
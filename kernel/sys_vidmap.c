@@ -34,14 +34,14 @@ vidmap(uint8_t** screen_start){
 		return -1;
 
 
-	/*map phisical video memory to a pre-set virtual memory, which we set to 132MB*/
+	/*map phisical video memory to a pre-set virtual memory, which we set to 260MB*/
 
 	/*get the page directory for the current process*/
-	page_directory_t* curr_pd = &pds[curr_pid]; 
+    pcb_entry_t *curr_pcb_entry = GET_PCB_ENTRY(curr_pid);
+	page_directory_t* curr_pd = curr_pcb_entry->page_directory; 
 
 	/*get the page table for the current process according to the terminal it belongs to*/
-    pcb_entry_t *curr_pcb_entry = GET_PCB_ENTRY(curr_pid);
-	us_vid_mem_pt_ptr = us_vid_mem_pt[curr_pcb_entry->terminal];
+	us_vid_mem_pt_ptr = us_vid_mem_pt[GET_PCB_HOT(curr_pid)->terminal];
 
 
     // TODO: Need to correctly handle mapping video to correct terminal video page.
@@ -52,7 +52,7 @@ vidmap(uint8_t** screen_start){
     /* mapping video memory for the kernel */
     //map_page_table_entry((page_table_t *)us_vid_mem_pt_ptr, VIR_VIDEO_MEMORY, VIDEO_MEMORY, P | RW | US);
 
-	SET_CR3(&pds[curr_pid]);
+	SET_CR3(curr_pd);
 
 	*screen_start = (uint8_t*)VIR_VIDEO_MEMORY;
 
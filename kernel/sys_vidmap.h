@@ -5,7 +5,9 @@
 #include "pt.h" 
 #include "terminal.h"
 
-#define  VIR_VIDEO_MEMORY (0x8400000 + VIDEO_MEMORY)
+/* In the 4 MB above the vsyscall page, which has a page directory entry of
+ * its own */
+#define  VIR_VIDEO_MEMORY (0x10400000 + VIDEO_MEMORY)
 
 /*Page table for the page size of 4KB*/
 extern page_table_t * us_vid_mem_pt[MAX_TERMINAL];
@@ -0,0 +1,137 @@
+#include "sys_waitpid.h"
+#include "lib.h"
+#include "pcb.h"
+#include "pt.h"
+#include "wait.h"
+
+/* Parents sleeping in waitpid(). Every child that halts wakes them all, and
+ * each checks for its own children. */
+static wait_queue_t child_exit_wq = WAIT_QUEUE_INIT;
+
+/* Returns 1 if |pcb| is a child of |parent| started by spawn() or fork() and
+ * |pid| is its pid or -1 */
+static int32_t is_spawned_child(pcb_entry_t *pcb, int32_t child, int32_t parent, int32_t pid)
+{
+	return pcb->spawned && pcb->myparent_pid == parent && (pid == -1 || child == pid);
+}
+
+/*
+ * collect_child
+ *   DESCRIPTION: Look for a child of |parent| matching |pid| (-1 for any)
+ *                that halted, and give it up
+ *   INPUTS: parent -- pid of the parent
+ *           pid -- child to look for, -1 for any
+ *           status -- where to put the status of the child
+ *   OUTPUTS: none
+ *   RETURN VALUE:  the pid of the child collected
+ *				    0, if the matching children are all still running
+ *				   -1, if there is no matching child
+ *   SIDE EFFECTS: Releases the PCB of the child collected
+ */
+static int32_t collect_child(int32_t parent, int32_t pid, uint32_t* status){
+	unsigned long flags;
+	int32_t found = -1;
+	int32_t child;
+
+	spin_lock_irqsave(&process_lock, flags);
+	for_each_pid(child) {
+		pcb_entry_t *pcb = GET_PCB_ENTRY(child);
+
+		if (!is_spawned_child(pcb, child, parent, pid))
+			continue;
+		if (pcb->zombie) {
+			*status = pcb->exit_status;
+			/* Nobody finds it again while it waits to be freed */
+			pcb->zombie = false;
+			pcb->myparent_pid = -1;
+			__pcb_release(child);
+			found = child;
+			break;
+		}
+		found = 0;
+	}
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	return found;
+}
+
+/*
+ * waitpid
+ *   DESCRIPTION: Wait for a child started by spawn() or fork() to halt and
+ *                get its status
+ *   INPUTS: pid -- child to wait for, -1 for any
+ *           status -- user buffer for the status the child passed to halt()
+ *                     (256 if it died by an exception), or NULL
+ *           options -- WNOHANG not to wait if no child has halted yet
+ *   OUTPUTS: none
+ *   RETURN VALUE:  the pid of the child that halted
+ *				    0, with WNOHANG if no matching child has halted yet
+ *				   -1, if there is no matching child or status is not a
+ *				       user buffer
+ *   SIDE EFFECTS: Frees what is left of the child
+ */
+int32_t waitpid(int32_t pid, uint32_t* status, int32_t options){
+	int32_t parent = curr_pid;
+	pcb_entry_t *parent_pcb = GET_PCB_ENTRY(parent);
+	uint32_t child_status = 0;
+	uint32_t exits;
+	int32_t ret;
+
+	if (status != NULL && !is_user((uint32_t)status))
+		return -1;
+
+	/* The wait only watches the count of children that halted, since the
+	 * condition runs with the wait queue lock held and child_exit() wakes
+	 * the queue after taking process_lock. A child that halts after the
+	 * count was read makes the wait return right away. */
+	while (1) {
+		exits = parent_pcb->child_exits;
+		ret = collect_child(parent, pid, &child_status);
+		if (ret != 0 || (options & WNOHANG))
+			break;
+		wait_event(&child_exit_wq, parent_pcb->child_exits != exits);
+	}
+
+	if (ret > 0 && status != NULL)
+		*status = child_status;
+	return ret;
+}
+
+void child_exit(int32_t pid, uint32_t status){
+	pcb_entry_t *pcb = GET_PCB_ENTRY(pid);
+	unsigned long flags;
+	bool orphan;
+
+	spin_lock_irqsave(&process_lock, flags);
+	orphan = (pcb->myparent_pid == -1);
+	if (!orphan) {
+		pcb->exit_status = status;
+		pcb->zombie = true;
+		GET_PCB_ENTRY(pcb->myparent_pid)->child_exits++;
+	}
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	if (orphan)
+		pcb_release(pid);
+	else
+		wake_up(&child_exit_wq);
+}
+
+void orphan_children(int32_t pid){
+	unsigned long flags;
+	int32_t child;
+
+	spin_lock_irqsave(&process_lock, flags);
+	for_each_pid(child) {
+		pcb_entry_t *pcb = GET_PCB_ENTRY(child);
+
+		if (!is_spawned_child(pcb, child, pid, -1))
+			continue;
+		pcb->myparent_pid = -1;
+		if (pcb->zombie) {
+			pcb->zombie = false;
+			__pcb_release(child);
+		}
+	}
+	spin_unlock_irqrestore(&process_lock, flags);
+}
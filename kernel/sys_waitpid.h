@@ -0,0 +1,20 @@
+#ifndef _SYS_WAITPID_H
+#define _SYS_WAITPID_H
+#include "types.h"
+
+/* Pass in |options| of waitpid() to return 0 instead of blocking */
+#define WNOHANG 1
+
+/*Wait for a child started by spawn() or fork() to halt and get its status*/
+int32_t waitpid(int32_t pid, uint32_t* status, int32_t options);
+
+/* Called by halt() of a process started by spawn() or fork(). Keeps its
+ * status for the parent to collect, or gives the process up if the parent is
+ * gone. */
+void child_exit(int32_t pid, uint32_t status);
+
+/* Called by halt() of every process. Gives up its halted children nobody
+ * will collect now, and lets the running ones give themselves up. */
+void orphan_children(int32_t pid);
+
+#endif /*_SYS_WAITPID_H*/
@@ -1,15 +1,59 @@
 #include "syscall.h"
-#include "../syscalls/ece391sysnum.h"
 #include "fs.h"
 #include "lib.h"
 #include "sys_execute.h"
 #include "sys_getargs.h"
 #include "sys_vidmap.h"
 #include "sys_halt.h"
+#include "sys_getrusage.h"
+#include "sys_fork.h"
+#include "sys_waitpid.h"
+#include "schedule.h"
+#include "trace.h"
+#include "pcb.h"
+#include "pt.h"
+#include "x86_desc.h"
 
 // Jump/call table that stores implementation every system call.
 syscall_jt_entry syscall_jump_table[NUM_SYSCALLS];
 
+// The vsyscall page and its page table. Kernel memory is identity mapped, so
+// the page's address is also its physical address.
+pte_t vsyscall_pt[NUM_PTE_ENTRIES] __attribute__((aligned(sizeof(page_table_t))));
+static uint8_t vsyscall_page[1 << NUM_4KB_OFFSET_BITS] __attribute__((aligned(1 << NUM_4KB_OFFSET_BITS)));
+
+// User side stubs in syscall-asm.S. One of them is copied to the vsyscall
+// page.
+extern uint8_t vsyscall_sysenter[], vsyscall_sysenter_end[];
+extern uint8_t vsyscall_int80[], vsyscall_int80_end[];
+
+// Returns 1 if the processor has SYSENTER/SYSEXIT.
+static int32_t sysenter_supported(void)
+{
+    return !!(cpuid_features() & CPUID_FEATURE_SEP);
+}
+
+void sysenter_init(void *tss)
+{
+    if (!sysenter_supported()) {
+        return;
+    }
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS, 0);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)tss, 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry, 0);
+}
+
+// Fills in the vsyscall page with the stub this processor supports.
+static void vsyscall_init(void)
+{
+    if (sysenter_supported()) {
+        memcpy(vsyscall_page, vsyscall_sysenter, vsyscall_sysenter_end - vsyscall_sysenter);
+    } else {
+        memcpy(vsyscall_page, vsyscall_int80, vsyscall_int80_end - vsyscall_int80);
+    }
+    map_page_table_entry((page_table_t *)vsyscall_pt, VSYSCALL_ADDR, (uint32_t)vsyscall_page, P | US | G);
+}
+
 // Simple syscall impl that represents an unimplemented syscall. Just prints
 // out an error and returns -1.
 // Output: Prints out an error message.
@@ -46,6 +90,24 @@ void setup_syscalls()
     set_syscall(SYS_SET_HANDLER, unimplemented_syscall);
     // int32_t sigreturn (void);
     set_syscall(SYS_SIGRETURN, unimplemented_syscall);
+    // int32_t getrusage (int32_t pid, rusage_t* usage);
+    set_syscall(SYS_GETRUSAGE, getrusage);
+    // int32_t sched_setscheduler (int32_t pid, int32_t policy, int32_t priority);
+    set_syscall(SYS_SCHED_SETSCHEDULER, sched_setscheduler);
+    // int32_t getpid (void);
+    set_syscall(SYS_GETPID, get_curr_pid);
+    // int32_t trace (int32_t pid, int32_t on);
+    set_syscall(SYS_TRACE, syscall_trace);
+    // int32_t fork (void);
+    set_syscall(SYS_FORK, fork);
+    // int32_t spawn (const uint8_t* command);
+    set_syscall(SYS_SPAWN, spawn);
+    // int32_t waitpid (int32_t pid, uint32_t* status, int32_t options);
+    set_syscall(SYS_WAITPID, waitpid);
+    // int32_t exec (const uint8_t* command);
+    set_syscall(SYS_EXEC, exec);
+
+    vsyscall_init();
 }
 
 // Adds new system calls to the syscall_jump_table.
@@ -3,11 +3,40 @@
 #ifndef _SYSCALL_H
 #define _SYSCALL_H
 
+// Syscall numbers. The first ten are the ones user programs know from
+// ece391sysnum.h and must stay the same.
+#define SYS_HALT 1
+#define SYS_EXECUTE 2
+#define SYS_READ 3
+#define SYS_WRITE 4
+#define SYS_OPEN 5
+#define SYS_CLOSE 6
+#define SYS_GETARGS 7
+#define SYS_VIDMAP 8
+#define SYS_SET_HANDLER 9
+#define SYS_SIGRETURN 10
+// Syscalls added after those.
+#define SYS_GETRUSAGE 11
+#define SYS_SCHED_SETSCHEDULER 12
+#define SYS_GETPID 13
+#define SYS_TRACE 14
+#define SYS_FORK 15
+#define SYS_SPAWN 16
+#define SYS_WAITPID 17
+#define SYS_EXEC 18
+
 // The number of syscalls that exist.
-#define NUM_SYSCALLS 11
+#define NUM_SYSCALLS 19
 // The maximum number of arguments that a syscall can have.
 #define MAX_SYSCALL_ARGS 6
 
+// User address of the read-only page holding the fast syscall stub, right
+// above the user memory. User code does `call *VSYSCALL_ADDR` with the same
+// registers as for int 0x80 to make a syscall through SYSENTER, or through
+// int 0x80 on processors without it. Only five arguments can be passed this
+// way since %ebp is used to remember the user stack.
+#define VSYSCALL_ADDR 0x10000000
+
 #ifndef ASM
 
 #include "types.h"
@@ -16,11 +45,38 @@
 // system calls by user programs. Implemented in syscall-asm.S.
 void system_call_handler();
 
+// SYSENTER entry point, which dispatches through the same syscall_jump_table
+// and returns with SYSEXIT. Implemented in syscall-asm.S.
+void sysenter_entry();
+
 // Responsible for setting up all system calls to their default implementation
-// by filling in the syscall_jump_table.
+// by filling in the syscall_jump_table. Also fills in the vsyscall page.
 // Output: Alters syscall_jump_table.
 void setup_syscalls();
 
+// Points the SYSENTER MSRs of the calling processor at sysenter_entry and at
+// |tss|, whose esp0 the entry code switches to. Does nothing if the processor
+// has no SYSENTER.
+void sysenter_init(void *tss);
+
+// What the entry code leaves at the top of the kernel stack while a syscall
+// runs, lowest address first: the registers SYSCALL_DISPATCH saves and the
+// IRET frame. Both entry points return to user mode with what is in here.
+typedef struct syscall_frame {
+    uint32_t ds;
+    uint32_t ebp;
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t ebx;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} syscall_frame_t;
+
 // Basic function pointer type to represent a system call implementation. Note
 // that an actual syscall impl can have as many arguments as desired.
 typedef int32_t (*syscall_impl)(void);
@@ -1,15 +1,37 @@
 #include "terminal.h"
 #include "lib.h"
 #include "schedule.h"
+#include "spinlock.h"
+#include "pt.h"
 
+// Taken around every write to video memory and the cursor, since processes
+// on other processors may print at the same time.
+spinlock_t terminal_lock = SPINLOCK_INIT;
 
-static char *video_mem = (char *)VIDEO;
 static int screen_x[MAX_NUM_TERMINALS], screen_y[MAX_NUM_TERMINALS];
 static int backspace_flag[MAX_NUM_TERMINALS];
 static int newline_flag[MAX_NUM_TERMINALS];
 int new_line_checklist[MAX_NUM_TERMINALS][NUM_ROWS];
 
+static void scroll(int terminal);
+
+/* Returns the video memory of |terminal|: the VGA buffer while it is visible
+ * and its own page otherwise. The kernel maps both in every address space,
+ * so this works whichever page directory is loaded. The visible terminal only
+ * changes under terminal_lock. */
+static char *terminal_video(int terminal)
+{
+    if (terminal == visible_terminal) {
+        return (char *)VIDEO;
+    }
+    return (char *)TERMINAL_VIDEO_PAGE(terminal);
+}
+
 void internel_terminal_putc(uint8_t c, int terminal) {
+    unsigned long flags;
+    spin_lock_irqsave(&terminal_lock, flags);
+
+    char *video_mem = terminal_video(terminal);
     int old_x = screen_x[terminal];
     /*if c is a newline, go to the next line*/
     if (c == '\n' || c == '\r') {
@@ -21,7 +43,7 @@ void internel_terminal_putc(uint8_t c, int terminal) {
             if (old_x == 0 && newline_flag[terminal] == 1) {
                 newline_flag[terminal] = 0;
             } else {
-                terminal_scroll();
+                scroll(terminal);
             }
         }
         new_line_checklist[terminal][screen_y[terminal]] = 1;
@@ -45,7 +67,7 @@ void internel_terminal_putc(uint8_t c, int terminal) {
             /*if the next line goes out of the screen, scroll the screen*/
             if (screen_y[terminal] >= NUM_ROWS) {
                 screen_y[terminal] = NUM_ROWS - 1;
-                terminal_scroll();
+                scroll(terminal);
                 newline_flag[terminal] = 1;
             }
         }
@@ -54,6 +76,8 @@ void internel_terminal_putc(uint8_t c, int terminal) {
     if(visible_terminal == TERMINAL_INDEX) {
         terminal_cursor(screen_y[visible_terminal], screen_x[visible_terminal]);
     }
+
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 /*
 terminal_putc
@@ -95,28 +119,42 @@ Clear the screen and reset screen_x[TERMINAL_INDEX] as well as screen_y[TERMINAL
 */
 void terminal_clear()
 {
+    terminal_clear_internal(visible_terminal);
+}
+
+/*
+terminal_clear_internal
+Description:
+Clear |terminal|, visible or not, and reset its screen_x and screen_y. The
+cursor only moves if it is the visible one.
+*/
+void terminal_clear_internal(int terminal)
+{
+    unsigned long flags;
+    char *video_mem;
     int32_t i;
     int loop_index;
 
+    spin_lock_irqsave(&terminal_lock, flags);
+    video_mem = terminal_video(terminal);
+
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
         *(uint8_t *)(video_mem + (i << 1)) = ' ';
         *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-        //screen_x[TERMINAL_INDEX] = 0;
-        //screen_y[TERMINAL_INDEX] = 0;
-        screen_x[visible_terminal] = 0;
-        screen_y[visible_terminal] = 0;
     }
+    screen_x[terminal] = 0;
+    screen_y[terminal] = 0;
 
-    /*Clear the new_line_checklist[TERMINAL_INDEX]*/
+    /*Clear the new_line_checklist[terminal]*/
     for (loop_index = 0; loop_index < NUM_ROWS; loop_index++) {
-        //new_line_checklist[TERMINAL_INDEX][loop_index] = 0;
-        new_line_checklist[visible_terminal][loop_index] = 0;
-
+        new_line_checklist[terminal][loop_index] = 0;
     }
 
-    //new_line_checklist[TERMINAL_INDEX][0] = 1; //the first line after clear screen is a newline
-    new_line_checklist[visible_terminal][0] = 1;
-    terminal_cursor(0, 0);
+    new_line_checklist[terminal][0] = 1; //the first line after clear screen is a newline
+    if (terminal == visible_terminal) {
+        terminal_cursor(0, 0);
+    }
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 
 /*
@@ -125,6 +163,7 @@ Description: Display a blue_screen
 */
 void terminal_blue_screen()
 {
+    char *video_mem = terminal_video(TERMINAL_INDEX);
     int32_t i;
     terminal_reset();
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
@@ -202,6 +241,13 @@ Description: Scroll the screen as well as new_line_checklist[TERMINAL_INDEX]
 */
 void terminal_scroll()
 {
+    scroll(TERMINAL_INDEX);
+}
+
+/* Scrolls the screen of |terminal| and its new_line_checklist */
+static void scroll(int terminal)
+{
+    char *video_mem = terminal_video(terminal);
     int32_t i;
     /*Move everything on the screen one line above*/
     memcpy(video_mem, video_mem + NUM_COLS * 2, NUM_COLS * (NUM_ROWS - 1) * 2);
@@ -214,11 +260,11 @@ void terminal_scroll()
 
     /*Move the elements in new_line_checklist[TERMINAL_INDEX] one element above*/
     for (i = 1; i < NUM_ROWS; i++) {
-        new_line_checklist[TERMINAL_INDEX][i - 1] = new_line_checklist[TERMINAL_INDEX][i];
+        new_line_checklist[terminal][i - 1] = new_line_checklist[terminal][i];
     }
 
     /*Clear the last element */
-    new_line_checklist[TERMINAL_INDEX][NUM_ROWS - 1] = 0;
+    new_line_checklist[terminal][NUM_ROWS - 1] = 0;
 }
 
 /*
@@ -276,6 +322,7 @@ void terminal_cursor(int row, int col)
 */
 void test_interrupts(void)
 {
+    char *video_mem = terminal_video(visible_terminal);
     int32_t i;
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
         video_mem[i << 1]++;
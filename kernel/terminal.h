@@ -2,6 +2,7 @@
 #define _TERMINAL
 
 #include "types.h"
+#include "spinlock.h"
 
 #define VIDEO 0xB8000
 #define NUM_COLS 80
@@ -13,7 +14,8 @@
 #define HIGH_PORT 0x0E
 #define MAX_TERMINAL 3
 
-
+/* Protects video memory, the cursor and the screen positions */
+extern spinlock_t terminal_lock;
 
 /*output the buffer to the screen*/
 int32_t terminal_write(const char *buf, int32_t nbytes);
@@ -23,6 +25,8 @@ void internel_terminal_putc(uint8_t c, int terminal);
 void terminal_putc(uint8_t c);
 /*Clear the screen and reset screen_x and screen_y*/
 void terminal_clear();
+/* internal helper that clears a specific terminal */
+void terminal_clear_internal(int terminal);
 /*Display a blue screen*/
 void terminal_blue_screen();
 /*Reset screen_x and screen_y to 0*/
@@ -0,0 +1,378 @@
+/* trace.c - Syscall tracing and statistics
+ * vim:ts=4
+ *
+ * A traced process's syscalls are recorded when they return, in the ring of
+ * the processor they return on. Only that processor writes its ring, with
+ * interrupts off so a preempting process can't write the same slot, and the
+ * reader never blocks it: when the ring is full the oldest records are
+ * overwritten and the reader notices it fell behind from the head index.
+ *
+ * The latency of every syscall, traced or not, also goes into histograms per
+ * syscall and per process, read as text from the sysstat device.
+ */
+
+#include "trace.h"
+#include "lib.h"
+#include "pcb.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "syscall.h"
+#include "tsc.h"
+
+// Longest line trace_read() produces for one record.
+#define TRACE_LINE_SIZE 160
+
+typedef struct trace_ring {
+    // Records ever written. Only the owning processor changes it.
+    volatile uint32_t head;
+    // Records read or dropped. Only changed with trace_lock held.
+    uint32_t tail;
+    trace_rec_t recs[TRACE_RING_SIZE];
+} trace_ring_t;
+
+// Name and number of arguments of every syscall, for printing.
+static const struct {
+    const char *name;
+    int32_t nargs;
+} syscall_names[NUM_SYSCALLS] = {
+    [SYS_HALT] = {"halt", 1},
+    [SYS_EXECUTE] = {"execute", 1},
+    [SYS_READ] = {"read", 3},
+    [SYS_WRITE] = {"write", 3},
+    [SYS_OPEN] = {"open", 1},
+    [SYS_CLOSE] = {"close", 1},
+    [SYS_GETARGS] = {"getargs", 2},
+    [SYS_VIDMAP] = {"vidmap", 1},
+    [SYS_SET_HANDLER] = {"set_handler", 2},
+    [SYS_SIGRETURN] = {"sigreturn", 0},
+    [SYS_GETRUSAGE] = {"getrusage", 2},
+    [SYS_SCHED_SETSCHEDULER] = {"sched_setscheduler", 3},
+    [SYS_GETPID] = {"getpid", 0},
+    [SYS_TRACE] = {"trace", 2},
+    [SYS_FORK] = {"fork", 0},
+    [SYS_SPAWN] = {"spawn", 1},
+    [SYS_WAITPID] = {"waitpid", 3},
+    [SYS_EXEC] = {"exec", 1},
+};
+
+volatile int32_t syscall_trace_active;
+
+static trace_ring_t trace_rings[MAX_CPUS];
+
+// Serializes readers and changes to syscall_trace_active.
+static spinlock_t trace_lock = SPINLOCK_INIT;
+
+// Records overwritten before they could be read.
+static uint32_t trace_dropped;
+
+// Latencies of every syscall on every processor. Each processor only updates
+// its own.
+static hist_t syscall_hists[MAX_CPUS][NUM_SYSCALLS];
+
+/* Appends |rec| to the ring of the calling processor */
+static void trace_emit(const trace_rec_t *rec)
+{
+    unsigned long flags;
+    trace_ring_t *ring;
+
+    cli_and_save(flags);
+    ring = &trace_rings[this_cpu()->id];
+    ring->recs[ring->head & (TRACE_RING_SIZE - 1)] = *rec;
+    // x86 does not reorder stores, so only the compiler needs stopping from
+    // publishing the slot before it is filled in.
+    asm volatile("" ::: "memory");
+    ring->head++;
+    restore_flags(flags);
+}
+
+void trace_syscall_enter(int32_t nr, uint32_t a0, uint32_t a1, uint32_t a2,
+                         uint32_t a3, uint32_t a4, uint32_t a5)
+{
+    int32_t pid = curr_pid;
+    trace_rec_t *rec;
+
+    if (pid < 0 || !GET_PCB_ENTRY(pid)->traced) {
+        return;
+    }
+
+    rec = &GET_PCB_ENTRY(pid)->trace_rec;
+    rec->pid = pid;
+    rec->nr = nr;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    rec->args[3] = a3;
+    rec->args[4] = a4;
+    rec->args[5] = a5;
+    rec->tsc_start = rdtsc();
+
+    // halt does not come back, so record it now with its status as the
+    // return value.
+    if (nr == SYS_HALT) {
+        rec->tsc_end = rec->tsc_start;
+        rec->ret = a0;
+        trace_emit(rec);
+        rec->nr = -1;
+    }
+}
+
+void trace_syscall_exit(int32_t ret)
+{
+    int32_t pid = curr_pid;
+    trace_rec_t *rec;
+
+    if (pid < 0 || !GET_PCB_ENTRY(pid)->traced) {
+        return;
+    }
+
+    // Tracing may have been turned on during this syscall.
+    rec = &GET_PCB_ENTRY(pid)->trace_rec;
+    if (rec->nr < 0) {
+        return;
+    }
+    rec->tsc_end = rdtsc();
+    rec->ret = ret;
+    trace_emit(rec);
+    rec->nr = -1;
+}
+
+int32_t trace_set(int32_t pid, int32_t on)
+{
+    unsigned long flags;
+    pcb_entry_t *pcb;
+
+    if (pid < 0 || pid >= MAX_NUM_PROCESSES) {
+        return -1;
+    }
+
+    // process_lock keeps the PCB from being freed meanwhile.
+    spin_lock_irqsave(&process_lock, flags);
+    pcb = GET_PCB_ENTRY(pid);
+    if (pcb == NULL) {
+        spin_unlock_irqrestore(&process_lock, flags);
+        return -1;
+    }
+    spin_lock(&trace_lock);
+    on = !!on;
+    if (pcb->traced != on) {
+        pcb->trace_rec.nr = -1;
+        pcb->traced = on;
+        syscall_trace_active += on ? 1 : -1;
+    }
+    spin_unlock(&trace_lock);
+    spin_unlock_irqrestore(&process_lock, flags);
+    return 0;
+}
+
+/*
+ * syscall_trace
+ *   DESCRIPTION: Turns syscall tracing of a process on or off
+ *   INPUTS: pid -- process to trace, TRACE_SELF for the caller
+ *           on -- non-zero to trace, 0 to stop
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if pid is not a process
+ *   SIDE EFFECTS: Syscalls of the process show up in the trace device from
+ *                 the next one on.
+ */
+int32_t syscall_trace(int32_t pid, int32_t on)
+{
+    if (pid == TRACE_SELF) {
+        pid = curr_pid;
+    }
+    if (pid < 0 || pid >= MAX_NUM_PROCESSES || !GET_PCB_HOT(pid)->active) {
+        return -1;
+    }
+    return trace_set(pid, on);
+}
+
+/* Copies the oldest unread record of |ring| to |rec|. Returns 0 if there is
+ * none. Must be called with trace_lock held. */
+static int32_t trace_peek(trace_ring_t *ring, trace_rec_t *rec)
+{
+    for (;;) {
+        uint32_t head = ring->head;
+
+        if (head - ring->tail > TRACE_RING_SIZE) {
+            trace_dropped += head - ring->tail - TRACE_RING_SIZE;
+            ring->tail = head - TRACE_RING_SIZE;
+        }
+        if (ring->tail == head) {
+            return 0;
+        }
+
+        *rec = ring->recs[ring->tail & (TRACE_RING_SIZE - 1)];
+        asm volatile("" ::: "memory");
+
+        // The slot is rewritten once the writer gets a whole ring ahead. If
+        // that started while it was copied, the copy may be torn.
+        if (ring->head - ring->tail < TRACE_RING_SIZE) {
+            return 1;
+        }
+        trace_dropped++;
+        ring->tail++;
+    }
+}
+
+/* Formats |rec| from processor |cpu| as one line. Looks like
+ * "1234 ms cpu 0 pid 2: read(0x0, 0x8000F00, 0x80) = 5 (3 us)". */
+static void trace_format(textbuf_t *tb, int32_t cpu, const trace_rec_t *rec)
+{
+    int32_t nargs = MAX_SYSCALL_ARGS;
+    int32_t i;
+
+    tb_putn(tb, div64_32(rec->tsc_start - cpus[0].boot_stamp, tsc_khz), 10, 0);
+    tb_puts(tb, " ms cpu ");
+    tb_putn(tb, cpu, 10, 0);
+    tb_puts(tb, " pid ");
+    tb_putn(tb, rec->pid, 10, 0);
+    tb_puts(tb, ": ");
+    if (rec->nr >= 0 && rec->nr < NUM_SYSCALLS && syscall_names[rec->nr].name) {
+        tb_puts(tb, syscall_names[rec->nr].name);
+        nargs = syscall_names[rec->nr].nargs;
+    } else {
+        tb_puts(tb, "syscall_");
+        tb_putn(tb, rec->nr, 10, 0);
+    }
+    tb_puts(tb, "(");
+    for (i = 0; i < nargs; i++) {
+        if (i) {
+            tb_puts(tb, ", ");
+        }
+        tb_putn(tb, rec->args[i], 16, 0);
+    }
+    tb_puts(tb, ") = ");
+    tb_putn(tb, rec->ret, 10, 1);
+    tb_puts(tb, " (");
+    tb_putn(tb, tsc_to_us(rec->tsc_end - rec->tsc_start), 10, 0);
+    tb_puts(tb, " us)\n");
+}
+
+/*
+ * trace_read
+ *   DESCRIPTION: Reads syscall records from the rings of all processors, one
+ *                processor after the other, formatted as lines of text. Only
+ *                whole lines are returned and those are gone afterwards.
+ *   INPUTS: id, offset -- ignored, the device is not seekable
+ *           buf -- where to put the text
+ *           nbytes -- size of buf
+ *   OUTPUTS: Fills in buf
+ *   RETURN VALUE: bytes put in buf, 0 once there are no records left
+ *   SIDE EFFECTS: Reports how many records were lost to overwriting since the
+ *                 last read, as a line of its own.
+ */
+int32_t trace_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    int8_t line[TRACE_LINE_SIZE];
+    textbuf_t tb;
+    unsigned long flags;
+    uint32_t done = 0;
+    uint32_t len;
+    int32_t cpu;
+    (void)id;
+    (void)offset;
+
+    spin_lock_irqsave(&trace_lock, flags);
+
+    if (trace_dropped) {
+        tb = (textbuf_t){line, line + TRACE_LINE_SIZE};
+        tb_puts(&tb, "dropped ");
+        tb_putn(&tb, trace_dropped, 10, 0);
+        tb_puts(&tb, " records\n");
+        len = tb.pos - line;
+        if (len <= nbytes) {
+            memcpy(buf, line, len);
+            done = len;
+            trace_dropped = 0;
+        }
+    }
+
+    for (cpu = 0; cpu < num_cpus; cpu++) {
+        trace_ring_t *ring = &trace_rings[cpu];
+        trace_rec_t rec;
+
+        while (trace_peek(ring, &rec)) {
+            tb = (textbuf_t){line, line + TRACE_LINE_SIZE};
+            trace_format(&tb, cpu, &rec);
+            len = tb.pos - line;
+            if (done + len > nbytes) {
+                goto out;
+            }
+            memcpy(buf + done, line, len);
+            done += len;
+            ring->tail++;
+        }
+    }
+
+out:
+    spin_unlock_irqrestore(&trace_lock, flags);
+    return done;
+}
+
+void syscall_stats_add(pcb_entry_t *pcb, int32_t nr, uint64_t cycles)
+{
+    unsigned long flags;
+
+    // Interrupts off keeps a preempting process on this processor from
+    // updating the same histogram halfway through.
+    cli_and_save(flags);
+    hist_add(&syscall_hists[this_cpu()->id][nr], cycles);
+    hist_add(&pcb->syscall_hist, cycles);
+    pcb->syscall_counts[nr]++;
+    restore_flags(flags);
+}
+
+/* Builds the text of the syscall statistics device */
+static void syscall_stats_fill(textbuf_t *tb)
+{
+    unsigned long flags;
+    int32_t nr, cpu, pid;
+
+    tb_puts(tb, "syscall latency, buckets are log2 cycles as bucket:count\n");
+    for (nr = 0; nr < NUM_SYSCALLS; nr++) {
+        hist_t total;
+
+        memset(&total, 0, sizeof(total));
+        for (cpu = 0; cpu < num_cpus; cpu++) {
+            hist_merge(&total, &syscall_hists[cpu][nr]);
+        }
+        if (!total.count || !syscall_names[nr].name) {
+            continue;
+        }
+        tb_puts(tb, syscall_names[nr].name);
+        tb_puts(tb, ":");
+        hist_print(tb, &total);
+    }
+
+    spin_lock_irqsave(&process_lock, flags);
+    for_each_pid(pid) {
+        pcb_entry_t *pcb = GET_PCB_ENTRY(pid);
+
+        if (!GET_PCB_HOT(pid)->active) {
+            continue;
+        }
+        tb_puts(tb, "pid ");
+        tb_putn(tb, pid, 10, 0);
+        tb_puts(tb, ":");
+        hist_print(tb, &pcb->syscall_hist);
+        tb_puts(tb, "   ");
+        for (nr = 0; nr < NUM_SYSCALLS; nr++) {
+            if (pcb->syscall_counts[nr] && syscall_names[nr].name) {
+                tb_puts(tb, " ");
+                tb_puts(tb, syscall_names[nr].name);
+                tb_puts(tb, " ");
+                tb_putn(tb, pcb->syscall_counts[nr], 10, 0);
+            }
+        }
+        tb_puts(tb, "\n");
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+static stats_file_t syscall_stats_file = {SPINLOCK_INIT, syscall_stats_fill};
+
+int32_t syscall_stats_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes)
+{
+    (void)id;
+    return stats_file_read(&syscall_stats_file, offset, buf, nbytes);
+}
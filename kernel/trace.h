@@ -0,0 +1,69 @@
+/* trace.h - Syscall tracing and statistics
+ * vim:ts=4
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "types.h"
+
+// Records kept per processor. Must be a power of two.
+#define TRACE_RING_SIZE 256
+
+// Names of the device files the trace records and the syscall statistics
+// are read from.
+#define TRACE_DEVICE_NAME "trace"
+#define SYSCALL_STATS_DEVICE_NAME "sysstat"
+
+// Pass to syscall_trace() to trace the calling process.
+#define TRACE_SELF (-1)
+
+#ifndef ASM
+
+// One traced syscall.
+typedef struct trace_rec {
+    // TSC when the syscall was entered and when it returned. Equal for halt,
+    // which does not return.
+    uint64_t tsc_start;
+    uint64_t tsc_end;
+    int32_t pid;
+    int32_t nr;
+    uint32_t args[6];
+    int32_t ret;
+} trace_rec_t;
+
+// Number of processes being traced. The syscall entry code only calls into
+// trace.c while this isn't 0, so tracing costs one compare when it is off.
+extern volatile int32_t syscall_trace_active;
+
+// Called by the syscall entry code in syscall-asm.S before and after the
+// implementation runs. |nr| and |args| are the ones passed in registers.
+void trace_syscall_enter(int32_t nr, uint32_t a0, uint32_t a1, uint32_t a2,
+                         uint32_t a3, uint32_t a4, uint32_t a5);
+void trace_syscall_exit(int32_t ret);
+
+// Turns tracing of process |pid| on or off. Called by the syscall and when a
+// process is created or halts.
+int32_t trace_set(int32_t pid, int32_t on);
+
+// Syscall: turns tracing on (on != 0) or off for process |pid|, TRACE_SELF
+// for the caller. Children started by a traced process are traced too.
+int32_t syscall_trace(int32_t pid, int32_t on);
+
+// Read operation of the trace device. Returns the oldest records not read
+// yet, one line of text each, and removes them.
+int32_t trace_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+struct pcb_entry;
+
+// Adds a syscall |nr| of |pcb| that took |cycles| to the statistics. Called
+// by acct_syscall_exit().
+void syscall_stats_add(struct pcb_entry *pcb, int32_t nr, uint64_t cycles);
+
+// Read operation of the sysstat device. Returns, as text, the latency
+// histogram of every syscall made so far, and for every process its own
+// histogram and how often it made each syscall.
+int32_t syscall_stats_read(uint32_t id, uint32_t offset, uint8_t *buf, uint32_t nbytes);
+
+#endif /* ASM */
+#endif /* _TRACE_H */
@@ -0,0 +1,102 @@
+/* tsc.c - Calibration of the time stamp counter
+ * vim:ts=4
+ */
+
+#include "tsc.h"
+#include "lib.h"
+
+/* PIT ports used for calibration */
+#define PIT_CHANNEL0_DATA 0x40
+#define PIT_CHANNEL2_DATA 0x42
+#define PIT_COMMAND 0x43
+/* Port B of the keyboard controller, which gates PIT channel 2 */
+#define PIT_GATE_PORT 0x61
+#define PIT_GATE_ENABLE 0x01
+#define PIT_SPEAKER_ENABLE 0x02
+#define PIT_CHANNEL2_OUT 0x20
+/* Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count) */
+#define PIT_CHANNEL2_MODE0 0xB0
+
+/* Read-back command latching the status and count of channel 0. The status
+ * has the level of the channel's output in bit 7. */
+#define PIT_READBACK_CHANNEL0 0xC2
+#define PIT_STATUS_OUT 0x80
+/* The kernel leaves channel 0 in mode 3 with the BIOS reload value of 65536
+ * (18.2 Hz). */
+#define PIT_CHANNEL0_RELOAD 65536
+
+/* Length of the calibration window in milliseconds */
+#define CALIBRATE_MS 10
+
+uint32_t tsc_khz = 0;
+
+/*
+ * tsc_init
+ *   DESCRIPTION: Counts TSC cycles while PIT channel 2 counts down
+ *                CALIBRATE_MS milliseconds and derives the TSC frequency.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Sets tsc_khz. Reprograms PIT channel 2 (the speaker).
+ */
+void tsc_init(void)
+{
+    uint32_t count = PIT_FREQ / 1000 * CALIBRATE_MS;
+    uint64_t start, end;
+
+    /* Raise the gate of channel 2 but keep the speaker off */
+    outb((inb(PIT_GATE_PORT) & ~PIT_SPEAKER_ENABLE) | PIT_GATE_ENABLE, PIT_GATE_PORT);
+
+    outb(PIT_CHANNEL2_MODE0, PIT_COMMAND);
+    outb(count & 0xFF, PIT_CHANNEL2_DATA);
+    outb((count >> 8) & 0xFF, PIT_CHANNEL2_DATA);
+
+    start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_CHANNEL2_OUT)) {
+        /* wait for the count to run out */
+    }
+    end = rdtsc();
+
+    tsc_khz = div64_32(end - start, CALIBRATE_MS);
+    printf("TSC: %u kHz\n", tsc_khz);
+}
+
+void udelay(uint32_t us)
+{
+    uint64_t end = rdtsc() + div64_32((uint64_t)us * tsc_khz, 1000);
+
+    while (rdtsc() < end) {
+        /* wait */
+    }
+}
+
+/*
+ * pit_irq_age
+ *   DESCRIPTION: Works out how long ago PIT channel 0 raised IRQ 0 from its
+ *                count. In mode 3 the output goes high when the IRQ is
+ *                raised and low halfway through the period, and the count
+ *                runs down from the reload value twice as fast in each half.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: TSC cycles since the last rising edge of IRQ 0
+ *   SIDE EFFECTS: Latches channel 0. Must be called with interrupts disabled
+ *                 or from the IRQ 0 handler, so nothing else reads it.
+ */
+uint32_t pit_irq_age(void)
+{
+    uint32_t status, count, ticks;
+
+    outb(PIT_READBACK_CHANNEL0, PIT_COMMAND);
+    status = inb(PIT_CHANNEL0_DATA);
+    count = inb(PIT_CHANNEL0_DATA);
+    count |= inb(PIT_CHANNEL0_DATA) << 8;
+    if (count == 0) {
+        count = PIT_CHANNEL0_RELOAD;
+    }
+
+    ticks = (PIT_CHANNEL0_RELOAD - count) / 2;
+    if (!(status & PIT_STATUS_OUT)) {
+        ticks += PIT_CHANNEL0_RELOAD / 2;
+    }
+    return div64_32((uint64_t)ticks * tsc_khz * 1000, PIT_FREQ);
+}
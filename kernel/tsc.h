@@ -0,0 +1,61 @@
+/* tsc.h - Time stamp counter helpers used for timing and benchmarking
+ * vim:ts=4
+ */
+
+#ifndef _TSC_H
+#define _TSC_H
+
+#include "types.h"
+
+/* Frequency of the PIT input clock in Hz */
+#define PIT_FREQ 1193182
+
+#ifndef ASM
+
+// Measured TSC frequency in kHz (cycles per millisecond). 0 until tsc_init().
+extern uint32_t tsc_khz;
+
+// Measures the TSC frequency against PIT channel 2. Must be called with
+// interrupts disabled.
+void tsc_init(void);
+
+// Busy waits for at least |us| microseconds. Needs tsc_init() to have run.
+void udelay(uint32_t us);
+
+// Returns the TSC cycles since PIT channel 0 last raised IRQ 0.
+uint32_t pit_irq_age(void);
+
+/* Reads the 64 bit time stamp counter */
+static inline uint64_t rdtsc(void)
+{
+    uint64_t val;
+    asm volatile("rdtsc"
+                 : "=A"(val));
+    return val;
+}
+
+/* Divides a 64 bit number by a 32 bit one. The kernel has no libgcc, so 64
+ * bit division has to be done with divl. The quotient is clamped to 32 bits. */
+static inline uint32_t div64_32(uint64_t dividend, uint32_t divisor)
+{
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotient;
+
+    if (divisor == 0 || high >= divisor) {
+        return 0xFFFFFFFF;
+    }
+    asm("divl %2"
+        : "=a"(quotient), "=d"(high)
+        : "rm"(divisor), "0"(low), "1"(high));
+    return quotient;
+}
+
+/* Converts a number of TSC cycles to microseconds */
+static inline uint32_t tsc_to_us(uint64_t cycles)
+{
+    return tsc_khz ? div64_32(cycles * 1000, tsc_khz) : 0;
+}
+
+#endif /* ASM */
+#endif /* _TSC_H */
@@ -0,0 +1,27 @@
+/* wait.c - Wait queues: processes blocked until some condition holds
+ * vim:ts=4
+ */
+
+#include "wait.h"
+#include "pcb.h"
+
+void prepare_to_wait(wait_queue_t *wq)
+{
+    int32_t pid = curr_pid;
+
+    pid_map_set(&wq->waiters, pid);
+    GET_PCB_HOT(pid)->runnable = false;
+}
+
+void wake_up(wait_queue_t *wq)
+{
+    unsigned long flags;
+    int32_t pid;
+
+    spin_lock_irqsave(&wq->lock, flags);
+    for (pid = pid_map_next(&wq->waiters, 0); pid != -1; pid = pid_map_next(&wq->waiters, pid + 1)) {
+        pid_map_clear(&wq->waiters, pid);
+        wake_up_process(pid);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
@@ -0,0 +1,46 @@
+/* wait.h - Wait queues: processes blocked until some condition holds
+ * vim:ts=4
+ */
+
+#ifndef _WAIT_H
+#define _WAIT_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "schedule.h"
+
+/* Processes sleeping on some event */
+typedef struct wait_queue {
+    spinlock_t lock;
+    pid_map_t waiters;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, {{0}} }
+
+// Adds the calling process to |wq| and marks it not runnable, so the next
+// schedule() puts it to sleep. |wq|->lock must be held.
+void prepare_to_wait(wait_queue_t *wq);
+
+// Wakes every process sleeping on |wq|. Safe to call from interrupt handlers.
+void wake_up(wait_queue_t *wq);
+
+/*
+ * Sleeps until |condition| is true. |condition| is evaluated with |wq|->lock
+ * held and interrupts disabled, and anything that can make it true must call
+ * wake_up(wq) afterwards. Only for processes and kernel threads, not for the
+ * idle loop.
+ */
+#define wait_event(wq, condition)                    \
+    do {                                             \
+        unsigned long __flags;                       \
+        spin_lock_irqsave(&(wq)->lock, __flags);     \
+        while (!(condition)) {                       \
+            prepare_to_wait(wq);                     \
+            spin_unlock(&(wq)->lock);                \
+            schedule();                              \
+            spin_lock(&(wq)->lock);                  \
+        }                                            \
+        spin_unlock_irqrestore(&(wq)->lock, __flags); \
+    } while (0)
+
+#endif /* _WAIT_H */
@@ -0,0 +1,81 @@
+/* workqueue.c - Work deferred from interrupt handlers to a kernel thread
+ * vim:ts=4
+ */
+
+#include "workqueue.h"
+#include "kthread.h"
+#include "lib.h"
+#include "pcb.h"
+#include "schedule.h"
+#include "spinlock.h"
+
+// Pending work in the order it was queued.
+static work_t *work_head = NULL;
+static work_t *work_tail = NULL;
+static spinlock_t work_lock = SPINLOCK_INIT;
+
+// Pid of the worker thread, -1 until it is created.
+static int32_t worker_pid = -1;
+
+/* Body of the worker thread. Runs the pending work in order and blocks when
+ * there is none. */
+static void worker_thread(void *arg)
+{
+    unsigned long flags;
+    work_t *work;
+
+    while (1) {
+        spin_lock_irqsave(&work_lock, flags);
+        while (work_head == NULL) {
+            // Checked and cleared under work_lock, which queue_work() holds
+            // while it wakes us, so the wakeup can't be missed.
+            GET_PCB_HOT(curr_pid)->runnable = false;
+            spin_unlock(&work_lock);
+            schedule();
+            spin_lock(&work_lock);
+        }
+        work = work_head;
+        work_head = work->next;
+        if (work_head == NULL) {
+            work_tail = NULL;
+        }
+        work->pending = 0;
+        spin_unlock_irqrestore(&work_lock, flags);
+
+        work->func(work);
+    }
+}
+
+void workqueue_init(void)
+{
+    worker_pid = kthread_create(worker_thread, NULL);
+    if (worker_pid == -1) {
+        printf("workqueue: can't create the worker thread\n");
+    }
+}
+
+int32_t queue_work(work_t *work)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&work_lock, flags);
+    if (work->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return 0;
+    }
+
+    work->pending = 1;
+    work->next = NULL;
+    if (work_tail == NULL) {
+        work_head = work;
+    } else {
+        work_tail->next = work;
+    }
+    work_tail = work;
+
+    if (worker_pid != -1) {
+        wake_up_process(worker_pid);
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+    return 1;
+}
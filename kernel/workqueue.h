@@ -0,0 +1,32 @@
+/* workqueue.h - Work deferred from interrupt handlers to a kernel thread
+ * vim:ts=4
+ */
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+
+struct work;
+typedef void (*work_func_t)(struct work *work);
+
+/* A piece of deferred work. Embed it in whatever state |func| needs. */
+typedef struct work {
+    work_func_t func;
+    struct work *next;
+    // Set from queue_work() until |func| starts running.
+    volatile int32_t pending;
+} work_t;
+
+#define WORK_INIT(fn) { .func = (fn), .next = NULL, .pending = 0 }
+
+// Starts the worker thread. Work queued before this runs once it starts.
+void workqueue_init(void);
+
+// Queues |work| to run on the worker thread with interrupts enabled. Safe to
+// call from interrupt handlers. Work that is already pending is not queued
+// twice, so |func| must handle everything that accumulated since it last ran.
+// Return: 1 if |work| was queued, 0 if it was already pending.
+int32_t queue_work(work_t *work);
+
+#endif /* _WORKQUEUE_H */
@@ -19,6 +19,20 @@
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE 104
 
+/* Model specific registers SYSENTER loads CS, ESP and EIP from. SS is the
+ * selector after CS, and SYSEXIT uses the two after that for user mode. */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* CPUID leaf 1 EDX bit: SYSENTER/SYSEXIT are supported */
+#define CPUID_FEATURE_SEP (1 << 11)
+
+/* Number of descriptors in the GDT (see x86_desc.S) */
+#define GDT_ENTRIES 8
+/* Index of the TSS descriptor in the GDT */
+#define GDT_TSS_INDEX (KERNEL_TSS >> 3)
+
 #ifndef ASM
 
 /* This structure is used to load descriptor base registers
@@ -109,6 +123,7 @@ typedef struct __attribute__((packed)) tss_t {
 
 /* Some external descriptors declared in .S files */
 extern x86_desc_t gdt_desc;
+extern seg_desc_t gdt[GDT_ENTRIES];
 
 extern uint16_t ldt_desc;
 extern uint32_t ldt_size;
@@ -140,6 +155,18 @@ extern tss_t tss;
         str.seg_lim_15_00 = (lim)&0x0000FFFF;                 \
     } while (0)
 
+/* Load the global descriptor table (GDT) register.  This macro takes a
+ * 6-byte structure (x86_desc_t) holding the size and base address of the
+ * GDT.  Segment registers keep their cached descriptors, so the new table
+ * must have the same layout as the old one */
+#define lgdt(desc)                \
+    do {                          \
+        asm volatile("lgdt %0"    \
+                     :            \
+                     : "m"(desc)  \
+                     : "memory"); \
+    } while (0)
+
 /* Load task register.  This macro takes a 16-bit index into the GDT,
  * which points to the TSS entry.  x86 then reads the GDT's TSS
  * descriptor and loads the base address specified in that descriptor
@@ -164,6 +191,24 @@ extern tss_t tss;
                      : "memory"); \
     } while (0)
 
+/* Write the 64 bit model specific register |msr| */
+#define wrmsr(msr, low, high)                          \
+    do {                                               \
+        asm volatile("wrmsr"                           \
+                     :                                 \
+                     : "c"(msr), "a"(low), "d"(high)   \
+                     : "memory");                      \
+    } while (0)
+
+/* Returns EDX of CPUID leaf 1, the basic feature flags */
+static inline uint32_t cpuid_features(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid"
+                 : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
 #endif /* ASM */
 
 #endif /* _x86_DESC_H */